@@ -0,0 +1,198 @@
+/*
+ * bufpool - size classed buffers with a cap on the total memory they use
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "bufpool.h"
+
+/* Each power of two is split into 1 << SUBCLASS_SHIFT classes */
+#define SUBCLASS_SHIFT	2
+#define N_CLASSES	(((64 - BUFPOOL_MIN_SHIFT) << SUBCLASS_SHIFT) + 1)
+
+struct free_buf {
+	struct free_buf *next;
+};
+
+struct bufpool {
+	pthread_mutex_t lock;
+	size_t max_size;
+	size_t cap;
+	int no_reuse;
+
+	size_t in_use;		/* handed out */
+	size_t cached;		/* sitting on free lists */
+	struct free_buf *free[N_CLASSES];
+};
+
+/* Which class does a buffer of size bytes come from, and how big are
+ * buffers in that class
+ */
+static int size_class(size_t size, size_t *class_size) {
+	int shift, sub;
+
+	if (size <= (1UL << BUFPOOL_MIN_SHIFT)) {
+		*class_size = 1UL << BUFPOOL_MIN_SHIFT;
+		return 0;
+	}
+
+	/* 1 << shift < size <= 1 << (shift + 1) */
+	shift = 63 - __builtin_clzl(size - 1);
+	sub = (size - 1 - (1UL << shift)) >> (shift - SUBCLASS_SHIFT);
+	*class_size = (1UL << shift) + ((size_t)(sub + 1) << (shift - SUBCLASS_SHIFT));
+	return ((shift - BUFPOOL_MIN_SHIFT) << SUBCLASS_SHIFT) + sub + 1;
+}
+
+/* How big the buffers in class c are */
+static size_t class_bytes(int c) {
+	int shift;
+
+	if (c == 0)
+		return 1UL << BUFPOOL_MIN_SHIFT;
+	shift = BUFPOOL_MIN_SHIFT + ((c - 1) >> SUBCLASS_SHIFT);
+	return (1UL << shift)
+		+ ((size_t)(((c - 1) & ((1 << SUBCLASS_SHIFT) - 1)) + 1) << (shift - SUBCLASS_SHIFT));
+}
+
+static uint8_t *alloc_buf(struct bufpool *pool, size_t size) {
+	uint8_t *buf;
+
+	if (!pool->no_reuse)
+		return malloc(size);
+
+	buf = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	return buf == MAP_FAILED ? NULL : buf;
+}
+
+static void free_buf(struct bufpool *pool, void *buf, size_t size) {
+	if (pool->no_reuse)
+		munmap(buf, size);
+	else
+		free(buf);
+}
+
+struct bufpool *bufpool_new(size_t max_size, size_t cap, int no_reuse) {
+	struct bufpool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->max_size = max_size;
+	pool->cap = cap;
+	pool->no_reuse = no_reuse;
+	return pool;
+}
+
+void bufpool_free(struct bufpool *pool) {
+	int c;
+
+	for (c = 0; c < N_CLASSES; c++) {
+		struct free_buf *fb, *next;
+
+		for (fb = pool->free[c]; fb != NULL; fb = next) {
+			next = fb->next;
+			free(fb);
+		}
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/* Give cached buffers back, biggest first, until need more bytes fit
+ * under the cap. Called with the lock held.
+ */
+static void make_room(struct bufpool *pool, size_t need) {
+	int c;
+
+	for (c = N_CLASSES - 1; c >= 0; c--) {
+		while (pool->free[c] != NULL
+				&& pool->in_use + pool->cached + need > pool->cap) {
+			struct free_buf *fb = pool->free[c];
+
+			pool->free[c] = fb->next;
+			pool->cached -= class_bytes(c);
+			free(fb);
+		}
+	}
+}
+
+uint8_t *bufpool_get(struct bufpool *pool, size_t size, size_t *bufsize) {
+	uint8_t *buf;
+	int c;
+
+	if (size > pool->max_size) {
+		errno = E2BIG;
+		return NULL;
+	}
+	c = size_class(size, bufsize);
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->free[c] != NULL) {
+		buf = (uint8_t *)pool->free[c];
+		pool->free[c] = pool->free[c]->next;
+		pool->cached -= *bufsize;
+		pool->in_use += *bufsize;
+		pthread_mutex_unlock(&pool->lock);
+		return buf;
+	}
+
+	if (pool->in_use + *bufsize > pool->cap) {
+		pthread_mutex_unlock(&pool->lock);
+		errno = ENOMEM;
+		return NULL;
+	}
+	make_room(pool, *bufsize);
+	pool->in_use += *bufsize;
+	pthread_mutex_unlock(&pool->lock);
+
+	buf = alloc_buf(pool, *bufsize);
+	if (buf == NULL) {
+		pthread_mutex_lock(&pool->lock);
+		pool->in_use -= *bufsize;
+		pthread_mutex_unlock(&pool->lock);
+		errno = ENOMEM;
+	}
+	return buf;
+}
+
+void bufpool_put(struct bufpool *pool, uint8_t *buf, size_t bufsize) {
+	size_t class_size;
+	int c;
+
+	if (pool->no_reuse) {
+		free_buf(pool, buf, bufsize);
+		pthread_mutex_lock(&pool->lock);
+		pool->in_use -= bufsize;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	c = size_class(bufsize, &class_size);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->in_use -= bufsize;
+	((struct free_buf *)buf)->next = pool->free[c];
+	pool->free[c] = (struct free_buf *)buf;
+	pool->cached += bufsize;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+size_t bufpool_buffer_size(size_t size) {
+	size_t class_size;
+
+	size_class(size, &class_size);
+	return class_size;
+}
+
+size_t bufpool_in_use(struct bufpool *pool) {
+	size_t in_use;
+
+	pthread_mutex_lock(&pool->lock);
+	in_use = pool->in_use;
+	pthread_mutex_unlock(&pool->lock);
+	return in_use;
+}
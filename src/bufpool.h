@@ -0,0 +1,47 @@
+/*
+ * bufpool - size classed buffers with a cap on the total memory they use
+ *
+ * Buffers are rounded up to one of four size classes per power of two
+ * (so at most 25% is wasted) and kept on a free list per class when
+ * they're given back. Everything the pool has allocated, in use or
+ * sitting on a free list, counts towards the cap; free buffers are
+ * released to make room for a new one before we give up.
+ *
+ * Safe to use from multiple threads.
+ */
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Smallest buffer we'll hand out is 1 << BUFPOOL_MIN_SHIFT */
+#define BUFPOOL_MIN_SHIFT	16
+
+struct bufpool;
+
+/* max_size is the largest buffer that can be asked for, cap the most
+ * memory the pool will ever hold.
+ *
+ * If no_reuse is set buffers are freshly mapped for every bufpool_get()
+ * and unmapped when they're put back.
+ */
+struct bufpool *bufpool_new(size_t max_size, size_t cap, int no_reuse);
+void bufpool_free(struct bufpool *pool);
+
+/* Get a buffer of at least size bytes. *bufsize is set to how big it
+ * actually is, which needs to be passed back to bufpool_put()
+ *
+ * returns NULL if size is bigger than the pool's max_size, or if
+ * handing it out would put us over the cap (errno is E2BIG or ENOMEM)
+ */
+uint8_t *bufpool_get(struct bufpool *pool, size_t size, size_t *bufsize);
+void bufpool_put(struct bufpool *pool, uint8_t *buf, size_t bufsize);
+
+/* How big a buffer we'd actually hand out for size bytes */
+size_t bufpool_buffer_size(size_t size);
+
+/* Bytes handed out and not yet put back */
+size_t bufpool_in_use(struct bufpool *pool);
+
+#endif
@@ -5,8 +5,11 @@
  *		  Can also pretend to be an ingestd (dangerous) or snif the
  *		  telemetry socket of an existing broker (passive)
  *
+ *		  Or spool them to disk until an ingestd is back, see spool.h
+ *
  * output format is the DataBurst length as a network byte ordered uint32
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +17,24 @@
 #include <unistd.h>
 #include <endian.h>
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <zmq.h>
 #include <lz4.h>
 
-#include "DataFrame.pb-c.h"
-#include "DataBurst.pb-c.h"
+#include "bufpool.h"
+#include "burststream.h"
+#include "intern.h"
+#include "spool.h"
+#include "throughput.h"
+#include "timeidx.h"
+#include "wire.h"
 
 #define DEBUG
 
@@ -29,46 +45,1375 @@
 #endif
 
 
-#define INITIAL_DECOMPRESS_BUFSIZE 1024000
+/* Biggest DataBurst we'll decompress, and the most memory we'll have
+ * tied up in decompressed bursts at once
+ */
+#define DEFAULT_MAX_BURST_SIZE	(512UL * 1024 * 1024)
+#define DEFAULT_MEMORY_CAP	(2048UL * 1024 * 1024)
+
+/* Space in front of every decompression buffer for the length header
+ * (and checksum when spooling), so a burst goes out as a single iovec
+ */
+#define BURST_HEADROOM SPOOL_RECORD_HEADER
+
+/* Most bursts we'll queue up for a single writev()/vmsplice(), which
+ * is as many iovecs as Linux takes (IOV_MAX)
+ */
+#define OUTQ_MAX_BURSTS 1024
+
+/* In pipelined mode, how many bursts each decompression thread can
+ * have queued up in front of the writer before we stop reading from
+ * the socket
+ */
+#define PIPELINE_SLOTS_PER_WORKER 4
+
+/* Where the writer thread hands acks back to the receiver thread, which
+ * owns the zmq socket they need to go out on
+ */
+#define ACK_PIPE_ADDRESS "inproc://burstnetsink-acks"
+
+/* -R and -H give up on bursts that haven't been acked after this long */
+#define DEFAULT_EXPIRE_SECONDS	600
+
+/* In -f mode, how much of a burst we decompress at a time */
+#define STREAM_CHUNK_SIZE (256 * 1024)
+
+static int verbose = 0;
+static int hexdump = 0;
+static int dummy_mode = 0;
+static int slow_mode = 0;
+static int broker_sub = 0;
+static int fake_ingestd = 0;
+static int just_points = 0;
+static int count_sources = 0;
+static int print_rates = 0;
+static int print_percentiles = 0;
+static double expire_seconds = DEFAULT_EXPIRE_SECONDS;
+static int zero_copy = 0;
+static int stream_frames = 0;
+static size_t flush_bytes = 0;
+static long group_usec = 0;
+static int group_bursts = OUTQ_MAX_BURSTS;
+static char *spool_dir = NULL;
+static size_t spool_segment_size = SPOOL_DEFAULT_SEGMENT_SIZE;
+static size_t max_burst_size = DEFAULT_MAX_BURST_SIZE;
+static size_t memory_cap = DEFAULT_MEMORY_CAP;
+static char *index_path = NULL;
+static size_t index_span = TIMEIDX_DEFAULT_SPAN;
+
+/* Where decompression buffers come from */
+static struct bufpool *pool;
+
+/* -R: what broker_throughput.py would have made of -v -p output */
+static struct throughput rates;
+
+/* Every source -P has seen */
+static struct intern_table sources;
+
+/* -I: the time index of what we're writing to stdout, see timeidx.h
+ *
+ * Spans are closed as their last burst is queued, but only go in the
+ * index once outq_flush() has written them, so the index never points
+ * at anything that isn't in the capture yet
+ */
+static struct {
+	int fd;
+	uint64_t offset;		/* in the capture of the next record */
+	uint64_t max_so_far;
+	struct timeidx_entry span;	/* being filled, if len isn't 0 */
+	struct timeidx_entry done[OUTQ_MAX_BURSTS];
+	int n_done;
+} tidx;
+
+#define verbose_printf(...) { if (verbose) fprintf(stderr, __VA_ARGS__); }
+
+enum recv_status {
+	RECV_ERROR = -1,	/* socket error. errno is set */
+	RECV_SKIP,		/* short message, already cleaned up */
+	RECV_BURST,		/* got a burst */
+	RECV_ACK		/* got an ingestd ack on the broker telemetry socket */
+};
+
+enum burst_status {
+	BURST_OK,
+	BURST_SKIP,		/* invalid, but not fatal. skip_reason says why */
+	BURST_FATAL		/* decompression failure */
+};
+
+/* A received DataBurst, and the space to decompress it into
+ */
+struct burst {
+	zmq_msg_t ident;
+	zmq_msg_t msg_id;
+	zmq_msg_t msg;
+
+	int header_valid;
+	uint32_t compressed_size;
+	uint32_t uncompressed_size;
+
+	enum burst_status status;
+	const char *skip_reason;
+
+	uint8_t *buf;		/* BURST_HEADROOM bytes in from the allocation */
+	size_t bufsize;
+	int size;		/* decompressed size */
+	uint32_t checksum;	/* spool_checksum() of buf, when spooling */
+
+	int decoded;		/* pipeline: set once a worker is done */
+};
+
+/* Bursts waiting to go out to stdout in a single writev()/vmsplice()
+ *
+ * The buffers belong to whoever queued them and have to stay put until
+ * outq_flush() returns
+ */
+struct outq {
+	int fd;
+	int use_vmsplice;
+	int sync;		/* fdatasync() after every flush */
+	struct iovec iov[OUTQ_MAX_BURSTS];
+	int iovcnt;
+	size_t pending;		/* bytes, including anything sitting in stdio */
+
+	/* When spooling, fd is the current segment */
+	uint64_t segment;
+	size_t segment_used;	/* including anything queued */
+	size_t segment_size;
+};
+
+static int outq_flush(struct outq *q);
+
+/* Find the newest segment already in the spool (0 if there are none)
+ */
+static int spool_last_segment(uint64_t *last) {
+	DIR *dir;
+	struct dirent *de;
+
+	dir = opendir(spool_dir);
+	if (dir == NULL)
+		return perror(spool_dir), -1;
+
+	*last = 0;
+	while ((de = readdir(dir)) != NULL) {
+		unsigned long long seq;
+		if (sscanf(de->d_name, SPOOL_PREFIX "%llu", &seq) == 1 && seq > *last)
+			*last = seq;
+	}
+	closedir(dir);
+	return 0;
+}
+
+/* Close the current spool segment and start the next one, with room for
+ * at least record_size bytes
+ *
+ * We never append to a segment we didn't create, so a restart always
+ * starts a new one.
+ */
+static int spool_next_segment(struct outq *q, size_t record_size) {
+	char path[PATH_MAX];
+	uint8_t header[SPOOL_HEADER_SIZE];
+	uint64_t n_seq;
+	size_t size;
+	int fd, dir_fd;
+
+	size = spool_segment_size;
+	if (size < record_size + SPOOL_HEADER_SIZE)
+		size = record_size + SPOOL_HEADER_SIZE;
 
-/* write out a DataBurst
+	if (q->fd >= 0 && close(q->fd) < 0)
+		return perror("close (spool segment)"), -1;
+	q->fd = -1;
+
+	q->segment++;
+	snprintf(path, sizeof(path), "%s/" SPOOL_NAME_FORMAT, spool_dir,
+		(unsigned long long)q->segment);
+	fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0644);
+	if (fd < 0)
+		return perror(path), -1;
+
+	/* Allocate the whole thing now, so syncing what we write into it
+	 * later only has to flush data
+	 */
+	errno = posix_fallocate(fd, 0, size);
+	if (errno)
+		return perror("posix_fallocate (spool segment)"), close(fd), -1;
+
+	memcpy(header, SPOOL_MAGIC, sizeof(n_seq));
+	n_seq = htobe64(q->segment);
+	memcpy(header + sizeof(n_seq), &n_seq, sizeof(n_seq));
+	if (write(fd, header, sizeof(header)) != sizeof(header))
+		return perror("write (spool segment)"), close(fd), -1;
+
+	/* Make sure the segment and its directory entry will survive a
+	 * crash before anything we're going to ack goes into it
+	 */
+	if (fsync(fd) < 0)
+		return perror("fsync (spool segment)"), close(fd), -1;
+	dir_fd = open(spool_dir, O_RDONLY|O_DIRECTORY);
+	if (dir_fd < 0 || fsync(dir_fd) < 0)
+		return perror("fsync (spool directory)"), close(fd), -1;
+	close(dir_fd);
+
+	verbose_printf("spooling to %s\n", path);
+	q->fd = fd;
+	q->segment_used = SPOOL_HEADER_SIZE;
+	q->segment_size = size;
+	return 0;
+}
+
+/* Start the -I index of what's about to go to stdout, or carry on with
+ * it if stdout is a file we're adding to
  *
- * First writes out the length of the databurst as a network
- * byte ordered uint32
+ * Anything in the capture the index doesn't cover yet (the span that
+ * was still filling up when we last stopped) gets an entry that matches
+ * any time, so it's still read.
  *
- * returns >= 1 on success
+ * returns -1 on failure
  */
-int write_burst(FILE *fp, uint8_t *packed_burst, size_t packed_size) {
-	int n_burstlen;
+static int timeidx_open(uint32_t kind) {
+	uint8_t header[TIMEIDX_HEADER_SIZE];
+	struct timeidx_entry last, gap;
+	struct stat st;
+	off_t pos;
+	int flags;
+
+	/* Where we'll be writing in the capture */
+	tidx.offset = 0;
+	if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode)) {
+		flags = fcntl(STDOUT_FILENO, F_GETFL);
+		if (flags >= 0 && (flags & O_APPEND))
+			tidx.offset = st.st_size;
+		else if ((pos = lseek(STDOUT_FILENO, 0, SEEK_CUR)) > 0)
+			tidx.offset = pos;
+	}
+
+	tidx.fd = open(index_path, O_RDWR|O_CREAT|O_APPEND, 0644);
+	if (tidx.fd < 0 || fstat(tidx.fd, &st) < 0)
+		return perror(index_path), -1;
+
+	/* A new capture gets a new index */
+	if (tidx.offset == 0 && st.st_size) {
+		verbose_printf("starting %s over\n", index_path);
+		if (ftruncate(tidx.fd, 0) < 0)
+			return perror(index_path), -1;
+		st.st_size = 0;
+	}
+
+	if (st.st_size == 0) {
+		memset(header, 0, sizeof(header));
+		memcpy(header, TIMEIDX_MAGIC, 8);
+		memcpy(header + 8, &kind, sizeof(kind));
+		if (write(tidx.fd, header, sizeof(header)) != sizeof(header))
+			return perror("write (index)"), -1;
+		memset(&last, 0, sizeof(last));
+	} else {
+		if (pread(tidx.fd, header, sizeof(header), 0) != sizeof(header)
+				|| memcmp(header, TIMEIDX_MAGIC, 8)
+				|| memcmp(header + 8, &kind, sizeof(kind))
+				|| (st.st_size - TIMEIDX_HEADER_SIZE) % sizeof(last)) {
+			fprintf(stderr, "%s isn't a time index of %s\n", index_path,
+				kind == TIMEIDX_FRAMES ? "DataFrames" : "DataBursts");
+			return -1;
+		}
+		memset(&last, 0, sizeof(last));
+		if (st.st_size > TIMEIDX_HEADER_SIZE
+				&& pread(tidx.fd, &last, sizeof(last), st.st_size - sizeof(last)) != sizeof(last))
+			return perror(index_path), -1;
+		if (last.offset + last.len > tidx.offset) {
+			fprintf(stderr, "%s indexes more than stdout has in it\n", index_path);
+			return -1;
+		}
+	}
+	tidx.max_so_far = last.max_so_far;
+
+	if (last.offset + last.len < tidx.offset) {
+		gap.offset = last.offset + last.len;
+		gap.len = tidx.offset - gap.offset;
+		gap.min_timestamp = 0;
+		gap.max_timestamp = gap.max_so_far = tidx.max_so_far = UINT64_MAX;
+		if (write(tidx.fd, &gap, sizeof(gap)) != sizeof(gap))
+			return perror("write (index)"), -1;
+	}
+	return 0;
+}
+
+/* Count a record of len bytes, holding frames from min to max, into the
+ * span being filled
+ */
+static void timeidx_add(size_t len, uint64_t min, uint64_t max) {
+	struct timeidx_entry *span = &tidx.span;
+
+	if (span->len == 0) {
+		span->offset = tidx.offset;
+		span->min_timestamp = UINT64_MAX;
+		span->max_timestamp = 0;
+	}
+	span->len += len;
+	tidx.offset += len;
+	if (min < span->min_timestamp)
+		span->min_timestamp = min;
+	if (max > span->max_timestamp)
+		span->max_timestamp = max;
+}
+
+/* At the end of a burst, close the span if it's big enough. That's any
+ * size at all with a span size of 0
+ */
+static void timeidx_end_burst(void) {
+	struct timeidx_entry *span = &tidx.span;
+
+	if (span->len == 0 || span->len < index_span)
+		return;
+	if (span->max_timestamp > tidx.max_so_far)
+		tidx.max_so_far = span->max_timestamp;
+	span->max_so_far = tidx.max_so_far;
+
+	assert(tidx.n_done < OUTQ_MAX_BURSTS);
+	tidx.done[tidx.n_done++] = *span;
+	span->len = 0;
+}
+
+/* Add the spans closed since the last flush to the index, now that
+ * they've been written
+ *
+ * returns -1 on failure
+ */
+static int timeidx_flush(int sync) {
+	ssize_t size = tidx.n_done * sizeof(tidx.done[0]);
+
+	if (size == 0)
+		return 0;
+	if (write(tidx.fd, tidx.done, size) != size)
+		return -1;
+	tidx.n_done = 0;
+	if (sync && fdatasync(tidx.fd) < 0)
+		return -1;
+	return 0;
+}
+
+static int outq_init(struct outq *q, int fd) {
+	struct stat st;
+
+	memset(q, 0, sizeof(*q));
+
+	if (spool_dir) {
+		q->fd = -1;
+		q->sync = 1;
+		if (spool_last_segment(&q->segment) < 0)
+			return -1;
+		return spool_next_segment(q, 0);
+	}
+
+	q->fd = fd;
+	if (fstat(fd, &st) < 0)
+		return 0;
+	q->use_vmsplice = zero_copy && S_ISFIFO(st.st_mode);
+	if (zero_copy && !q->use_vmsplice)
+		verbose_printf("stdout isn't a pipe, using writev\n");
+
+	/* When group committing to a file, by time or by bytes, a commit
+	 * means it's on disk */
+	q->sync = (flush_bytes || group_usec) && S_ISREG(st.st_mode);
+	return 0;
+}
+
+/* queue up a DataBurst
+ *
+ * The length of the databurst goes in front of it as a network
+ * byte ordered uint32 (followed by its checksum if we're spooling), in
+ * the headroom of the burst's buffer
+ *
+ * returns -1 on failure
+ */
+static int outq_add(struct outq *q, struct burst *b) {
+	size_t header = spool_dir ? SPOOL_RECORD_HEADER : sizeof(uint32_t);
+	size_t len = b->size + header;
+	uint8_t *start = b->buf - header;
+	uint32_t n_burstlen = htonl(b->size);
+
+	if (spool_dir && q->segment_used + len > q->segment_size) {
+		/* Anything already queued is laid out for this segment */
+		if (outq_flush(q) < 0 || spool_next_segment(q, len) < 0)
+			return -1;
+	}
+
+	assert(q->iovcnt < OUTQ_MAX_BURSTS);
+	memcpy(start, &n_burstlen, sizeof(n_burstlen));
+	if (spool_dir) {
+		uint32_t n_checksum = htonl(b->checksum);
+		memcpy(start + sizeof(n_burstlen), &n_checksum, sizeof(n_checksum));
+		q->segment_used += len;
+	}
+	q->iov[q->iovcnt].iov_base = start;
+	q->iov[q->iovcnt].iov_len = len;
+	q->iovcnt++;
+	q->pending += len;
+	return 0;
+}
+
+/* Have we queued up enough that it's time to write it out?
+ *
+ * With neither a byte nor a time window, that's every burst
+ */
+static int outq_full(struct outq *q) {
+	if (q->iovcnt == OUTQ_MAX_BURSTS)
+		return 1;
+	if (flush_bytes)
+		return q->pending >= flush_bytes;
+	return !group_usec;
+}
+
+/* write out everything queued (or buffered by stdio)
+ *
+ * returns -1 on failure
+ */
+static int outq_flush(struct outq *q) {
+	struct iovec *iov = q->iov;
+	int iovcnt = q->iovcnt;
+
+	if (fflush(stdout))
+		return -1;
+
+	while (iovcnt) {
+		ssize_t n;
+
+		if (q->use_vmsplice)
+			n = vmsplice(q->fd, iov, iovcnt, 0);
+		else
+			n = writev(q->fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		/* Skip past whatever made it out */
+		while (iovcnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++; iovcnt--;
+		}
+		if (n) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	if (q->sync && q->pending && fdatasync(q->fd) < 0)
+		return -1;
 
-	n_burstlen = htonl(packed_size);
-	if (fwrite(&n_burstlen, sizeof(n_burstlen), 1, fp) != 1)
+	q->iovcnt = 0;
+	q->pending = 0;
+	if (index_path && timeidx_flush(q->sync) < 0)
 		return -1;
-	return fwrite(packed_burst, packed_size, 1, fp);
+	return 0;
 }
 
 /* most inefficient hexdump on the planet */
-void fhexdump(FILE *fp, uint8_t *buf, size_t bufsiz) {
+void fhexdump(FILE *fp, const uint8_t *buf, size_t bufsiz) {
 	while (bufsiz--)
 		fprintf(fp,"%02x", *(buf++));
 }
 
+/* receive a message part, retrying if we get interrupted
+ */
+static int recv_part(zmq_msg_t *msg, void *sock) {
+	int rx;
+	do { rx = zmq_msg_recv(msg, sock, 0);
+	} while (rx < 0 && errno == EINTR);
+	return rx;
+}
+
+/* Receive the 3 part ident, msg_id, burst message
+ *
+ * On RECV_BURST and RECV_ACK the caller owns all three parts of b
+ */
+static enum recv_status recv_burst(void *sock, struct burst *b) {
+	zmq_msg_init(&b->ident);
+	zmq_msg_init(&b->msg_id);
+	zmq_msg_init(&b->msg);
+
+	if (recv_part(&b->ident, sock) < 1)
+		return perror("zmq_msg_recv (ident_rx)"), RECV_ERROR;
+	if (!zmq_msg_more(&b->ident)) {
+		fprintf(stderr, "Got short message (only 1 part). Skipping\n");
+		zmq_msg_close(&b->ident);
+		return RECV_SKIP;
+	}
+
+	if (recv_part(&b->msg_id, sock) < 1)
+		return perror("zmq_msg_recv (msg_id_rx)"), RECV_ERROR;
+	if (!zmq_msg_more(&b->msg_id)) {
+		fprintf(stderr, "Got short message (only 2 parts). Skipping\n");
+		zmq_msg_close(&b->ident); zmq_msg_close(&b->msg_id);
+		return RECV_SKIP;
+	}
+
+	if (recv_part(&b->msg, sock) < 0)
+		return perror("zmq_msg_recv (burst_rx)"), RECV_ERROR;
+	if (broker_sub && zmq_msg_size(&b->msg) == 0)
+		return RECV_ACK;
+
+	return RECV_BURST;
+}
+
+/* Get a buffer to decompress b into, going by the size in its header
+ *
+ * In zero copy mode the pool maps fresh pages for every burst. Once
+ * we've vmsplice()d pages into a pipe we can't write to them again until
+ * the other end has read them, and there's no way of telling when that
+ * happens, so they get unmapped by burst_buffer_done() instead of reused.
+ *
+ * Bursts with no header, or that are bigger than max_burst_size, don't
+ * get a buffer. decode_burst() will skip them.
+ *
+ * returns -1 if there isn't room under memory_cap right now
+ */
+static int reserve_burst(struct burst *b) {
+	uint8_t *buf;
+	size_t size;
+
+	if (dummy_mode || b->buf != NULL || zmq_msg_size(&b->msg) <= 8)
+		return 0;
+
+	size = le32toh(*(uint32_t *)zmq_msg_data(&b->msg));
+	if (size > max_burst_size)
+		return 0;
+
+	buf = bufpool_get(pool, size + BURST_HEADROOM, &b->bufsize);
+	if (buf == NULL)
+		return -1;
+	b->buf = buf + BURST_HEADROOM;
+	b->bufsize -= BURST_HEADROOM;
+	return 0;
+}
+
+/* Finished with the contents of b's buffer
+ */
+static void burst_buffer_done(struct burst *b) {
+	if (b->buf == NULL)
+		return;
+	bufpool_put(pool, b->buf - BURST_HEADROOM, b->bufsize + BURST_HEADROOM);
+	b->buf = NULL;
+	b->bufsize = 0;
+}
+
+static void close_burst_msgs(struct burst *b) {
+	zmq_msg_close(&b->ident);
+	zmq_msg_close(&b->msg_id);
+	zmq_msg_close(&b->msg);
+}
+
+static void report_ack(struct burst *b) {
+	if (!verbose) return;
+	flockfile(stderr);
+	fprintf(stderr,"got ingestd ACK\n\tidentity:\t0x");
+	fhexdump(stderr, zmq_msg_data(&b->ident), zmq_msg_size(&b->ident));
+	fprintf(stderr, "\n\tmessage id:\t0x");
+	fhexdump(stderr, zmq_msg_data(&b->msg_id), zmq_msg_size(&b->msg_id));
+	fputc('\n', stderr);
+	funlockfile(stderr);
+}
+
+/* Check a received burst's header against the message it came in
+ *
+ * Doesn't write anything to stderr so it can be run out of order;
+ * report_burst() covers that once we know where we are.
+ */
+static enum burst_status check_burst(struct burst *b) {
+	uint8_t *compressed_buffer;
+	size_t msg_size = zmq_msg_size(&b->msg);
+
+	b->header_valid = 0;
+	b->skip_reason = NULL;
+	b->size = 0;
+
+	/* The databurst has an 8 byte header. 2 uint32s with
+	* little endian ordering advising compressed and
+	* decompressed size for some lz4 implementations.
+	*
+	* We can ignore this as we don't need to know the original
+	* size to decompress
+	*/
+	if (msg_size <= 8) {
+		b->skip_reason = "Got short message (small payload). Skipping\n";
+		return b->status = BURST_SKIP;
+	}
+	compressed_buffer = (uint8_t *)zmq_msg_data(&b->msg);
+
+	b->uncompressed_size = le32toh(*(uint32_t *)compressed_buffer);
+	compressed_buffer += sizeof(uint32_t);
+
+	b->compressed_size = le32toh(*(uint32_t *)compressed_buffer);
+	compressed_buffer += sizeof(uint32_t);
+	b->header_valid = 1;
+
+	if (msg_size != (b->compressed_size + 8)) {
+		b->skip_reason = "Message size and header payload size don't match. skipping\n";
+		return b->status = BURST_SKIP;
+	}
+
+	assert(((uint8_t *)zmq_msg_data(&b->msg) + 8) == compressed_buffer);
+
+	return b->status = BURST_OK;
+}
+
+/* Validate and decompress a received burst into its buffer
+ *
+ * Like check_burst(), quiet so it can be run out of order.
+ */
+static enum burst_status decode_burst(struct burst *b) {
+	uint8_t *compressed_buffer = (uint8_t *)zmq_msg_data(&b->msg) + 8;
+
+	if (check_burst(b) != BURST_OK || dummy_mode)
+		return b->status;
+
+	/* reserve_burst() sized our buffer off the header.
+	*
+	* We shouldn't trust the burst header here as it could easily be
+	* used to DoS based on memory usage.  At the same time, databursts
+	* can legitimately be hundreds of MB in size, so the limit is
+	* max_burst_size, and memory_cap stops us having too many of them
+	* on the go at once.
+	*/
+	if (b->uncompressed_size > max_burst_size) {
+		b->skip_reason = "DataBurst is bigger than the maximum burst size. skipping\n";
+		return b->status = BURST_SKIP;
+	}
+	assert(b->buf != NULL);
+
+	/* Decompress the databurst. -m keeps the buffer to what an int
+	 * can say, but don't count on it */
+	b->size = LZ4_decompress_safe(
+		(const char *)compressed_buffer,
+		(char *)b->buf,
+		(int)b->compressed_size,
+		b->bufsize > INT_MAX ? INT_MAX : (int)b->bufsize);
+
+	if (b->size < 1) {
+		b->skip_reason = "DataBurst decompression failure\n";
+		return b->status = BURST_FATAL;
+	}
+
+	/* Crosscheck decompressed size is what we expect */
+	if (b->size != b->uncompressed_size) {
+		b->skip_reason = "uncompressed DataBurst size and header don't match. skipping\n";
+		return b->status = BURST_SKIP;
+	}
+
+	if (spool_dir)
+		b->checksum = spool_checksum(b->buf, b->size);
+
+	return b->status = BURST_OK;
+}
+
+/* Tell the world what decode_burst() found
+ */
+static void report_burst(struct burst *b) {
+	flockfile(stderr);
+	if (verbose) {
+		fprintf(stderr, "received %lu bytes\n\tidentity:\t0x", zmq_msg_size(&b->msg));
+		fhexdump(stderr, zmq_msg_data(&b->ident), zmq_msg_size(&b->ident));
+		fprintf(stderr, "\n\tmessage id:\t0x");
+		fhexdump(stderr, zmq_msg_data(&b->msg_id), zmq_msg_size(&b->msg_id));
+		fputc('\n', stderr);
+		if (b->header_valid)
+			fprintf(stderr, "\tcompressed:\t%u bytes\n\tuncompressed:\t%u bytes\n",
+				b->compressed_size,
+				b->uncompressed_size);
+	}
+	if (b->skip_reason)
+		fputs(b->skip_reason, stderr);
+	funlockfile(stderr);
+}
+
+static double now_seconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* -P: have we seen the source of this frame before?
+ *
+ * returns 1 if it's new, 0 if not and -1 if the frame is malformed
+ */
+static int new_source(const uint8_t *buf, size_t len) {
+	struct wire_frame frame;
+	struct wire_bytes key;
+	uint64_t hash;
+
+	if (wire_decode_frame(buf, len, &frame) < 0)
+		return -1;
+	key = wire_frame_source(&frame);
+	hash = intern_hash(key.data, key.len);
+	if (intern_find(&sources, key.data, key.len, hash))
+		return 0;
+	intern_add(&sources, key.data, key.len, hash, "", 0);
+	return 1;
+}
+
+/* returns how many frames in the burst had new sources, or -1 */
+static long count_new_sources(const uint8_t *buf, size_t len) {
+	const uint8_t *cursor = buf;
+	struct wire_bytes frame;
+	long n_new = 0;
+	int more, new;
+
+	while ((more = wire_burst_next(&cursor, buf + len, &frame)) > 0) {
+		if ((new = new_source(frame.data, frame.len)) < 0)
+			return -1;
+		n_new += new;
+	}
+	return more < 0 ? -1 : n_new;
+}
+
+static void print_sources(long n_new) {
+	printf("\tnew sources:\t%ld\n\tsource hits:\t%lu of %lu\n", n_new,
+		sources.hits, sources.hits + sources.misses);
+}
+
+/* -I: index a decoded burst that's about to be queued
+ */
+static void index_burst(struct burst *b) {
+	const uint8_t *cursor = b->buf;
+	struct wire_bytes frame;
+	uint64_t timestamp, min = UINT64_MAX, max = 0;
+
+	while (wire_burst_next(&cursor, b->buf + b->size, &frame) > 0) {
+		if (wire_frame_timestamp(frame.data, frame.len, &timestamp) < 0)
+			continue;
+		if (timestamp < min)
+			min = timestamp;
+		if (timestamp > max)
+			max = timestamp;
+	}
+	timeidx_add(b->size + sizeof(uint32_t), min, max);
+	timeidx_end_burst();
+}
+
+/* Write out a decoded burst in whatever form was asked for
+ *
+ * Plain bursts get queued on q, anything else goes through stdio. It's
+ * up to the caller to flush q either way.
+ *
+ * returns -1 on failure
+ */
+static int output_burst(struct burst *b, struct outq *q) {
+	if (dummy_mode)
+		return 0;
+
+	if (print_rates) {
+		long n_frames = wire_burst_count(b->buf, b->size);
+
+		if (n_frames < 0)
+			fprintf(stderr, "failed to decode protobuf\n");
+		else
+			throughput_burst(&rates,
+				zmq_msg_data(&b->ident), zmq_msg_size(&b->ident),
+				zmq_msg_data(&b->msg_id), zmq_msg_size(&b->msg_id),
+				n_frames, now_seconds());
+		return 0;
+	}
+
+	if (just_points) {
+		/* Only the frames need finding, not decoding */
+		long n_frames = wire_burst_count(b->buf, b->size);
+		long n_new = 0;
+
+		if (n_frames >= 0 && count_sources)
+			n_new = count_new_sources(b->buf, b->size);
+		if (n_frames < 0 || n_new < 0) {
+			fprintf(stderr, "failed to decode protobuf\n");
+		} else {
+			printf("\tpoints:\t\t%u\n", (unsigned int)n_frames);
+			if (count_sources)
+				print_sources(n_new);
+		}
+
+	} else if (hexdump) {
+		fhexdump(stdout, b->buf, b->size);
+		printf("\n");
+	}
+	else {
+		if (index_path)
+			index_burst(b);
+		return outq_add(q, b);
+	}
+
+	q->pending += b->size;
+	return ferror(stdout) ? -1 : 0;
+}
+
+/* Somewhere to put DataFrames as stream_burst() comes across them
+ */
+struct frame_stream {
+	struct frame_splitter splitter;
+	uint8_t *work;		/* LZ4_CHUNKED_WORKSIZE(STREAM_CHUNK_SIZE) */
+	uint32_t frames;
+	uint32_t new_sources;
+	int write_failed;
+};
+
+static int stream_frame(const uint8_t *frame, size_t len, void *arg) {
+	struct frame_stream *fs = arg;
+	uint32_t n_len = htonl(len);
+
+	fs->frames++;
+	if (count_sources) {
+		int new = new_source(frame, len);
+		if (new < 0)
+			return -1;
+		fs->new_sources += new;
+	}
+	if (just_points)
+		return 0;
+
+	if (index_path) {
+		uint64_t timestamp;
+
+		if (wire_frame_timestamp(frame, len, &timestamp) < 0)
+			timeidx_add(len + sizeof(n_len), UINT64_MAX, 0);
+		else
+			timeidx_add(len + sizeof(n_len), timestamp, timestamp);
+	}
+
+	if (hexdump) {
+		fhexdump(stdout, frame, len);
+		printf("\n");
+	} else {
+		fwrite(&n_len, sizeof(n_len), 1, stdout);
+		fwrite(frame, 1, len, stdout);
+	}
+	if (ferror(stdout)) {
+		fs->write_failed = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Decompress b a chunk at a time, writing out each DataFrame in it as
+ * soon as we come across it, so we never hold more than a chunk of the
+ * burst.
+ *
+ * There's no going back once a frame is out: if the burst turns out to
+ * be bad part way through, whatever came before it has been written.
+ */
+static enum burst_status stream_burst(struct burst *b, struct frame_stream *fs) {
+	long size;
+
+	check_burst(b);
+	report_burst(b);
+	if (b->status != BURST_OK || dummy_mode)
+		return b->status;
+
+	fs->frames = 0;
+	fs->new_sources = 0;
+	fs->write_failed = 0;
+	splitter_reset(&fs->splitter);
+	size = lz4_decompress_chunked(
+		(uint8_t *)zmq_msg_data(&b->msg) + 8,
+		b->compressed_size,
+		b->uncompressed_size,
+		fs->work, STREAM_CHUNK_SIZE,
+		splitter_feed, &fs->splitter);
+
+	/* Whatever frames made it out are in the capture either way */
+	if (index_path)
+		timeidx_end_burst();
+
+	if (fs->write_failed)
+		return perror("writing dataframe"), b->status = BURST_FATAL;
+
+	if (size == LZ4_CHUNKED_CORRUPT) {
+		fputs("DataBurst decompression failure\n", stderr);
+		return b->status = BURST_FATAL;
+	}
+	if (size >= 0 && size != b->uncompressed_size) {
+		fputs("uncompressed DataBurst size and header don't match. skipping\n", stderr);
+		return b->status = BURST_SKIP;
+	}
+
+	if (size < 0 || splitter_finish(&fs->splitter) < 0)
+		fputs("failed to decode protobuf\n", stderr);
+	else if (just_points) {
+		printf("\tpoints:\t\t%u\n", fs->frames);
+		if (count_sources)
+			print_sources(fs->new_sources);
+	}
+
+	return b->status = BURST_OK;
+}
+
+/* -R: print a line for every second that's gone by, then wait for
+ * something to turn up on sock, but only until the next one is due
+ *
+ * returns -1 on failure
+ */
+static int wait_for_rates(void *sock) {
+	static double next_line;
+	zmq_pollitem_t item = { sock, 0, ZMQ_POLLIN, 0 };
+
+	if (next_line == 0)
+		next_line = now_seconds() + 1;
+
+	while (1) {
+		double now = now_seconds();
+
+		if (now >= next_line) {
+			while (now >= next_line) {
+				throughput_print(&rates, stdout, now);
+				next_line += 1;
+			}
+			if (fflush(stdout))
+				return perror("writing rates"), -1;
+		}
+
+		if (zmq_poll(&item, 1, (long)((next_line - now) * 1000) + 1) < 0) {
+			if (errno == EINTR) continue;
+			return perror("zmq_poll"), -1;
+		}
+		if (item.revents & ZMQ_POLLIN)
+			return 0;
+	}
+}
+
+/* Send an ack for ident/msg_id out of sock. Takes ownership of both.
+ *
+ * returns -1 on failure
+ */
+static int send_ack(void *sock, zmq_msg_t *ident, zmq_msg_t *msg_id) {
+	if (slow_mode)
+		usleep(1000000);
+
+	if(zmq_msg_send(ident, sock, ZMQ_SNDMORE) < 0)
+		return perror("zmq_send (ident)"), -1;
+	if(zmq_msg_send(msg_id, sock, ZMQ_SNDMORE) < 0)
+		return perror("zmq_send (msg_id)"), -1;
+	if (zmq_send(sock, NULL, 0, 0) < 0)
+		return perror("zmq_send (null ack)"), -1;
+	return 0;
+}
+
+/*
+ * Receive handler.
+ *
+ *	* receive the message
+ *	* write out
+ *	* ack once write successful
+ */
+static int run_single(void *zmq_sock) {
+	struct burst b;
+	struct outq out;
+	struct frame_stream fs;
+
+	memset(&b, 0, sizeof(b));
+	if (outq_init(&out, STDOUT_FILENO) < 0)
+		return 1;
+
+	if (stream_frames) {
+		splitter_init(&fs.splitter, max_burst_size, stream_frame, &fs);
+		fs.work = malloc(LZ4_CHUNKED_WORKSIZE(STREAM_CHUNK_SIZE));
+		if (fs.work == NULL)
+			return perror("malloc"), 1;
+		setvbuf(stdout, NULL, _IOFBF, STREAM_CHUNK_SIZE);
+	}
+
+	while(1) {
+		if (print_rates && wait_for_rates(zmq_sock) < 0)
+			return 1;
+
+		switch (recv_burst(zmq_sock, &b)) {
+			case RECV_ERROR: return 1;
+			case RECV_SKIP: continue;
+			case RECV_ACK:
+				report_ack(&b);
+				if (print_rates)
+					throughput_ack(&rates,
+						zmq_msg_data(&b.ident), zmq_msg_size(&b.ident),
+						zmq_msg_data(&b.msg_id), zmq_msg_size(&b.msg_id),
+						now_seconds());
+				close_burst_msgs(&b);
+				continue;
+			case RECV_BURST: break;
+		}
+
+		if (stream_frames) {
+			/* Written out as we go */
+			stream_burst(&b, &fs);
+		} else {
+			/* Only one burst at a time, so the cap can't get in the way */
+			if (reserve_burst(&b) < 0)
+				return perror("allocating decompression buffer"), 1;
+
+			decode_burst(&b);
+			report_burst(&b);
+		}
+		if (b.status == BURST_FATAL)
+			return 1;
+		if (b.status == BURST_SKIP) {
+			/* Frames streamed out before it went bad are in the
+			 * capture, so they (and their span of the index) have
+			 * to go out the same as a good burst's
+			 */
+			if (stream_frames && outq_flush(&out) < 0)
+				return perror("writing dataframe"), 1;
+			close_burst_msgs(&b);
+			burst_buffer_done(&b);
+			continue;
+		}
+
+		/* Write out and flush */
+		if (!stream_frames && output_burst(&b, &out) < 0)
+			return perror("writing databurst"), 1;
+		if (outq_flush(&out) < 0)
+			return perror("writing databurst"), 1;
+		burst_buffer_done(&b);
+
+		/* Send back acks if we aren't passively listening */
+		if (!broker_sub) {
+			if (send_ack(zmq_sock, &b.ident, &b.msg_id) < 0)
+				return 1;
+		}
+		else {
+			/* No acks as we're just subscribing so we need to
+			 * clean up the message headers */
+			zmq_msg_close(&b.ident);
+			zmq_msg_close(&b.msg_id);
+		}
+		zmq_msg_close(&b.msg);
+	}
+	DEBUG_PRINTF("done\n");
+
+	return 0;
+}
+
+/*
+ * Pipelined receive handler
+ *
+ * The receiving thread (the one that owns the zmq socket) reads bursts
+ * into a ring of slots. A pool of worker threads decompress and check
+ * them in whatever order they finish, and a single writer thread writes
+ * them out in the order they arrived.
+ *
+ * The writer holds on to slots until their bursts are actually written
+ * out: that happens once flush_bytes are queued, once group_usec have
+ * passed since the first burst it's holding, or (without a group commit
+ * window) when it runs out of decoded bursts to look at. Every slot
+ * held is flushed (and fdatasync()ed if we're group committing to a file)
+ * in one go before any of their acks go back.
+ *
+ * The writer can't touch the zmq socket, so once a burst is written it
+ * passes [ident][msg_id] back over an inproc socket and the receiver
+ * sends the ack. A single empty part means a slot was freed but there's
+ * nothing to ack. The receiver stops reading from the network when all
+ * slots are in use, or there isn't room under memory_cap to decompress
+ * the last burst it read, and waits on the ack pipe instead.
+ */
+struct held_ack {
+	int ack;
+	zmq_msg_t ident;
+	zmq_msg_t msg_id;
+};
+
+struct pipeline {
+	struct burst *slots;
+	unsigned nslots;
+
+	/* Sequence numbers. slot = seq % nslots
+	 *
+	 * next_write <= next_out <= next_decode <= next_rx
+	 */
+	uint64_t next_rx;
+	uint64_t next_decode;
+	uint64_t next_out;	/* writer only. next_write..next_out are queued */
+	uint64_t next_write;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;	/* receiver -> workers */
+	pthread_cond_t burst_decoded;	/* workers -> writer */
+
+	void *ack_pipe;			/* writer's end */
+	struct outq out;
+	struct held_ack *acks;
+};
+
+static void *pipeline_worker(void *arg) {
+	struct pipeline *p = arg;
+
+	while (1) {
+		struct burst *b;
+
+		pthread_mutex_lock(&p->lock);
+		while (p->next_decode == p->next_rx)
+			pthread_cond_wait(&p->work_ready, &p->lock);
+		b = &p->slots[p->next_decode++ % p->nslots];
+		pthread_mutex_unlock(&p->lock);
+
+		decode_burst(b);
+
+		pthread_mutex_lock(&p->lock);
+		b->decoded = 1;
+		pthread_cond_broadcast(&p->burst_decoded);
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+static int slot_ready(struct pipeline *p, uint64_t seq) {
+	return seq < p->next_rx && p->slots[seq % p->nslots].decoded;
+}
+
+/* Write out everything the writer has queued, then hand back the slots
+ * along with their acks
+ */
+static void pipeline_flush(struct pipeline *p) {
+	uint64_t seq, first = p->next_write, last = p->next_out;
+
+	if (outq_flush(&p->out) < 0)
+		perror("writing databurst"), exit(1);
+
+	/* Take the acks out of the slots before handing them back, the
+	 * receiver is free to reuse them as soon as next_write moves
+	 */
+	for (seq = first; seq < last; seq++) {
+		struct burst *b = &p->slots[seq % p->nslots];
+		struct held_ack *a = &p->acks[seq - first];
+
+		a->ack = b->status == BURST_OK && !broker_sub;
+		zmq_msg_init(&a->ident);
+		zmq_msg_init(&a->msg_id);
+		zmq_msg_move(&a->ident, &b->ident);
+		zmq_msg_move(&a->msg_id, &b->msg_id);
+		close_burst_msgs(b);
+		burst_buffer_done(b);
+		b->decoded = 0;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->next_write = last;
+	pthread_mutex_unlock(&p->lock);
+
+	for (seq = first; seq < last; seq++) {
+		struct held_ack *a = &p->acks[seq - first];
+
+		if (a->ack) {
+			if (zmq_msg_send(&a->ident, p->ack_pipe, ZMQ_SNDMORE) < 0
+					|| zmq_msg_send(&a->msg_id, p->ack_pipe, 0) < 0)
+				perror("zmq_send (ack pipe)"), exit(1);
+		} else {
+			zmq_msg_close(&a->ident);
+			zmq_msg_close(&a->msg_id);
+			if (zmq_send(p->ack_pipe, NULL, 0, 0) < 0)
+				perror("zmq_send (ack pipe)"), exit(1);
+		}
+	}
+}
+
+static int window_passed(struct timespec *deadline) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec
+		&& now.tv_nsec >= deadline->tv_nsec);
+}
+
+static void *pipeline_writer(void *arg) {
+	struct pipeline *p = arg;
+	struct timespec deadline;
+
+	while (1) {
+		struct burst *b;
+
+		pthread_mutex_lock(&p->lock);
+		while (!slot_ready(p, p->next_out)) {
+			if (p->next_out != p->next_write) {
+				/* Don't sit on anything past the group commit
+				 * window while we wait, if there is one */
+				if (!group_usec || pthread_cond_timedwait(
+						&p->burst_decoded, &p->lock,
+						&deadline) == ETIMEDOUT) {
+					pthread_mutex_unlock(&p->lock);
+					pipeline_flush(p);
+					pthread_mutex_lock(&p->lock);
+				}
+				continue;
+			}
+			pthread_cond_wait(&p->burst_decoded, &p->lock);
+		}
+		b = &p->slots[p->next_out % p->nslots];
+		pthread_mutex_unlock(&p->lock);
+
+		/* First one in, start the clock */
+		if (group_usec && p->next_out == p->next_write) {
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += group_usec / 1000000;
+			deadline.tv_nsec += (group_usec % 1000000) * 1000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+		}
+
+		report_burst(b);
+		if (b->status == BURST_FATAL)
+			exit(1);
+
+		if (b->status == BURST_OK && output_burst(b, &p->out) < 0)
+			perror("writing databurst"), exit(1);
+		p->next_out++;
+
+		if (outq_full(&p->out)
+				|| p->next_out - p->next_write == p->nslots
+				|| p->next_out - p->next_write == (uint64_t)group_bursts
+				|| (group_usec && window_passed(&deadline)))
+			pipeline_flush(p);
+	}
+	return NULL;
+}
+
+/* Pass an ack from the writer thread out onto the network
+ */
+static int forward_ack(void *ack_pipe, void *zmq_sock) {
+	zmq_msg_t ident, msg_id;
+
+	zmq_msg_init(&ident);
+	if (recv_part(&ident, ack_pipe) < 0)
+		return perror("zmq_msg_recv (ack pipe)"), -1;
+	if (!zmq_msg_more(&ident)) {
+		/* Just a slot being freed */
+		zmq_msg_close(&ident);
+		return 0;
+	}
+
+	zmq_msg_init(&msg_id);
+	if (recv_part(&msg_id, ack_pipe) < 0)
+		return perror("zmq_msg_recv (ack pipe)"), -1;
+
+	return send_ack(zmq_sock, &ident, &msg_id);
+}
+
+static int run_pipelined(void *zmq_context, void *zmq_sock, int n_workers) {
+	struct pipeline p;
+	pthread_condattr_t condattr;
+	pthread_t thread;
+	void *ack_pipe_rx;
+	int waiting_for_memory = 0;
+	unsigned i;
+
+	memset(&p, 0, sizeof(p));
+	p.nslots = n_workers * PIPELINE_SLOTS_PER_WORKER;
+
+	/* A group commit can only hold as many bursts as there are slots,
+	 * so make room for -G of them whatever -t is. The writer stops
+	 * at -G however many more there are
+	 */
+	if ((flush_bytes || group_usec) && p.nslots < group_bursts)
+		p.nslots = group_bursts;
+	p.slots = calloc(p.nslots, sizeof(*p.slots));
+	p.acks = calloc(p.nslots, sizeof(*p.acks));
+	if (p.slots == NULL || p.acks == NULL)
+		return perror("calloc"), 1;
+	if (outq_init(&p.out, STDOUT_FILENO) < 0)
+		return 1;
+
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.work_ready, NULL);
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&p.burst_decoded, &condattr);
+
+	/* inproc needs the bind to happen before the connect */
+	ack_pipe_rx = zmq_socket(zmq_context, ZMQ_PAIR);
+	if (zmq_bind(ack_pipe_rx, ACK_PIPE_ADDRESS))
+		return perror("zmq_bind (ack pipe)"), 1;
+	p.ack_pipe = zmq_socket(zmq_context, ZMQ_PAIR);
+	if (zmq_connect(p.ack_pipe, ACK_PIPE_ADDRESS))
+		return perror("zmq_connect (ack pipe)"), 1;
+
+	verbose_printf("pipelining with %d decompression threads\n", n_workers);
+	for (i = 0; i < n_workers; i++) {
+		if (pthread_create(&thread, NULL, pipeline_worker, &p))
+			return perror("pthread_create"), 1;
+		pthread_detach(thread);
+	}
+	if (pthread_create(&thread, NULL, pipeline_writer, &p))
+		return perror("pthread_create"), 1;
+	pthread_detach(thread);
+
+	while (1) {
+		zmq_pollitem_t items[] = {
+			{ ack_pipe_rx, 0, ZMQ_POLLIN, 0 },
+			{ zmq_sock, 0, ZMQ_POLLIN, 0 }
+		};
+		/* We're the only one who advances next_rx, and we know it's
+		 * behind next_write + nslots, so the slot is ours
+		 */
+		struct burst *b = &p.slots[p.next_rx % p.nslots];
+		int full, idle;
+
+		pthread_mutex_lock(&p.lock);
+		full = (p.next_rx - p.next_write) >= p.nslots;
+		idle = p.next_rx == p.next_write;
+		pthread_mutex_unlock(&p.lock);
+
+		if (waiting_for_memory) {
+			if (reserve_burst(b) == 0) {
+				waiting_for_memory = 0;
+				goto queue_burst;
+			}
+			if (idle)
+				return perror("allocating decompression buffer"), 1;
+		}
+
+		/* If we're full, only listen for the writer freeing up
+		 * a slot. Anything else can wait on the network
+		 */
+		if (zmq_poll(items, full || waiting_for_memory ? 1 : 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			return perror("zmq_poll"), 1;
+		}
+
+		if (items[0].revents & ZMQ_POLLIN) {
+			if (forward_ack(ack_pipe_rx, zmq_sock) < 0)
+				return 1;
+		}
+
+		if (full || waiting_for_memory || !(items[1].revents & ZMQ_POLLIN))
+			continue;
+
+		switch (recv_burst(zmq_sock, b)) {
+			case RECV_ERROR: return 1;
+			case RECV_SKIP: continue;
+			case RECV_ACK:
+				report_ack(b);
+				close_burst_msgs(b);
+				continue;
+			case RECV_BURST: break;
+		}
+
+		/* Hang on to it and stop reading until the writer hands
+		 * back some memory
+		 */
+		if (reserve_burst(b) < 0) {
+			waiting_for_memory = 1;
+			continue;
+		}
+
+queue_burst:
+		pthread_mutex_lock(&p.lock);
+		p.next_rx++;
+		pthread_cond_signal(&p.work_ready);
+		pthread_mutex_unlock(&p.lock);
+	}
+
+	return 0;
+}
+
 int main(int argc, char **argv) {
 	void *zmq_context = zmq_ctx_new();
 	void *zmq_sock;
-	uint8_t *decompressed_buffer;
-	size_t decompressed_bufsize = INITIAL_DECOMPRESS_BUFSIZE;
-	int verbose = 0;
-	int hexdump = 0;
-	int dummy_mode = 0;
-	int slow_mode = 0;
-	int broker_sub = 0;
-	int fake_ingestd = 0;
-	int just_points = 0;
+	int n_workers = 0;
 	char *zmq_sock_address;
 
-#define verbose_printf(...) { if (verbose) fprintf(stderr, __VA_ARGS__); }
-
 	if (argc < 2) {
 		fprintf(stderr, "%s [-v] [-x] <zmq socket>\n\n"
 				"\t\t-v\tverbose\n"
@@ -79,10 +1424,49 @@ int main(int argc, char **argv) {
 				"\t\t-b\tconnect to the telemetry port of a broker"
 				" rather than listening\n"
 				"\t\t-p\tprint the number of points in a burst only\n"
+				"\t\t-P\tlike -p, and how many of their sources haven't"
+				" been seen before\n"
+				"\t\t-R\tprint points and acks per second, ack latency"
+				" and unacked\n\t\t\tpoints every second, like"
+				" broker_throughput.py. use with -b\n"
+				"\t\t-H\tlike -R, but the 50th, 90th, 99th and 99.9th"
+				" percentile and\n\t\t\tbiggest ack latency instead,"
+				" and by identity\n\t\t\tover each window every minute\n"
+				"\t\t-E secs\twith -R or -H, give up on bursts that haven't"
+				" been acked\n\t\t\tafter this long (default %d, 0 never)\n"
 				"\t\t-i\tconnect to the ingestd (outgoing) port of a broker"
 				" rather than listening\n\t\t\tWARNING: THIS WILL ACK AND DESTROY"
 				" ANY FRAMES THAT IT RECEIVES THAT WERE DESTINED FOR VAULTAIRE\n"
-				, argv[0]);
+				"\t\t-t n\tpipelined mode. decompress with n threads,"
+				" write and ack\n\t\t\tin the order received from a"
+				" separate thread\n"
+				"\t\t-f\tstream DataFrames rather than DataBursts,"
+				" decompressing a chunk\n\t\t\tat a time."
+				" -m limits the biggest frame instead\n"
+				"\t\t-z\tzero copy. vmsplice() bursts into stdout if"
+				" it is a pipe\n"
+				"\t\t-F n\thold off writing (and acking)"
+				" until n bytes are queued.\n\t\t\tfdatasync() if stdout is a file\n"
+				"\t\t-g usec\tgroup commit. hold off writing (and acking)"
+				" for up to usec\n\t\t\tafter the first burst received."
+				" fdatasync() if stdout is a file\n"
+				"\t\t-G n\twith -F or -g, hold at most n bursts"
+				" (default and most %d)\n"
+				"\t\t\t-F and -g imply -t 1\n"
+				"\t\t-S dir\tspool bursts to segment files in dir rather"
+				" than stdout.\n\t\t\tbursts are only acked once"
+				" fdatasync()ed. see spoolcat\n"
+				"\t\t-L n\tpreallocate spool segments n bytes long\n"
+				"\t\t-m n\tskip DataBursts bigger than n bytes"
+				" decompressed (default %lu)\n"
+				"\t\t-M n\tstop reading from the network while n bytes"
+				" are tied up in\n\t\t\tdecompressed DataBursts"
+				" (default %lu)\n"
+				"\t\t-I file\tkeep a time index of stdout in file,"
+				" for framecat -i\n"
+				"\t\t-J n\tindex spans of at least n bytes (default %d)."
+				" 0 indexes\n\t\t\tevery burst\n"
+				, argv[0], DEFAULT_EXPIRE_SECONDS, OUTQ_MAX_BURSTS, DEFAULT_MAX_BURST_SIZE, DEFAULT_MEMORY_CAP, TIMEIDX_DEFAULT_SPAN);
 		return 1;
 	}
 
@@ -105,17 +1489,127 @@ int main(int argc, char **argv) {
 			fake_ingestd =  1;
 		else if (strncmp("-p", *argv, 3) == 0)
 			just_points =  1;
+		else if (strncmp("-P", *argv, 3) == 0)
+			just_points = count_sources = 1;
+		else if (strncmp("-R", *argv, 3) == 0)
+			print_rates = 1;
+		else if (strncmp("-H", *argv, 3) == 0)
+			print_rates = print_percentiles = 1;
+		else if (strncmp("-E", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			expire_seconds = atof(*argv);
+		}
+		else if (strncmp("-t", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			n_workers = atoi(*argv);
+			if (n_workers < 1) {
+				fprintf(stderr, "-t needs at least 1 thread\n");
+				return 1;
+			}
+		}
+		else if (strncmp("-z", *argv, 3) == 0)
+			zero_copy = 1;
+		else if (strncmp("-f", *argv, 3) == 0)
+			stream_frames = 1;
+		else if (strncmp("-F", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			flush_bytes = strtoul(*argv, NULL, 10);
+		}
+		else if (strncmp("-g", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			group_usec = atol(*argv);
+		}
+		else if (strncmp("-G", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			group_bursts = atoi(*argv);
+			if (group_bursts < 1 || group_bursts > OUTQ_MAX_BURSTS) {
+				fprintf(stderr, "-G has to be 1 to %d\n", OUTQ_MAX_BURSTS);
+				return 1;
+			}
+		}
+		else if (strncmp("-S", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			spool_dir = *argv;
+		}
+		else if (strncmp("-L", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			spool_segment_size = strtoul(*argv, NULL, 10);
+		}
+		else if (strncmp("-m", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			max_burst_size = strtoul(*argv, NULL, 10);
+		}
+		else if (strncmp("-M", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			memory_cap = strtoul(*argv, NULL, 10);
+		}
+		else if (strncmp("-I", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			index_path = *argv;
+		}
+		else if (strncmp("-J", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			index_span = strtoul(*argv, NULL, 10);
+		}
 		else break;
 		argv++; argc--;
 	}
 	zmq_sock_address = *argv;
 
+	if (spool_dir && (just_points || hexdump)) {
+		fprintf(stderr, "can only spool whole bursts (no -p or -x)\n");
+		return 1;
+	}
 
-	/* Need some space to decompress the databursts into
+	/* Frames go out as they're decompressed, so there's nothing to
+	 * hand over to other threads or put in a spool
 	 */
-	decompressed_buffer = malloc(decompressed_bufsize);
-	if (decompressed_buffer == NULL)
-		return perror("malloc"), 1;
+	if (stream_frames && (n_workers || flush_bytes || group_usec || spool_dir || zero_copy)) {
+		fprintf(stderr, "-f can't be used with -t, -F, -g, -S or -z\n");
+		return 1;
+	}
+
+	/* Bursts are only counted, on the thread that sees the acks */
+	if (print_rates && (just_points || hexdump || dummy_mode || stream_frames || spool_dir
+			|| index_path || n_workers || flush_bytes || group_usec)) {
+		fprintf(stderr, "-R and -H can't be used with -p, -P, -x, -d, -f, -S, -I, -t, -F or -g\n");
+		return 1;
+	}
+
+	/* The index is of the bursts (or frames) in stdout */
+	if (index_path && (just_points || hexdump || dummy_mode || spool_dir)) {
+		fprintf(stderr, "-I can't be used with -p, -P, -x, -d or -S\n");
+		return 1;
+	}
+
+	/* LZ4 sizes are ints, so the biggest burst's buffer has to be one
+	 * once the pool's rounded it up to a size class */
+	if (max_burst_size > INT_MAX
+			|| bufpool_buffer_size(max_burst_size + BURST_HEADROOM) > INT_MAX) {
+		fprintf(stderr, "-m %lu is too big. Its buffer, rounded up to a size"
+			" class, has to be at most %d bytes\n", max_burst_size, INT_MAX);
+		return 1;
+	}
+
+	/* We always need to be able to fit at least the biggest burst */
+	if (memory_cap < bufpool_buffer_size(max_burst_size + BURST_HEADROOM)) {
+		fprintf(stderr, "-M has to be at least %lu to fit a %lu byte DataBurst\n",
+			bufpool_buffer_size(max_burst_size + BURST_HEADROOM),
+			max_burst_size);
+		return 1;
+	}
+	if (count_sources)
+		intern_init(&sources, 1 << 20);
+	if (print_rates) {
+		throughput_init(&rates, now_seconds());
+		rates.percentiles = print_percentiles;
+		rates.expire_after = expire_seconds;
+	}
+	pool = bufpool_new(max_burst_size + BURST_HEADROOM, memory_cap, zero_copy);
+	if (pool == NULL)
+		return perror("bufpool_new"), 1;
+	if (index_path && timeidx_open(stream_frames ? TIMEIDX_FRAMES : TIMEIDX_BURSTS) < 0)
+		return 1;
 
 	if (broker_sub) {
 		/* subscribe to the broker socket */
@@ -142,188 +1636,11 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	/*
-	 * Receive handler.
-	 *
-	 *	* receive the message
-	 *	* write out
-	 *	* ack once write successful
-	 */
-	while(1) {
-		zmq_msg_t ident, msg_id, burst;
-		zmq_msg_init(&ident);
-		zmq_msg_init(&msg_id);
-		zmq_msg_init(&burst);
-
-		size_t ident_rx;
-		errno = 0;
-		do { ident_rx  = zmq_msg_recv(&ident, zmq_sock, 0);
-		} while (errno == EINTR);
-		if (ident_rx < 1 ) return perror("zmq_msg_recv (ident_rx)"), 1;
-		if (!zmq_msg_more(&ident)) {
-			fprintf(stderr, "Got short message (only 1 part). Skipping");
-			zmq_msg_close(&ident);
-			continue;
-		}
-
-		size_t msg_id_rx;
-		errno = 0;
-		do { msg_id_rx = zmq_msg_recv(&msg_id, zmq_sock, 0);
-		} while (errno == EINTR);
-		if (msg_id_rx < 1 ) return perror("zmq_msg_recv (msg_id_rx)"), 1;
-		if (!zmq_msg_more(&msg_id)) {
-			fprintf(stderr, "Got short message (only 2 parts). Skipping");
-			zmq_msg_close(&ident); zmq_msg_close(&msg_id);
-			continue;
-		}
-
-		size_t burst_rx;
-		errno = 0;
-		do { burst_rx = zmq_msg_recv(&burst, zmq_sock, 0);
-		} while (errno == EINTR);
-		if (burst_rx < 0 ) return perror("zmq_msg_recv (burst_rx)"), 1;
-		if (broker_sub && burst_rx == 0) {
-			if (verbose) {
-				fprintf(stderr,"got ingestd ACK\n\tidentity:\t0x");
-				fhexdump(stderr, zmq_msg_data(&ident), zmq_msg_size(&ident));
-				fprintf(stderr, "\n\tmessage id:\t0x");
-				fhexdump(stderr, zmq_msg_data(&msg_id), zmq_msg_size(&msg_id));
-				fputc('\n', stderr);
-			}
-			zmq_msg_close(&ident); zmq_msg_close(&msg_id); zmq_msg_close(&burst);
-			continue;
-		}
-
-		uint8_t *compressed_buffer;
-		uint32_t uncompressed_size_from_header;
-		uint32_t compressed_size_from_header;
-
-		if (verbose) {
-			fprintf(stderr, "received %lu bytes\n\tidentity:\t0x", zmq_msg_size(&burst));
-			fhexdump(stderr, zmq_msg_data(&ident), zmq_msg_size(&ident));
-			fprintf(stderr, "\n\tmessage id:\t0x");
-			fhexdump(stderr, zmq_msg_data(&msg_id), zmq_msg_size(&msg_id));
-			fputc('\n', stderr);
-		}
-
-		/* The databurst has an 8 byte header. 2 uint32s with
-		* little endian ordering advising compressed and
-		* decompressed size for some lz4 implementations.
-		*
-		* We can ignore this as we don't need to know the original
-		* size to decompress
-		*/
-		if (zmq_msg_size(&burst) <= 8) {
-			fprintf(stderr, "Got short message (small payload). Skipping\n");
-			zmq_msg_close(&ident); zmq_msg_close(&msg_id); zmq_msg_close(&burst);
-			continue;
-		}
-		compressed_buffer = (uint8_t *)zmq_msg_data(&burst);
-
-		uncompressed_size_from_header = le32toh(*(uint32_t *)compressed_buffer);
-		compressed_buffer += sizeof(uint32_t);
-
-		compressed_size_from_header = le32toh(*(uint32_t *)compressed_buffer);
-		compressed_buffer += sizeof(uint32_t);
-
-		verbose_printf("\tcompressed:\t%u bytes\n\tuncompressed:\t%u bytes\n",
-			compressed_size_from_header,
-			uncompressed_size_from_header);
+	/* Batching needs somewhere to hold more than one burst */
+	if ((flush_bytes || group_usec) && !n_workers)
+		n_workers = 1;
 
-		if (zmq_msg_size(&burst) != (compressed_size_from_header + 8)) {
-			fprintf(stderr, "Message size and header payload size don't match. skipping");
-			zmq_msg_close(&ident); zmq_msg_close(&msg_id); zmq_msg_close(&burst);
-			continue;
-		}
-
-		assert(((uint8_t *)zmq_msg_data(&burst) + 8) == compressed_buffer);
-
-		/* Make sure we have enough room to decompress the burst into.
-		*
-		* We probably shouldn't trust the burst header here if this is
-		* used in production as it could easily be used to DoS based on
-		* memory usage.  At the same time, databursts can legitimately
-		* be hundreds of MB in size, so limiting this is curious.
-		*/
-		if (decompressed_bufsize < uncompressed_size_from_header) {
-			void *new_buffer;
-			DEBUG_PRINTF("growing buffer from %lu to %u bytes\n",
-				decompressed_bufsize,
-				uncompressed_size_from_header);
-			new_buffer = realloc(decompressed_buffer, uncompressed_size_from_header);
-			if (new_buffer == NULL) return perror("realloc"), 1;
-
-			decompressed_buffer = new_buffer;
-			decompressed_bufsize = uncompressed_size_from_header;
-		}
-
-		if (!dummy_mode) {
-			/* Decompress the databurst */
-			int databurst_size;
-			databurst_size = LZ4_decompress_safe(
-				(const char *)compressed_buffer,
-				(char *)decompressed_buffer,
-				(int)compressed_size_from_header,
-				(int)decompressed_bufsize);
-
-			if (databurst_size < 1) {
-				fprintf(stderr,"DataBurst decompression failure");
-				return 1;
-			}
-
-			/* Crosscheck decompressed size is what we expect */
-			if (databurst_size != uncompressed_size_from_header) {
-				fprintf(stderr, "uncompressed DataBurst size and header don't match. skipping");
-				zmq_msg_close(&ident); zmq_msg_close(&msg_id); zmq_msg_close(&burst);
-				continue;
-			}
-
-			/* Write out and flush */
-			if (just_points) {
-				DataBurst *b = data_burst__unpack(NULL, databurst_size, decompressed_buffer);
-				if( b == NULL ) {
-					perror("failed to decode protobuf");
-				} else {
-					printf("\tpoints:\t\t%u\n", (unsigned int)b->n_frames);
-					data_burst__free_unpacked(b, NULL);
-				}
-
-			} else if (hexdump) {
-				fhexdump(stdout, decompressed_buffer, databurst_size);
-				printf("\n");
-			}
-			else {
-				if (write_burst(stdout, decompressed_buffer, databurst_size) < 0)
-					return perror("writing databurst"), 1;
-			}
-
-			fflush(stdout);
-		}
-
-		/* Send back acks if we aren't passively listening */
-		if (!broker_sub) {
-			/* Send an ack */
-			if (slow_mode)
-				usleep(1000000);
-
-			if(zmq_msg_send(&ident, zmq_sock, ZMQ_SNDMORE) < 0)
-				return perror("zmq_send (ident)"), 1;
-			if(zmq_msg_send(&msg_id, zmq_sock, ZMQ_SNDMORE) < 0)
-				return perror("zmq_send (msg_id)"), 1;
-			if (zmq_send(zmq_sock, NULL, 0, 0) < 0)
-			return perror("zmq_send (null ack)"), 1;
-		}
-		else {
-			/* No acks as we're just subscribing so we need to
-			 * clean up the message headers */
-			zmq_msg_close(&ident);
-			zmq_msg_close(&msg_id);
-		}
-		zmq_msg_close(&burst);
-	}
-	DEBUG_PRINTF("done\n");
-
-	free(decompressed_buffer);
-
-	return 0;
+	if (n_workers)
+		return run_pipelined(zmq_context, zmq_sock, n_workers);
+	return run_single(zmq_sock);
 }
@@ -0,0 +1,297 @@
+/*
+ * burststream - decode a DataBurst without ever holding all of it
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "burststream.h"
+
+/* Where the decompressed output is going */
+struct chunked_out {
+	uint8_t *buf;		/* window followed by a chunk */
+	size_t cap;
+	size_t pos;		/* next byte to write */
+	size_t flushed;		/* everything before here has gone to sink */
+	size_t total;
+	size_t max;
+	chunk_sink sink;
+	void *ctx;
+};
+
+/* Hand whatever's new to the sink and slide the window down to make
+ * room for the next chunk
+ */
+static int flush_out(struct chunked_out *o) {
+	int ret;
+
+	if (o->pos > o->flushed) {
+		ret = o->sink(o->buf + o->flushed, o->pos - o->flushed, o->ctx);
+		if (ret)
+			return ret;
+	}
+	if (o->pos > LZ4_WINDOW_SIZE) {
+		memmove(o->buf, o->buf + o->pos - LZ4_WINDOW_SIZE, LZ4_WINDOW_SIZE);
+		o->pos = LZ4_WINDOW_SIZE;
+	}
+	o->flushed = o->pos;
+	return 0;
+}
+
+/* How many bytes can we write before we have to flush. Flushes if
+ * that's none.
+ */
+static long out_room(struct chunked_out *o) {
+	int ret;
+
+	if (o->pos == o->cap && (ret = flush_out(o)))
+		return ret;
+	return o->cap - o->pos;
+}
+
+/* Read one of LZ4's 255 terminated length extensions */
+static int read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return LZ4_CHUNKED_CORRUPT;
+		b = *((*ip)++);
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+long lz4_decompress_chunked(const uint8_t *src, size_t srclen, size_t max_out,
+		uint8_t *work, size_t chunk, chunk_sink sink, void *ctx) {
+	const uint8_t *ip = src, *iend = src + srclen;
+	struct chunked_out o;
+	long room;
+	int ret;
+
+	o.buf = work;
+	o.cap = LZ4_CHUNKED_WORKSIZE(chunk);
+	o.pos = o.flushed = o.total = 0;
+	o.max = max_out;
+	o.sink = sink;
+	o.ctx = ctx;
+
+	while (ip < iend) {
+		uint8_t token = *(ip++);
+		size_t literals = token >> 4;
+		size_t match = token & 0xf;
+		size_t offset;
+
+		/* Literals */
+		if (literals == 15 && read_length(&ip, iend, &literals))
+			return LZ4_CHUNKED_CORRUPT;
+		if (literals > iend - ip || literals > o.max - o.total)
+			return LZ4_CHUNKED_CORRUPT;
+		o.total += literals;
+		while (literals) {
+			size_t n;
+			if ((room = out_room(&o)) < 0)
+				return room;
+			n = literals < room ? literals : room;
+			memcpy(o.buf + o.pos, ip, n);
+			o.pos += n;
+			ip += n;
+			literals -= n;
+		}
+
+		/* The last sequence is only literals */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			return LZ4_CHUNKED_CORRUPT;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > o.total)
+			return LZ4_CHUNKED_CORRUPT;
+		if (match == 15 && read_length(&ip, iend, &match))
+			return LZ4_CHUNKED_CORRUPT;
+		match += 4;
+		if (match > o.max - o.total)
+			return LZ4_CHUNKED_CORRUPT;
+		o.total += match;
+
+		/* The window always keeps at least offset bytes behind pos,
+		 * even after sliding
+		 */
+		while (match) {
+			uint8_t *from, *to;
+			size_t n;
+
+			if ((room = out_room(&o)) < 0)
+				return room;
+			n = match < room ? match : room;
+			to = o.buf + o.pos;
+			from = to - offset;
+			if (offset >= n) {
+				memcpy(to, from, n);
+			} else {
+				size_t i;
+				for (i = 0; i < n; i++)
+					to[i] = from[i];
+			}
+			o.pos += n;
+			match -= n;
+		}
+	}
+
+	if ((ret = flush_out(&o)))
+		return ret;
+	return o.total;
+}
+
+enum {
+	SPLIT_KEY,
+	SPLIT_LENGTH,
+	SPLIT_FRAME,
+	SPLIT_SKIP,
+	SPLIT_SKIP_VARINT
+};
+
+void splitter_init(struct frame_splitter *s, size_t max_frame,
+		int (*emit)(const uint8_t *, size_t, void *), void *ctx) {
+	memset(s, 0, sizeof(*s));
+	s->emit = emit;
+	s->ctx = ctx;
+	s->max_frame = max_frame;
+}
+
+void splitter_free(struct frame_splitter *s) {
+	free(s->spill);
+	s->spill = NULL;
+	s->spill_size = 0;
+}
+
+void splitter_reset(struct frame_splitter *s) {
+	s->state = SPLIT_KEY;
+	s->varint = 0;
+	s->shift = 0;
+	s->spill_len = 0;
+}
+
+/* Carry on with a varint that may have been started in an earlier piece
+ *
+ * returns 1 once it's complete, 0 if we ran out of input
+ */
+static int feed_varint(struct frame_splitter *s, const uint8_t **p, const uint8_t *end) {
+	while (*p < end) {
+		uint8_t b = *((*p)++);
+		if (s->shift >= 64)
+			return SPLITTER_MALFORMED;
+		s->varint |= (uint64_t)(b & 0x7f) << s->shift;
+		s->shift += 7;
+		if (!(b & 0x80))
+			return 1;
+	}
+	return 0;
+}
+
+int splitter_feed(const uint8_t *buf, size_t len, void *splitter) {
+	struct frame_splitter *s = splitter;
+	const uint8_t *p = buf, *end = buf + len;
+	int ret;
+
+	while (p < end) {
+		switch (s->state) {
+		case SPLIT_KEY:
+			if ((ret = feed_varint(s, &p, end)) <= 0)
+				return ret;
+			s->field = s->varint >> 3;
+			switch (s->varint & 7) {
+				case 0: s->state = SPLIT_SKIP_VARINT; break;
+				case 1: s->state = SPLIT_SKIP; s->remaining = 8; break;
+				case 2: s->state = SPLIT_LENGTH; break;
+				case 5: s->state = SPLIT_SKIP; s->remaining = 4; break;
+				default: return SPLITTER_MALFORMED;
+			}
+			s->varint = 0;
+			s->shift = 0;
+			break;
+
+		case SPLIT_LENGTH:
+			if ((ret = feed_varint(s, &p, end)) <= 0)
+				return ret;
+			s->remaining = s->varint;
+			s->varint = 0;
+			s->shift = 0;
+			if (s->field != 1) {
+				/* An empty one may be the last thing in the burst */
+				s->state = s->remaining ? SPLIT_SKIP : SPLIT_KEY;
+				break;
+			}
+			if (s->remaining > s->max_frame)
+				return SPLITTER_MALFORMED;
+			s->state = SPLIT_FRAME;
+			if (s->remaining == 0) {
+				s->state = SPLIT_KEY;
+				if ((ret = s->emit(p, 0, s->ctx)))
+					return ret;
+			}
+			break;
+
+		case SPLIT_FRAME:
+			/* All here, hand it over in place */
+			if (s->spill_len == 0 && s->remaining <= end - p) {
+				ret = s->emit(p, s->remaining, s->ctx);
+				p += s->remaining;
+				s->state = SPLIT_KEY;
+				if (ret)
+					return ret;
+				break;
+			}
+
+			/* Straddles pieces, put it together in spill */
+			if (s->spill_len == 0 && s->spill_size < s->remaining) {
+				uint8_t *spill = realloc(s->spill, s->remaining);
+				if (spill == NULL)
+					return SPLITTER_NOMEM;
+				s->spill = spill;
+				s->spill_size = s->remaining;
+			}
+			{
+				size_t n = s->remaining < end - p ? s->remaining : end - p;
+				memcpy(s->spill + s->spill_len, p, n);
+				s->spill_len += n;
+				s->remaining -= n;
+				p += n;
+			}
+			if (s->remaining == 0) {
+				ret = s->emit(s->spill, s->spill_len, s->ctx);
+				s->spill_len = 0;
+				s->state = SPLIT_KEY;
+				if (ret)
+					return ret;
+			}
+			break;
+
+		case SPLIT_SKIP:
+			if (s->remaining > end - p) {
+				s->remaining -= end - p;
+				return 0;
+			}
+			p += s->remaining;
+			s->state = SPLIT_KEY;
+			break;
+
+		case SPLIT_SKIP_VARINT:
+			if ((ret = feed_varint(s, &p, end)) <= 0)
+				return ret;
+			s->varint = 0;
+			s->shift = 0;
+			s->state = SPLIT_KEY;
+			break;
+		}
+	}
+	return 0;
+}
+
+int splitter_finish(struct frame_splitter *s) {
+	if (s->state != SPLIT_KEY || s->shift)
+		return SPLITTER_MALFORMED;
+	return 0;
+}
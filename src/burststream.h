@@ -0,0 +1,83 @@
+/*
+ * burststream - decode a DataBurst without ever holding all of it
+ *
+ * lz4_decompress_chunked() decompresses an LZ4 block a chunk at a time,
+ * keeping only the 64KB window LZ4 can refer back into. Each chunk can be
+ * fed to a frame_splitter, which picks the DataFrames (field 1) out of a
+ * DataBurst as they go past and hands them on one at a time.
+ */
+#ifndef BURSTSTREAM_H
+#define BURSTSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* How far back an LZ4 match can reach */
+#define LZ4_WINDOW_SIZE		65536
+
+/* Size of the work buffer lz4_decompress_chunked() needs */
+#define LZ4_CHUNKED_WORKSIZE(chunk)	(LZ4_WINDOW_SIZE + (chunk))
+
+/* Handed each chunk of output in turn. Return a negative value to stop */
+typedef int (*chunk_sink)(const uint8_t *buf, size_t len, void *ctx);
+
+#define LZ4_CHUNKED_CORRUPT	(-1)
+
+/* Decompress the LZ4 block in src, handing the output to sink in pieces
+ * no bigger than the work buffer (the first one has the window to
+ * fill too, after that they're chunk bytes).
+ *
+ * returns the decompressed size, LZ4_CHUNKED_CORRUPT if the block is
+ * corrupt or decompresses to more than max_out bytes, or whatever
+ * negative value sink returned to stop us
+ */
+long lz4_decompress_chunked(const uint8_t *src, size_t srclen, size_t max_out,
+	uint8_t *work, size_t chunk, chunk_sink sink, void *ctx);
+
+/* Pulls DataFrames out of a DataBurst fed to it in arbitrary pieces
+ *
+ * Frames that sit entirely within a piece are handed on in place, so
+ * only frames that straddle two pieces get copied.
+ */
+struct frame_splitter {
+	/* Called for every DataFrame. Return a negative value to stop */
+	int (*emit)(const uint8_t *frame, size_t len, void *ctx);
+	void *ctx;
+	size_t max_frame;	/* biggest frame we'll put together */
+
+	int state;
+	uint64_t varint;
+	int shift;
+	int field;
+	uint64_t remaining;
+
+	uint8_t *spill;		/* frame that straddles pieces */
+	size_t spill_len;
+	size_t spill_size;
+};
+
+#define SPLITTER_MALFORMED	(-2)
+#define SPLITTER_NOMEM		(-3)
+
+void splitter_init(struct frame_splitter *s, size_t max_frame,
+	int (*emit)(const uint8_t *, size_t, void *), void *ctx);
+void splitter_free(struct frame_splitter *s);
+
+/* Start on a new DataBurst */
+void splitter_reset(struct frame_splitter *s);
+
+/* Feed the next piece of the DataBurst. Has the right signature to be
+ * a chunk_sink with the splitter as its ctx
+ *
+ * returns 0, SPLITTER_MALFORMED, SPLITTER_NOMEM if a straddling frame
+ * couldn't be put together, or whatever emit returned to stop us
+ */
+int splitter_feed(const uint8_t *buf, size_t len, void *splitter);
+
+/* Call once the whole DataBurst has been fed in
+ *
+ * returns SPLITTER_MALFORMED if it stopped part way through something
+ */
+int splitter_finish(struct frame_splitter *s);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * col_test: write frames to a colfile and check they all read back the
+ * same, extremes and all
+ *
+ * make check builds and runs it. Exits 1 if anything fails
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "colfile.h"
+#include "wire.h"
+
+static int failures;
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+		failures++;						\
+	}								\
+} while (0)
+
+/* A frame, as it goes in and should come out */
+struct row {
+	const char *host;
+	uint64_t timestamp;
+	enum wire_payload payload;
+	int64_t number;
+	double real;
+	const char *bytes;
+};
+
+/* An encoded frame */
+struct msg {
+	uint8_t buf[256];
+	size_t len;
+};
+
+static void put_varint(struct msg *m, uint64_t v) {
+	while (v >= 0x80) {
+		m->buf[m->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	m->buf[m->len++] = v;
+}
+
+static void put_fixed64(struct msg *m, uint64_t v) {
+	int i;
+
+	for (i = 0; i < 8; i++)
+		m->buf[m->len++] = v >> (8 * i);
+}
+
+static void put_bytes(struct msg *m, int field, const void *data, size_t len) {
+	put_varint(m, WIRE_KEY(field, WIRE_LEN));
+	put_varint(m, len);
+	memcpy(m->buf + m->len, data, len);
+	m->len += len;
+}
+
+static void encode_row(struct msg *m, const struct row *r) {
+	struct msg tag = { .len = 0 };
+	uint64_t bits;
+
+	put_bytes(&tag, 1, "host", 4);
+	put_bytes(&tag, 2, r->host, strlen(r->host));
+	m->len = 0;
+	put_bytes(m, 1, tag.buf, tag.len);
+	put_varint(m, WIRE_KEY(2, WIRE_FIXED64));
+	put_fixed64(m, r->timestamp);
+	put_varint(m, WIRE_KEY(3, WIRE_VARINT));
+	put_varint(m, r->payload);
+	switch (r->payload) {
+		case WIRE_NUMBER:
+			put_varint(m, WIRE_KEY(4, WIRE_VARINT));
+			put_varint(m, (uint64_t)r->number);
+			break;
+		case WIRE_REAL:
+			put_varint(m, WIRE_KEY(5, WIRE_FIXED64));
+			memcpy(&bits, &r->real, sizeof(bits));
+			put_fixed64(m, bits);
+			break;
+		case WIRE_TEXT:
+			put_bytes(m, 6, r->bytes, strlen(r->bytes));
+			break;
+		case WIRE_BINARY:
+			put_bytes(m, 7, r->bytes, strlen(r->bytes));
+			break;
+		default:
+			break;
+	}
+}
+
+/* Write rows out in groups of rows_per_group, read them back and
+ * compare
+ */
+static void round_trip(const char *name, const struct row *rows, uint32_t n, uint32_t rows_per_group) {
+	char path[] = "/tmp/col_test.XXXXXX";
+	struct col_writer *w;
+	struct col_file cf;
+	uint32_t g, i, row = 0;
+	int fd = mkstemp(path);
+
+	if (fd < 0)
+		perror("mkstemp"), exit(1);
+	w = col_writer_open(fd, rows_per_group);
+	if (w == NULL)
+		perror("col_writer_open"), exit(1);
+	for (i = 0; i < n; i++) {
+		struct wire_frame frame;
+		struct msg m;
+
+		encode_row(&m, &rows[i]);
+		CHECK(wire_decode_frame(m.buf, m.len, &frame) == 0);
+		CHECK(col_writer_add(w, &frame) == 0);
+	}
+	CHECK(col_writer_close(w) == 0);
+	close(fd);
+
+	if (col_open(&cf, path) < 0) {
+		fprintf(stderr, "%s: can't read the colfile back\n", name);
+		failures++;
+		unlink(path);
+		return;
+	}
+	CHECK(cf.footer->n_rows == n);
+	CHECK(cf.footer->n_groups == (n + rows_per_group - 1) / rows_per_group);
+
+	for (g = 0; g < cf.footer->n_groups; g++) {
+		struct col_group group;
+		uint64_t timestamps[64];
+		int64_t numbers[64];
+		double reals[64];
+		const uint8_t *cursor;
+		uint32_t n_numbers = 0, n_reals = 0;
+
+		if (col_group(&cf, g, &group) < 0) {
+			fprintf(stderr, "%s: row group %u is broken\n", name, g);
+			failures++;
+			break;
+		}
+		CHECK(group.n_rows <= 64);
+		CHECK(col_decode_timestamps(&group, timestamps) == 0);
+		CHECK(col_decode_numbers(&group, numbers) == 0);
+		CHECK(col_decode_reals(&group, reals) == 0);
+		cursor = group.columns[COL_BYTES].data;
+
+		for (i = 0; i < group.n_rows; i++, row++) {
+			const struct row *r = &rows[row];
+			struct wire_bytes entry, value;
+			const uint8_t *tags;
+			struct wire_tag tag;
+
+			CHECK(timestamps[i] == r->timestamp);
+			CHECK(group.payload[i] == r->payload);
+			CHECK(col_source(&cf, group.source[i], &entry) == 0);
+			tags = entry.data;
+			CHECK(col_next_tag(&entry, &tags, &tag) == 1);
+			CHECK(tag.value.len == strlen(r->host)
+				&& memcmp(tag.value.data, r->host, tag.value.len) == 0);
+
+			switch (r->payload) {
+				case WIRE_NUMBER:
+					CHECK(numbers[n_numbers++] == r->number);
+					break;
+				case WIRE_REAL:
+					/* Bit for bit, so NaNs and -0.0 count */
+					CHECK(memcmp(&reals[n_reals++], &r->real, sizeof(r->real)) == 0);
+					break;
+				case WIRE_TEXT:
+				case WIRE_BINARY:
+					CHECK(col_next_bytes(&group, &cursor, &value) == 0);
+					CHECK(value.len == strlen(r->bytes)
+						&& memcmp(value.data, r->bytes, value.len) == 0);
+					break;
+				default:
+					break;
+			}
+		}
+		CHECK(n_numbers == group.header->n_numbers);
+		CHECK(n_reals == group.header->n_reals);
+	}
+	CHECK(row == n);
+	col_close(&cf);
+	unlink(path);
+}
+
+static const struct row rows[] = {
+	{ "astrolabe", 1395212041732118000ULL, WIRE_NUMBER, 0 },
+	{ "astrolabe", 1395212041732118001ULL, WIRE_NUMBER, INT64_MAX },
+	{ "fishhook", 1395212041732118002ULL, WIRE_NUMBER, INT64_MIN },
+	{ "fishhook", 1395212041732118003ULL, WIRE_NUMBER, INT64_MAX },
+	{ "fishhook", 0, WIRE_NUMBER, -1 },
+	{ "astrolabe", UINT64_MAX, WIRE_NUMBER, INT64_MIN },
+	{ "astrolabe", 1, WIRE_REAL, 0, NAN },
+	{ "tamborine", 1395212041732118000ULL, WIRE_REAL, 0, -0.0 },
+	{ "tamborine", 1395212041732117000ULL, WIRE_REAL, 0, 0.0 },
+	{ "tamborine", 1395212041732119000ULL, WIRE_REAL, 0, INFINITY },
+	{ "tamborine", 1395212041732119000ULL, WIRE_REAL, 0, -INFINITY },
+	{ "tamborine", 1395212041732119000ULL, WIRE_REAL, 0, 5e-324 },
+	{ "tamborine", UINT64_MAX, WIRE_REAL, 0, 1.5 },
+	{ "tamborine", 0, WIRE_REAL, 0, -NAN },
+	{ "gunnedah", 1ULL << 63, WIRE_TEXT, 0, 0, "" },
+	{ "gunnedah", (1ULL << 63) - 1, WIRE_TEXT, 0, 0, "state_42" },
+	{ "gunnedah", 1ULL << 63, WIRE_BINARY, 0, 0, "\x01\x02\x03" },
+	{ "gunnedah", 12345, WIRE_EMPTY },
+	{ "astrolabe", 12345, WIRE_NUMBER, -4611686018427387904LL },
+};
+#define N_ROWS	(sizeof(rows) / sizeof(rows[0]))
+
+int main(void) {
+	round_trip("one group", rows, N_ROWS, 64);
+	round_trip("groups of 4, the last short", rows, N_ROWS, 4);
+	round_trip("a row a group", rows, N_ROWS, 1);
+	round_trip("one row", rows + 2, 1, 64);
+	round_trip("no rows", rows, 0, 64);
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	puts("col_test: ok");
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * colcat: output the frames in colfiles (see colfile.h) the way framecat
+ * does, one line per frame
+ *
+ * Sources come out with their tags sorted, as that's how the colfile
+ * keeps them. -i says what's in each row group instead.
+ *
+ * colcat [-i] [-r] colfile...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "colfile.h"
+#include "outbuf.h"
+
+/* Write output out once this much has built up */
+#define OUTPUT_FLUSH_SIZE	65536
+
+static int info = 0;
+static int shortest = 0;
+
+/* Stop at a NUL, like framecat */
+static void put_bytes(struct outbuf *ob, struct wire_bytes b) {
+	const uint8_t *nul = memchr(b.data, 0, b.len);
+
+	outbuf_put(ob, b.data, nul ? nul - b.data : b.len);
+}
+
+static int dump_source(struct outbuf *ob, const struct col_file *cf, uint32_t id) {
+	struct wire_bytes entry;
+	struct wire_tag tag;
+	const uint8_t *cursor;
+	int i = 0, more;
+
+	if (col_source(cf, id, &entry) < 0)
+		return -1;
+	cursor = entry.data;
+	while ((more = col_next_tag(&entry, &cursor, &tag)) > 0) {
+		if (i++)
+			outbuf_putc(ob, ',');
+		put_bytes(ob, tag.field);
+		outbuf_putc(ob, '=');
+		put_bytes(ob, tag.value);
+	}
+	return more;
+}
+
+static void dump_info(const struct col_file *cf, uint32_t g, const struct col_group *group) {
+	static const char *names[COL_N_COLUMNS] = { "source", "payload", "timestamp", "number", "real", "bytes" };
+	int c;
+
+	printf("group %u: %u rows (%u NUMBER, %u REAL, %u TEXT or BINARY), timestamps %lu to %lu\n",
+		g, group->n_rows, group->header->n_numbers, group->header->n_reals,
+		group->header->n_bytes, group->header->min_timestamp, group->header->max_timestamp);
+	for (c = 0; c < COL_N_COLUMNS; c++)
+		printf("\t%-10s %10zu bytes\n", names[c], group->columns[c].len);
+}
+
+/* Output every row of every group
+ *
+ * returns 1 if the file turns out to be broken
+ */
+static int dump_file(const char *path, const struct col_file *cf, struct outbuf *ob) {
+	uint64_t *timestamps = malloc(cf->header->rows_per_group * sizeof(uint64_t));
+	int64_t *numbers = malloc(cf->header->rows_per_group * sizeof(int64_t));
+	double *reals = malloc(cf->header->rows_per_group * sizeof(double));
+	struct col_group group;
+	uint32_t g, row;
+	int ret = 0;
+
+	if (!timestamps || !numbers || !reals)
+		return perror("malloc"), 1;
+
+	if (info)
+		printf("%s: %lu rows in %u groups, %u sources (%lu bytes of dictionary)\n",
+			path, cf->footer->n_rows, cf->footer->n_groups,
+			cf->n_sources, cf->footer->dict_len);
+
+	for (g = 0; g < cf->footer->n_groups && !ret; g++) {
+		const uint8_t *bytes;
+		uint32_t number = 0, real = 0;
+
+		if (col_group(cf, g, &group) < 0
+				|| group.n_rows > cf->header->rows_per_group
+				|| col_decode_timestamps(&group, timestamps) < 0
+				|| col_decode_numbers(&group, numbers) < 0
+				|| col_decode_reals(&group, reals) < 0) {
+			ret = 1;
+			break;
+		}
+		if (info) {
+			dump_info(cf, g, &group);
+			continue;
+		}
+
+		bytes = group.columns[COL_BYTES].data;
+		for (row = 0; row < group.n_rows; row++) {
+			struct wire_bytes value;
+
+			if (dump_source(ob, cf, group.source[row]) < 0) {
+				ret = 1;
+				break;
+			}
+			outbuf_putc(ob, ' ');
+			outbuf_u64(ob, timestamps[row]);
+			outbuf_putc(ob, ' ');
+			switch (group.payload[row]) {
+				case WIRE_NUMBER:
+					if (number == group.header->n_numbers)
+						ret = 1;
+					else
+						outbuf_u64(ob, numbers[number++]);
+					break;
+				case WIRE_REAL:
+					if (real == group.header->n_reals)
+						ret = 1;
+					else if (shortest)
+						outbuf_double_shortest(ob, reals[real++]);
+					else
+						outbuf_double_fixed(ob, reals[real++]);
+					break;
+				case WIRE_TEXT:
+				case WIRE_BINARY:
+					if (col_next_bytes(&group, &bytes, &value) < 0)
+						ret = 1;
+					else if (group.payload[row] == WIRE_TEXT)
+						put_bytes(ob, value);
+					else
+						outbuf_puts(ob, "(BINARY DATA)");
+					break;
+				case WIRE_EMPTY:
+					outbuf_puts(ob, "(EMPTY)"); break;
+				default:
+					outbuf_puts(ob, "(UNKNOWN PAYLOAD TYPE)");
+			}
+			if (ret)
+				break;
+			outbuf_putc(ob, '\n');
+
+			if (ob->len >= OUTPUT_FLUSH_SIZE && outbuf_flush(ob, STDOUT_FILENO) < 0) {
+				perror("write");
+				exit(1);
+			}
+		}
+	}
+
+	if (outbuf_flush(ob, STDOUT_FILENO) < 0) {
+		perror("write");
+		exit(1);
+	}
+	if (ret)
+		fprintf(stderr, "%s: row group %u is broken\n", path, g);
+	free(reals);
+	free(numbers);
+	free(timestamps);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	struct col_file cf;
+	struct outbuf ob;
+	int ret = 0;
+
+	argv++; argc--;
+	while (argc > 0 && **argv == '-') {
+		if (strncmp("-i", *argv, 3) == 0) {
+			info = 1;
+		}
+		else if (strncmp("-r", *argv, 3) == 0) {
+			shortest = 1;
+		}
+		else {
+			argc = 0;
+			break;
+		}
+		argv++; argc--;
+	}
+	if (argc < 1) {
+		fprintf(stderr, "colcat [-i] [-r] colfile...\n\n"
+				"\toutputs the frames in colfiles written by framecat -o\n"
+				"\t-i says what's in each row group instead\n"
+				"\t-r prints REAL values in as few digits as will read"
+				" back exactly\n");
+		return 1;
+	}
+
+	outbuf_init(&ob, OUTPUT_FLUSH_SIZE * 2);
+	for (; argc > 0; argv++, argc--) {
+		switch (col_open(&cf, *argv)) {
+			case 0:
+				break;
+			case -1:
+				perror(*argv);
+				ret = 1;
+				continue;
+			default:
+				fprintf(stderr, "%s: not a colfile\n", *argv);
+				ret = 1;
+				col_close(&cf);
+				continue;
+		}
+		if (dump_file(*argv, &cf, &ob))
+			ret = 1;
+		col_close(&cf);
+	}
+	outbuf_free(&ob);
+	return ret;
+}
@@ -0,0 +1,769 @@
+/*
+ * colfile - write and read the columnar export format in colfile.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "colfile.h"
+#include "outbuf.h"
+#include "intern.h"
+
+static inline uint64_t zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void put_varint(struct outbuf *ob, uint64_t v) {
+	uint8_t *start = (uint8_t *)outbuf_reserve(ob, 10), *p = start;
+
+	while (v >= 0x80) {
+		*(p++) = v | 0x80;
+		v >>= 7;
+	}
+	*(p++) = v;
+	ob->len += p - start;
+}
+
+static void put_bytes(struct outbuf *ob, struct wire_bytes b) {
+	put_varint(ob, b.len);
+	outbuf_put(ob, b.data, b.len);
+}
+
+static void pad8(struct outbuf *ob) {
+	while (ob->len % 8)
+		outbuf_putc(ob, 0);
+}
+
+/*
+ * Bit streams, most significant bit first
+ */
+
+struct bit_writer {
+	struct outbuf *ob;
+	uint64_t acc;		/* the low n bits are waiting to go out */
+	int n;
+};
+
+static void put_bits(struct bit_writer *bw, uint64_t v, int bits) {
+	if (bits > 32) {
+		put_bits(bw, v >> 32, bits - 32);
+		bits = 32;
+	}
+	bw->acc = (bw->acc << bits) | (v & ((1ULL << bits) - 1));
+	bw->n += bits;
+	while (bw->n >= 8) {
+		bw->n -= 8;
+		outbuf_putc(bw->ob, bw->acc >> bw->n);
+	}
+}
+
+static void finish_bits(struct bit_writer *bw) {
+	if (bw->n)
+		outbuf_putc(bw->ob, bw->acc << (8 - bw->n));
+	bw->n = 0;
+}
+
+struct bit_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	int n;
+	int overrun;
+};
+
+static uint64_t get_bits(struct bit_reader *br, int bits) {
+	uint64_t v;
+
+	if (bits > 32) {
+		v = get_bits(br, bits - 32) << 32;
+		return v | get_bits(br, 32);
+	}
+	while (br->n < bits) {
+		if (br->p == br->end) {
+			br->overrun = 1;
+			return 0;
+		}
+		br->acc = (br->acc << 8) | *(br->p++);
+		br->n += 8;
+	}
+	br->n -= bits;
+	return (br->acc >> br->n) & ((1ULL << bits) - 1);
+}
+
+/* Count the 1 bits before a 0, giving up at max */
+static int get_unary(struct bit_reader *br, int max) {
+	int n = 0;
+
+	while (n < max && get_bits(br, 1))
+		n++;
+	return n;
+}
+
+/*
+ * Delta of delta timestamps
+ */
+
+/* How many bits a zigzagged delta of delta gets after its prefix */
+static const int dod_bits[] = { 0, 7, 9, 12, 32, 64 };
+#define DOD_PREFIXES	(sizeof(dod_bits) / sizeof(dod_bits[0]) - 1)
+
+static void encode_timestamps(struct outbuf *ob, const uint64_t *ts, uint32_t n) {
+	struct bit_writer bw = { .ob = ob };
+	uint64_t delta = 0;
+	uint32_t i;
+	int b;
+
+	if (n == 0)
+		return;
+	put_bits(&bw, ts[0], 64);
+	for (i = 1; i < n; i++) {
+		uint64_t d = ts[i] - ts[i - 1];
+		uint64_t dod = zigzag((int64_t)(d - delta));
+
+		for (b = 0; b < DOD_PREFIXES; b++)
+			if (dod_bits[b] < 64 && dod < (1ULL << dod_bits[b]))
+				break;
+		/* b ones, then a zero unless it's the last prefix */
+		if (b < DOD_PREFIXES)
+			put_bits(&bw, ((1ULL << b) - 1) << 1, b + 1);
+		else
+			put_bits(&bw, (1ULL << b) - 1, b);
+		if (dod_bits[b])
+			put_bits(&bw, dod, dod_bits[b]);
+		delta = d;
+	}
+	finish_bits(&bw);
+}
+
+int col_decode_timestamps(const struct col_group *group, uint64_t *ts) {
+	const struct wire_bytes *col = &group->columns[COL_TIMESTAMP];
+	struct bit_reader br = { .p = col->data, .end = col->data + col->len };
+	uint64_t delta = 0;
+	uint32_t i;
+
+	if (group->n_rows == 0)
+		return 0;
+	ts[0] = get_bits(&br, 64);
+	for (i = 1; i < group->n_rows; i++) {
+		int b = get_unary(&br, DOD_PREFIXES);
+
+		if (dod_bits[b])
+			delta += unzigzag(get_bits(&br, dod_bits[b]));
+		ts[i] = ts[i - 1] + delta;
+	}
+	return br.overrun ? -1 : 0;
+}
+
+/*
+ * Gorilla XOR REAL values
+ */
+
+static void encode_reals(struct outbuf *ob, const double *reals, uint32_t n) {
+	struct bit_writer bw = { .ob = ob };
+	int lead = -1, trail = 0;
+	uint64_t prev, v;
+	uint32_t i;
+
+	if (n == 0)
+		return;
+	memcpy(&prev, &reals[0], sizeof(prev));
+	put_bits(&bw, prev, 64);
+	for (i = 1; i < n; i++) {
+		uint64_t x;
+		int l, t;
+
+		memcpy(&v, &reals[i], sizeof(v));
+		x = v ^ prev;
+		prev = v;
+		if (x == 0) {
+			put_bits(&bw, 0, 1);
+			continue;
+		}
+
+		l = __builtin_clzll(x);
+		t = __builtin_ctzll(x);
+		if (l > 31)
+			l = 31;
+		if (lead >= 0 && l >= lead && t >= trail) {
+			put_bits(&bw, 2, 2);
+			put_bits(&bw, x >> trail, 64 - lead - trail);
+		} else {
+			put_bits(&bw, 3, 2);
+			put_bits(&bw, l, 5);
+			put_bits(&bw, 64 - l - t - 1, 6);
+			put_bits(&bw, x >> t, 64 - l - t);
+			lead = l;
+			trail = t;
+		}
+	}
+	finish_bits(&bw);
+}
+
+int col_decode_reals(const struct col_group *group, double *reals) {
+	const struct wire_bytes *col = &group->columns[COL_REAL];
+	struct bit_reader br = { .p = col->data, .end = col->data + col->len };
+	int lead = -1, trail = 0;
+	uint64_t v;
+	uint32_t i;
+
+	if (group->header->n_reals == 0)
+		return 0;
+	v = get_bits(&br, 64);
+	memcpy(&reals[0], &v, sizeof(v));
+	for (i = 1; i < group->header->n_reals; i++) {
+		switch (get_unary(&br, 2)) {
+			case 0:
+				break;
+			case 1:
+				if (lead < 0)
+					return -1;
+				v ^= get_bits(&br, 64 - lead - trail) << trail;
+				break;
+			default:
+				lead = get_bits(&br, 5);
+				trail = 64 - lead - (get_bits(&br, 6) + 1);
+				if (trail < 0)
+					return -1;
+				v ^= get_bits(&br, 64 - lead - trail) << trail;
+		}
+		memcpy(&reals[i], &v, sizeof(v));
+	}
+	return br.overrun ? -1 : 0;
+}
+
+/*
+ * Writing
+ */
+
+/* Where a source's dictionary entry went */
+struct source_slot {
+	uint64_t hash;
+	uint32_t id;		/* plus 1, 0 is empty */
+};
+
+struct col_writer {
+	int fd;
+	uint64_t offset;	/* of the next thing written */
+	uint32_t rows_per_group;
+
+	/* The row group being put together */
+	uint32_t n_rows;
+	uint32_t n_numbers;
+	uint32_t n_reals;
+	uint32_t n_bytes;
+	uint32_t *source;
+	uint8_t *payload;
+	uint64_t *timestamp;
+	int64_t *number;
+	double *real;
+	struct outbuf bytes;
+
+	struct outbuf out;	/* on its way to fd */
+	struct outbuf groups;	/* a struct col_group_index for each */
+	uint64_t n_total;
+
+	/* Source dictionary */
+	struct outbuf entries;
+	uint64_t *entry_offsets;
+	size_t entry_offsets_size;
+	uint32_t n_sources;
+	struct source_slot *slots;
+	size_t n_slots;		/* a power of 2, at least twice n_sources */
+
+	struct wire_tag *tags;
+	size_t tags_size;
+	struct outbuf key;
+
+	/* Raw source bytes we've already found the ID of */
+	struct intern_table raw;
+};
+
+static int write_out(struct col_writer *w) {
+	w->offset += w->out.len;
+	return outbuf_flush(&w->out, w->fd);
+}
+
+struct col_writer *col_writer_open(int fd, uint32_t rows_per_group) {
+	struct col_writer *w = calloc(1, sizeof(*w));
+	struct col_file_header header;
+
+	if (w == NULL)
+		return NULL;
+	w->fd = fd;
+	w->rows_per_group = rows_per_group ? rows_per_group : COL_DEFAULT_ROWS_PER_GROUP;
+	w->source = malloc(w->rows_per_group * sizeof(*w->source));
+	w->payload = malloc(w->rows_per_group * sizeof(*w->payload));
+	w->timestamp = malloc(w->rows_per_group * sizeof(*w->timestamp));
+	w->number = malloc(w->rows_per_group * sizeof(*w->number));
+	w->real = malloc(w->rows_per_group * sizeof(*w->real));
+	w->n_slots = 1024;
+	w->slots = calloc(w->n_slots, sizeof(*w->slots));
+	w->entry_offsets_size = 512;
+	w->entry_offsets = malloc(w->entry_offsets_size * sizeof(*w->entry_offsets));
+	if (!w->source || !w->payload || !w->timestamp || !w->number || !w->real
+			|| !w->slots || !w->entry_offsets)
+		return NULL;
+	w->entry_offsets[0] = 0;
+
+	outbuf_init(&w->bytes, 65536);
+	outbuf_init(&w->out, 1 << 20);
+	outbuf_init(&w->groups, 4096);
+	outbuf_init(&w->entries, 65536);
+	outbuf_init(&w->key, 256);
+	intern_init(&w->raw, INTERN_DEFAULT_MAX_ENTRIES);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COL_MAGIC, sizeof(header.magic));
+	header.version = COL_VERSION;
+	header.rows_per_group = w->rows_per_group;
+	outbuf_put(&w->out, &header, sizeof(header));
+	if (write_out(w) < 0)
+		return NULL;
+	return w;
+}
+
+static int tag_cmp(const void *a, const void *b) {
+	const struct wire_tag *x = a, *y = b;
+	size_t len;
+	int c;
+
+	len = x->field.len < y->field.len ? x->field.len : y->field.len;
+	if ((c = memcmp(x->field.data, y->field.data, len)))
+		return c;
+	if (x->field.len != y->field.len)
+		return x->field.len < y->field.len ? -1 : 1;
+	len = x->value.len < y->value.len ? x->value.len : y->value.len;
+	if ((c = memcmp(x->value.data, y->value.data, len)))
+		return c;
+	if (x->value.len != y->value.len)
+		return x->value.len < y->value.len ? -1 : 1;
+	return 0;
+}
+
+static void grow_slots(struct col_writer *w) {
+	size_t n_slots = w->n_slots * 2, i;
+	struct source_slot *slots = calloc(n_slots, sizeof(*slots));
+
+	if (slots == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < w->n_slots; i++) {
+		size_t j;
+
+		if (!w->slots[i].id)
+			continue;
+		for (j = w->slots[i].hash & (n_slots - 1); slots[j].id; j = (j + 1) & (n_slots - 1))
+			;
+		slots[j] = w->slots[i];
+	}
+	free(w->slots);
+	w->slots = slots;
+	w->n_slots = n_slots;
+}
+
+/* The ID of frame's source, adding it to the dictionary if it's new
+ */
+static uint32_t new_source_id(struct col_writer *w, const struct wire_frame *frame) {
+	const uint8_t *cursor = frame->source;
+	struct wire_tag tag;
+	uint64_t hash;
+	size_t n = 0, i;
+
+	while (wire_next_tag(frame, &cursor, &tag)) {
+		if (n == w->tags_size) {
+			w->tags_size = w->tags_size ? w->tags_size * 2 : 16;
+			w->tags = realloc(w->tags, w->tags_size * sizeof(*w->tags));
+			if (w->tags == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		w->tags[n++] = tag;
+	}
+	qsort(w->tags, n, sizeof(*w->tags), tag_cmp);
+
+	w->key.len = 0;
+	put_varint(&w->key, n);
+	for (i = 0; i < n; i++) {
+		put_bytes(&w->key, w->tags[i].field);
+		put_bytes(&w->key, w->tags[i].value);
+	}
+	hash = intern_hash((const uint8_t *)w->key.buf, w->key.len);
+
+	for (i = hash & (w->n_slots - 1); w->slots[i].id; i = (i + 1) & (w->n_slots - 1)) {
+		uint32_t id = w->slots[i].id - 1;
+		uint64_t start = w->entry_offsets[id];
+
+		if (w->slots[i].hash == hash
+				&& w->entry_offsets[id + 1] - start == w->key.len
+				&& memcmp(w->entries.buf + start, w->key.buf, w->key.len) == 0)
+			return id;
+	}
+
+	/* A new one */
+	if (w->n_sources + 2 > w->entry_offsets_size) {
+		w->entry_offsets_size *= 2;
+		w->entry_offsets = realloc(w->entry_offsets, w->entry_offsets_size * sizeof(*w->entry_offsets));
+		if (w->entry_offsets == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	outbuf_put(&w->entries, w->key.buf, w->key.len);
+	w->entry_offsets[w->n_sources + 1] = w->entries.len;
+	w->slots[i].hash = hash;
+	w->slots[i].id = ++w->n_sources;
+	if (w->n_sources * 2 > w->n_slots)
+		grow_slots(w);
+	return w->n_sources - 1;
+}
+
+/* Most frames' sources have turned up before with the same bytes, so
+ * there's no need to sort their tags to find the ID
+ */
+static uint32_t source_id(struct col_writer *w, const struct wire_frame *frame) {
+	struct wire_bytes key = wire_frame_source(frame);
+	uint64_t hash = intern_hash(key.data, key.len);
+	struct intern_entry *e = intern_find(&w->raw, key.data, key.len, hash);
+
+	if (e == NULL) {
+		e = intern_add(&w->raw, key.data, key.len, hash, "", 0);
+		e->id = new_source_id(w, frame);
+	}
+	return e->id;
+}
+
+/* Columns of the row group being put together in w->out */
+static void start_column(struct col_writer *w, struct col_group_header *h, int c) {
+	pad8(&w->out);
+	h->columns[c].offset = w->out.len;
+}
+
+static void end_column(struct col_writer *w, struct col_group_header *h, int c) {
+	h->columns[c].len = w->out.len - h->columns[c].offset;
+}
+
+static int write_group(struct col_writer *w) {
+	struct col_group_header h;
+	struct col_group_index idx;
+	int64_t last = 0;
+	uint32_t i;
+
+	if (w->n_rows == 0)
+		return 0;
+
+	memset(&h, 0, sizeof(h));
+	h.n_rows = w->n_rows;
+	h.n_numbers = w->n_numbers;
+	h.n_reals = w->n_reals;
+	h.n_bytes = w->n_bytes;
+	h.min_timestamp = h.max_timestamp = w->timestamp[0];
+	for (i = 1; i < w->n_rows; i++) {
+		if (w->timestamp[i] < h.min_timestamp)
+			h.min_timestamp = w->timestamp[i];
+		if (w->timestamp[i] > h.max_timestamp)
+			h.max_timestamp = w->timestamp[i];
+	}
+
+	/* The header goes in once we know where the columns are */
+	outbuf_reserve(&w->out, sizeof(h));
+	w->out.len = sizeof(h);
+
+	start_column(w, &h, COL_SOURCE);
+	outbuf_put(&w->out, w->source, w->n_rows * sizeof(*w->source));
+	end_column(w, &h, COL_SOURCE);
+
+	start_column(w, &h, COL_PAYLOAD);
+	outbuf_put(&w->out, w->payload, w->n_rows);
+	end_column(w, &h, COL_PAYLOAD);
+
+	start_column(w, &h, COL_TIMESTAMP);
+	encode_timestamps(&w->out, w->timestamp, w->n_rows);
+	end_column(w, &h, COL_TIMESTAMP);
+
+	start_column(w, &h, COL_NUMBER);
+	/* In uint64 so far apart values wrap rather than overflow */
+	for (i = 0; i < w->n_numbers; i++) {
+		put_varint(&w->out, zigzag((int64_t)((uint64_t)w->number[i] - (uint64_t)last)));
+		last = w->number[i];
+	}
+	end_column(w, &h, COL_NUMBER);
+
+	start_column(w, &h, COL_REAL);
+	encode_reals(&w->out, w->real, w->n_reals);
+	end_column(w, &h, COL_REAL);
+
+	start_column(w, &h, COL_BYTES);
+	outbuf_put(&w->out, w->bytes.buf, w->bytes.len);
+	end_column(w, &h, COL_BYTES);
+
+	pad8(&w->out);
+	memcpy(w->out.buf, &h, sizeof(h));
+
+	idx.offset = w->offset;
+	idx.len = w->out.len;
+	idx.min_timestamp = h.min_timestamp;
+	idx.max_timestamp = h.max_timestamp;
+	outbuf_put(&w->groups, &idx, sizeof(idx));
+
+	w->n_total += w->n_rows;
+	w->n_rows = w->n_numbers = w->n_reals = w->n_bytes = 0;
+	w->bytes.len = 0;
+	return write_out(w);
+}
+
+int col_writer_add(struct col_writer *w, const struct wire_frame *frame) {
+	uint32_t row = w->n_rows++;
+
+	w->source[row] = source_id(w, frame);
+	w->payload[row] = frame->payload > 0xff ? 0xff : frame->payload;
+	w->timestamp[row] = frame->timestamp;
+	switch (frame->payload) {
+		case WIRE_NUMBER:
+			w->number[w->n_numbers++] = frame->value_numeric;
+			break;
+		case WIRE_REAL:
+			w->real[w->n_reals++] = frame->value_measurement;
+			break;
+		case WIRE_TEXT:
+			put_bytes(&w->bytes, frame->value_textual);
+			w->n_bytes++;
+			break;
+		case WIRE_BINARY:
+			put_bytes(&w->bytes, frame->value_blob);
+			w->n_bytes++;
+			break;
+		default:
+			break;
+	}
+
+	if (w->n_rows == w->rows_per_group)
+		return write_group(w);
+	return 0;
+}
+
+int col_writer_close(struct col_writer *w) {
+	struct col_dict_header dh;
+	struct col_footer footer;
+	struct col_trailer trailer;
+	int ret = 0;
+
+	if (write_group(w) < 0)
+		ret = -1;
+
+	memset(&footer, 0, sizeof(footer));
+	footer.n_rows = w->n_total;
+	footer.dict_offset = w->offset;
+	footer.n_groups = w->groups.len / sizeof(struct col_group_index);
+
+	memset(&dh, 0, sizeof(dh));
+	dh.n_sources = w->n_sources;
+	outbuf_put(&w->out, &dh, sizeof(dh));
+	outbuf_put(&w->out, w->entry_offsets, (w->n_sources + 1) * sizeof(*w->entry_offsets));
+	outbuf_put(&w->out, w->entries.buf, w->entries.len);
+	pad8(&w->out);
+	footer.dict_len = w->out.len;
+
+	trailer.footer_offset = w->offset + w->out.len;
+	memcpy(trailer.magic, COL_MAGIC, sizeof(trailer.magic));
+	outbuf_put(&w->out, &footer, sizeof(footer));
+	outbuf_put(&w->out, w->groups.buf, w->groups.len);
+	outbuf_put(&w->out, &trailer, sizeof(trailer));
+	if (ret == 0 && write_out(w) < 0)
+		ret = -1;
+
+	intern_free(&w->raw);
+	outbuf_free(&w->key);
+	outbuf_free(&w->entries);
+	outbuf_free(&w->groups);
+	outbuf_free(&w->out);
+	outbuf_free(&w->bytes);
+	free(w->tags);
+	free(w->entry_offsets);
+	free(w->slots);
+	free(w->real);
+	free(w->number);
+	free(w->timestamp);
+	free(w->payload);
+	free(w->source);
+	free(w);
+	return ret;
+}
+
+/*
+ * Reading
+ */
+
+int col_open(struct col_file *cf, const char *path) {
+	const struct col_dict_header *dh;
+	const struct col_trailer *trailer;
+	struct stat st;
+	size_t index_len;
+	int fd;
+
+	memset(cf, 0, sizeof(*cf));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(struct col_file_header) + sizeof(struct col_footer) + sizeof(struct col_trailer)) {
+		close(fd);
+		return -2;
+	}
+	cf->size = st.st_size;
+	cf->map = mmap(NULL, cf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (cf->map == MAP_FAILED) {
+		cf->map = NULL;
+		return -1;
+	}
+
+	cf->header = (const struct col_file_header *)cf->map;
+	trailer = (const struct col_trailer *)(cf->map + cf->size - sizeof(*trailer));
+	if (memcmp(cf->header->magic, COL_MAGIC, sizeof(cf->header->magic))
+			|| cf->header->version != COL_VERSION
+			|| cf->header->rows_per_group == 0
+			|| memcmp(trailer->magic, COL_MAGIC, sizeof(trailer->magic))
+			|| trailer->footer_offset % 8
+			|| trailer->footer_offset > cf->size - sizeof(*trailer) - sizeof(struct col_footer))
+		return -2;
+
+	cf->footer = (const struct col_footer *)(cf->map + trailer->footer_offset);
+	cf->groups = (const struct col_group_index *)(cf->footer + 1);
+	index_len = cf->footer->n_groups * sizeof(struct col_group_index);
+	if (index_len > cf->size - sizeof(*trailer) - trailer->footer_offset - sizeof(struct col_footer))
+		return -2;
+
+	/* The dictionary, bar its entries, which col_source() checks */
+	if (cf->footer->dict_offset % 8
+			|| cf->footer->dict_offset > trailer->footer_offset
+			|| cf->footer->dict_len > trailer->footer_offset - cf->footer->dict_offset
+			|| cf->footer->dict_len < sizeof(*dh))
+		return -2;
+	dh = (const struct col_dict_header *)(cf->map + cf->footer->dict_offset);
+	cf->n_sources = dh->n_sources;
+	if ((cf->n_sources + 1ULL) * sizeof(uint64_t) > cf->footer->dict_len - sizeof(*dh))
+		return -2;
+	cf->source_offsets = (const uint64_t *)(dh + 1);
+	cf->sources = (const uint8_t *)(cf->source_offsets + cf->n_sources + 1);
+	cf->sources_len = cf->footer->dict_len - sizeof(*dh) - (cf->n_sources + 1) * sizeof(uint64_t);
+	return 0;
+}
+
+void col_close(struct col_file *cf) {
+	if (cf->map)
+		munmap((void *)cf->map, cf->size);
+	cf->map = NULL;
+}
+
+int col_group(const struct col_file *cf, uint32_t g, struct col_group *group) {
+	const struct col_group_index *idx;
+	const struct col_group_header *h;
+	int c;
+
+	if (g >= cf->footer->n_groups)
+		return -1;
+	idx = &cf->groups[g];
+	if (idx->offset % 8
+			|| idx->offset > cf->footer->dict_offset
+			|| idx->len > cf->footer->dict_offset - idx->offset
+			|| idx->len < sizeof(*h))
+		return -1;
+	h = (const struct col_group_header *)(cf->map + idx->offset);
+
+	for (c = 0; c < COL_N_COLUMNS; c++) {
+		if (h->columns[c].offset > idx->len || h->columns[c].len > idx->len - h->columns[c].offset)
+			return -1;
+		group->columns[c].data = cf->map + idx->offset + h->columns[c].offset;
+		group->columns[c].len = h->columns[c].len;
+	}
+	if (group->columns[COL_SOURCE].len != h->n_rows * sizeof(uint32_t)
+			|| h->columns[COL_SOURCE].offset % sizeof(uint32_t)
+			|| group->columns[COL_PAYLOAD].len != h->n_rows
+			|| h->n_numbers > h->n_rows
+			|| h->n_reals > h->n_rows
+			|| h->n_bytes > h->n_rows)
+		return -1;
+
+	group->header = h;
+	group->n_rows = h->n_rows;
+	group->source = (const uint32_t *)group->columns[COL_SOURCE].data;
+	group->payload = group->columns[COL_PAYLOAD].data;
+	return 0;
+}
+
+int col_source(const struct col_file *cf, uint32_t id, struct wire_bytes *entry) {
+	uint64_t start, end;
+
+	if (id >= cf->n_sources)
+		return -1;
+	start = cf->source_offsets[id];
+	end = cf->source_offsets[id + 1];
+	if (start > end || end > cf->sources_len)
+		return -1;
+	entry->data = cf->sources + start;
+	entry->len = end - start;
+	return 0;
+}
+
+static int get_bytes(const uint8_t **cursor, const uint8_t *end, struct wire_bytes *b) {
+	uint64_t len;
+
+	if (wire_varint(cursor, end, &len) < 0 || len > end - *cursor)
+		return -1;
+	b->data = *cursor;
+	b->len = len;
+	*cursor += len;
+	return 0;
+}
+
+int col_next_tag(const struct wire_bytes *entry, const uint8_t **cursor, struct wire_tag *tag) {
+	const uint8_t *end = entry->data + entry->len;
+	uint64_t n_tags;
+
+	/* Skip the tag count, we go by the end of the entry */
+	if (*cursor == entry->data && wire_varint(cursor, end, &n_tags) < 0)
+		return -1;
+	if (*cursor == end)
+		return 0;
+	if (get_bytes(cursor, end, &tag->field) < 0 || get_bytes(cursor, end, &tag->value) < 0)
+		return -1;
+	return 1;
+}
+
+int col_decode_numbers(const struct col_group *group, int64_t *numbers) {
+	const struct wire_bytes *col = &group->columns[COL_NUMBER];
+	const uint8_t *p = col->data, *end = col->data + col->len;
+	int64_t last = 0;
+	uint32_t i;
+
+	for (i = 0; i < group->header->n_numbers; i++) {
+		uint64_t v;
+
+		if (wire_varint(&p, end, &v) < 0)
+			return -1;
+		last = (int64_t)((uint64_t)last + (uint64_t)unzigzag(v));
+		numbers[i] = last;
+	}
+	return 0;
+}
+
+int col_next_bytes(const struct col_group *group, const uint8_t **cursor, struct wire_bytes *value) {
+	const struct wire_bytes *col = &group->columns[COL_BYTES];
+
+	return get_bytes(cursor, col->data + col->len, value);
+}
@@ -0,0 +1,229 @@
+/*
+ * colfile.h - columnar export of DataFrames, for scanning a lot of them
+ * quickly
+ *
+ * framecat -o writes these and colcat reads them back. Everything is
+ * little endian and 8 byte aligned, so a mmap()ed file can be read in
+ * place:
+ *
+ *	[ struct col_file_header ]
+ *	[ row group ]
+ *	[ row group ]
+ *	...
+ *	[ source dictionary ]
+ *	[ struct col_footer ]
+ *	[ struct col_group_index for each row group ]
+ *	[ struct col_trailer ]
+ *
+ * A row group is rows_per_group frames (the last one can be short): a
+ * struct col_group_header and then its columns, each 8 byte aligned.
+ *
+ *	COL_SOURCE	uint32_t source ID of each row
+ *	COL_PAYLOAD	uint8_t payload type of each row
+ *	COL_TIMESTAMP	timestamp of each row, delta of delta encoded
+ *	COL_NUMBER	value_numeric of each NUMBER row, as zigzag varint
+ *			deltas from the one before (the first from 0)
+ *	COL_REAL	value_measurement of each REAL row, Gorilla XOR
+ *			encoded
+ *	COL_BYTES	value of each TEXT and BINARY row: a varint length
+ *			then the bytes
+ *
+ * The timestamp and REAL columns are bit streams, most significant bit
+ * first. The first value in each is 64 bits as is. After that timestamps
+ * are zigzagged differences between successive deltas (the first delta
+ * is from 0), each prefixed by how many bits it takes:
+ *
+ *	0	0 (same delta as last time)
+ *	10	7 bits
+ *	110	9 bits
+ *	1110	12 bits
+ *	11110	32 bits
+ *	11111	64 bits
+ *
+ * and REAL values are XORed with the one before, as in Facebook's
+ * Gorilla:
+ *
+ *	0	same value
+ *	10	meaningful bits, which fit inside the last run's leading
+ *		and trailing zeros
+ *	11	5 bits of leading zeros, 6 bits of meaningful bit count
+ *		(less 1), then the meaningful bits
+ *
+ * The source dictionary is a struct col_dict_header, n_sources + 1
+ * uint64_t offsets into the entries that follow, and then the entries.
+ * Each is a source's tags sorted by field then value, as a varint tag
+ * count followed by a varint length and bytes for each field and value.
+ * Frames with the same tags in a different order get the same ID.
+ *
+ * Frame origins aren't kept.
+ */
+#ifndef COLFILE_H
+#define COLFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wire.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error colfiles are read and written in place, so little endian only
+#endif
+
+#define COL_MAGIC		"VAULTCOL"
+#define COL_VERSION		1
+
+#define COL_DEFAULT_ROWS_PER_GROUP	65536
+
+enum col_column_id {
+	COL_SOURCE,
+	COL_PAYLOAD,
+	COL_TIMESTAMP,
+	COL_NUMBER,
+	COL_REAL,
+	COL_BYTES,
+	COL_N_COLUMNS
+};
+
+struct col_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t rows_per_group;
+};
+
+/* Where a column is, from the start of its row group */
+struct col_column {
+	uint64_t offset;
+	uint64_t len;
+};
+
+struct col_group_header {
+	uint32_t n_rows;
+	uint32_t n_numbers;
+	uint32_t n_reals;
+	uint32_t n_bytes;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	struct col_column columns[COL_N_COLUMNS];
+};
+
+struct col_dict_header {
+	uint32_t n_sources;
+	uint32_t reserved;
+};
+
+struct col_footer {
+	uint64_t n_rows;
+	uint64_t dict_offset;
+	uint64_t dict_len;
+	uint32_t n_groups;
+	uint32_t reserved;
+};
+
+struct col_group_index {
+	uint64_t offset;
+	uint64_t len;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+};
+
+struct col_trailer {
+	uint64_t footer_offset;
+	char magic[8];
+};
+
+/*
+ * Writing
+ */
+
+struct col_writer;
+
+/* Start a colfile on fd, which should be empty
+ *
+ * returns NULL on failure
+ */
+struct col_writer *col_writer_open(int fd, uint32_t rows_per_group);
+
+/* Add a decoded frame
+ *
+ * returns -1 if a row group couldn't be written
+ */
+int col_writer_add(struct col_writer *w, const struct wire_frame *frame);
+
+/* Write out what's left and the dictionary and footer, and free w
+ *
+ * returns -1 on failure
+ */
+int col_writer_close(struct col_writer *w);
+
+/*
+ * Reading
+ */
+
+struct col_file {
+	const uint8_t *map;
+	size_t size;
+
+	const struct col_file_header *header;
+	const struct col_footer *footer;
+	const struct col_group_index *groups;
+
+	uint32_t n_sources;
+	const uint64_t *source_offsets;
+	const uint8_t *sources;
+	uint64_t sources_len;
+};
+
+/* A row group's columns, pointing into the file
+ */
+struct col_group {
+	const struct col_group_header *header;
+	uint32_t n_rows;
+	const uint32_t *source;
+	const uint8_t *payload;
+	struct wire_bytes columns[COL_N_COLUMNS];
+};
+
+/* mmap() a colfile and check it over
+ *
+ * returns -1 with errno set if it can't be read, -2 if it isn't a
+ * colfile (or is broken)
+ */
+int col_open(struct col_file *cf, const char *path);
+void col_close(struct col_file *cf);
+
+/* Find row group g and check its columns are where they should be
+ *
+ * returns -1 if they aren't
+ */
+int col_group(const struct col_file *cf, uint32_t g, struct col_group *group);
+
+/* The dictionary entry for a source ID, to walk with col_next_tag()
+ *
+ * returns -1 if there's no such source
+ */
+int col_source(const struct col_file *cf, uint32_t id, struct wire_bytes *entry);
+
+/* Walk the tags of a dictionary entry. *cursor starts as entry->data
+ *
+ * returns 1 and sets tag to the next one, 0 after the last, -1 if the
+ * entry is broken
+ */
+int col_next_tag(const struct wire_bytes *entry, const uint8_t **cursor, struct wire_tag *tag);
+
+/* Decode a row group's timestamps (n_rows of them), NUMBER values and
+ * REAL values (n_numbers and n_reals of them)
+ *
+ * return -1 if the column is broken
+ */
+int col_decode_timestamps(const struct col_group *group, uint64_t *timestamps);
+int col_decode_numbers(const struct col_group *group, int64_t *numbers);
+int col_decode_reals(const struct col_group *group, double *reals);
+
+/* The next TEXT or BINARY value. *cursor starts as
+ * group->columns[COL_BYTES].data
+ *
+ * returns -1 if the column is broken
+ */
+int col_next_bytes(const struct col_group *group, const uint8_t **cursor, struct wire_bytes *value);
+
+#endif
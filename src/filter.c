@@ -0,0 +1,134 @@
+/*
+ * filter - pick out frames without decoding them. See filter.h
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "filter.h"
+
+int filter_add_tag(struct frame_filter *f, const char *arg, int prefix) {
+	const char *eq = strchr(arg, '=');
+	struct filter_tag *t;
+
+	if (eq == NULL || f->n_tags == FILTER_MAX_TAGS)
+		return -1;
+	t = &f->tags[f->n_tags++];
+	t->field.data = (const uint8_t *)arg;
+	t->field.len = eq - arg;
+	t->value.data = (const uint8_t *)eq + 1;
+	t->value.len = strlen(eq + 1);
+	t->prefix = prefix;
+	return 0;
+}
+
+int filter_set_time(struct frame_filter *f, const char *arg) {
+	const char *comma = strchr(arg, ',');
+	char *end;
+
+	if (comma == NULL)
+		return -1;
+	f->alpha = 0;
+	f->omega = UINT64_MAX;
+	errno = 0;
+	if (comma != arg) {
+		f->alpha = strtoull(arg, &end, 10);
+		if (end != comma)
+			return -1;
+	}
+	if (comma[1]) {
+		f->omega = strtoull(comma + 1, &end, 10);
+		if (*end)
+			return -1;
+	}
+	if (errno)
+		return -1;
+	f->have_time = 1;
+	return 0;
+}
+
+int filter_add_payload(struct frame_filter *f, const char *arg) {
+	static const char *names[] = { "EMPTY", "NUMBER", "REAL", "TEXT", "BINARY" };
+	unsigned int i;
+	char *end;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcasecmp(arg, names[i]) == 0) {
+			f->payloads |= 1U << i;
+			return 0;
+		}
+	}
+	i = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end || i >= 32)
+		return -1;
+	f->payloads |= 1U << i;
+	return 0;
+}
+
+static int tag_matches(const struct filter_tag *want, const struct wire_tag *tag) {
+	if (tag->field.len != want->field.len
+			|| memcmp(tag->field.data, want->field.data, want->field.len))
+		return 0;
+	if (want->prefix ? tag->value.len < want->value.len : tag->value.len != want->value.len)
+		return 0;
+	return memcmp(tag->value.data, want->value.data, want->value.len) == 0;
+}
+
+int filter_match(const struct frame_filter *f, const uint8_t *buf, size_t len) {
+	const uint8_t *p = buf, *end = buf + len;
+	uint64_t all = f->n_tags == 64 ? ~0ULL : (1ULL << f->n_tags) - 1;
+	uint64_t matched = 0;
+	int have_time = !f->have_time, have_payload = !f->payloads;
+	int i;
+
+	while (p < end) {
+		struct wire_tag tag;
+		uint64_t key, v;
+
+		if (matched == all && have_time && have_payload)
+			return 1;
+		if (wire_varint(&p, end, &key) < 0)
+			return 1;
+
+		switch (key) {
+			case WIRE_KEY(1, WIRE_LEN):
+				if (matched == all)
+					break;
+				if (wire_varint(&p, end, &v) < 0 || v > end - p
+						|| wire_decode_tag(p, p + v, &tag) < 0)
+					return 1;
+				for (i = 0; i < f->n_tags; i++)
+					if (!(matched & (1ULL << i)) && tag_matches(&f->tags[i], &tag))
+						matched |= 1ULL << i;
+				p += v;
+				continue;
+			case WIRE_KEY(2, WIRE_FIXED64):
+				if (have_time)
+					break;
+				if (end - p < 8)
+					return 1;
+				memcpy(&v, p, sizeof(v));
+				v = le64toh(v);
+				if (v < f->alpha || v > f->omega)
+					return 0;
+				have_time = 1;
+				p += 8;
+				continue;
+			case WIRE_KEY(3, WIRE_VARINT):
+				if (have_payload)
+					break;
+				if (wire_varint(&p, end, &v) < 0)
+					return 1;
+				if (v >= 32 || !(f->payloads & (1U << v)))
+					return 0;
+				have_payload = 1;
+				continue;
+		}
+		if (wire_skip(&p, end, key & 7) < 0)
+			return 1;
+	}
+	return matched == all && have_time && have_payload;
+}
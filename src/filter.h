@@ -0,0 +1,69 @@
+/*
+ * filter - pick out frames by source, time and payload type without
+ * decoding them
+ *
+ * Conditions are all ANDed together, like a RequestSource (see
+ * protobuf/RequestMulti.proto): every tag has to be in the frame's
+ * source, and its timestamp has to be within [alpha, omega]. Payload
+ * types are a set, any of which will do.
+ *
+ * filter_match() works on the raw frame, reading only the keys, tags,
+ * timestamp and payload type, and stops as soon as it knows the answer.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wire.h"
+
+/* Most tags a filter can have */
+#define FILTER_MAX_TAGS	64
+
+struct filter_tag {
+	struct wire_bytes field;
+	struct wire_bytes value;
+	int prefix;		/* value only has to start with value */
+};
+
+struct frame_filter {
+	struct filter_tag tags[FILTER_MAX_TAGS];
+	int n_tags;
+
+	int have_time;
+	uint64_t alpha;
+	uint64_t omega;
+
+	unsigned int payloads;	/* 1 << enum wire_payload for each, 0 for any */
+};
+
+/* Add a "field=value" tag, which with prefix set only has to match the
+ * start of the value. arg has to stick around
+ *
+ * returns -1 if there's no = or too many tags
+ */
+int filter_add_tag(struct frame_filter *f, const char *arg, int prefix);
+
+/* Set the time range from "alpha,omega". Either can be left out
+ *
+ * returns -1 if it doesn't parse
+ */
+int filter_set_time(struct frame_filter *f, const char *arg);
+
+/* Add a payload type, by name (NUMBER, REAL, ...) or number
+ *
+ * returns -1 if we've never heard of it
+ */
+int filter_add_payload(struct frame_filter *f, const char *arg);
+
+static inline int filter_empty(const struct frame_filter *f) {
+	return f->n_tags == 0 && !f->have_time && !f->payloads;
+}
+
+/* Does the frame in buf match? A frame that turns out to be malformed
+ * matches, so that whatever decodes it next gets to complain
+ */
+int filter_match(const struct frame_filter *f, const uint8_t *buf, size_t len);
+
+#endif
@@ -14,98 +14,1053 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "DataFrame.pb-c.h"
+#include "wire.h"
+#include "outbuf.h"
+#include "burststream.h"
+#include "colfile.h"
+#include "intern.h"
+#include "filter.h"
+#include "timeidx.h"
 
-#define BUFFER_SIZE	16384
+/* stdin is read this much at a time */
+#define READ_BLOCK_SIZE	(1 << 20)
+
+/* Frames (and bursts) bigger than this are taken to be garbage */
+#define DEFAULT_MAX_FRAME_SIZE	(64 << 20)
+#define DEFAULT_MAX_BURST_SIZE	(512UL * 1024 * 1024)
+
+/* Write stdin mode output out once this much has built up */
+#define OUTPUT_FLUSH_SIZE	65536
 
 /* Really blunt way to stop invalid data from protobuf-c libraries
  * letting us overrun our buffer.
  */
 #define MAX_STRING_LEN	8000
 
-/* Make sure that the strings in the frame are null
- * terminated (at least up to MAX_STRING
+/* Make sure that the strings in the frame aren't silly long. A source
+ * we've seen before was checked the first time
  */
-int check_frame_bounds(DataFrame *frame){
-	int i;
-	for (i=0; i<frame->n_source; i++) {
-		if (strnlen(frame->source[i]->field, MAX_STRING_LEN) >= MAX_STRING_LEN)
+int check_frame_bounds(struct wire_frame *frame, int new_source){
+	const uint8_t *cursor = frame->source;
+	struct wire_tag tag;
+
+	while (new_source && wire_next_tag(frame, &cursor, &tag)) {
+		if (tag.field.len >= MAX_STRING_LEN)
 			return 1;
-		if (strnlen(frame->source[i]->value, MAX_STRING_LEN) >= MAX_STRING_LEN)
+		if (tag.value.len >= MAX_STRING_LEN)
 			return 1;
 	}
 
-	if (frame->payload == DATA_FRAME__TYPE__TEXT && 
-		strnlen(frame->value_textual, MAX_STRING_LEN) >= MAX_STRING_LEN)
+	if (frame->payload == WIRE_TEXT && 
+		frame->value_textual.len >= MAX_STRING_LEN)
 		return 1;
 	return 0;
 }
 
-void dump_frame_source(FILE *fp, DataFrame *frame) {
-	int i;
-	for (i=0; i < frame->n_source; i++)  {
-		fprintf(fp, "%s%s=%s", (i ? "," : ""),  
-			frame->source[i]->field, frame->source[i]->value ); 
+/* Strings are views into the frame. Stop at a NUL just like the null
+ * terminated strings protobuf-c gave us did.
+ */
+static void put_bytes(struct outbuf *ob, struct wire_bytes b) {
+	const uint8_t *nul = memchr(b.data, 0, b.len);
+
+	outbuf_put(ob, b.data, nul ? nul - b.data : b.len);
+}
+
+/* Print REAL values as short as they'll go rather than like %f */
+static int shortest;
+
+/* Say how the source cache did */
+static int verbose;
+
+/* -s, -S, -T and -p: only frames that match get decoded */
+static struct frame_filter filter;
+static int filtering;
+
+/* 0 until we know which of the defaults to use */
+static size_t max_frame_size = 0;
+
+enum input_format {
+	INPUT_FRAMES,
+	INPUT_BURSTS,
+	INPUT_LZ4_BURSTS
+};
+
+void dump_frame_source(struct outbuf *ob, struct wire_frame *frame) {
+	const uint8_t *cursor = frame->source;
+	struct wire_tag tag;
+	int i = 0;
+
+	while (wire_next_tag(frame, &cursor, &tag)) {
+		if (i++)
+			outbuf_putc(ob, ',');
+		put_bytes(ob, tag.field);
+		outbuf_putc(ob, '=');
+		put_bytes(ob, tag.value);
 	}
 }
 
-void dump_frame(FILE *fp, DataFrame *frame) {
-	dump_frame_source(fp, frame);
-	fprintf(fp, " %lu ", frame->timestamp);
+void dump_frame(struct outbuf *ob, struct wire_frame *frame, const char *source, size_t source_len) {
+	outbuf_put(ob, source, source_len);
+	outbuf_putc(ob, ' ');
+	outbuf_u64(ob, frame->timestamp);
+	outbuf_putc(ob, ' ');
 	switch (frame->payload) {
-		case DATA_FRAME__TYPE__NUMBER:
-			fprintf(fp, "%lu\n", frame->value_numeric); break;
-		case DATA_FRAME__TYPE__REAL:
-			fprintf(fp, "%f\n", frame->value_measurement); break;
-		case DATA_FRAME__TYPE__TEXT:
-			fprintf(fp, "%s\n", frame->value_textual); break;
-		case DATA_FRAME__TYPE__BINARY:
-			fprintf(fp, "(BINARY DATA)\n"); break;
-		case DATA_FRAME__TYPE__EMPTY:
-			fprintf(fp, "(EMPTY)\n"); break;
+		case WIRE_NUMBER:
+			outbuf_u64(ob, frame->value_numeric); break;
+		case WIRE_REAL:
+			if (shortest)
+				outbuf_double_shortest(ob, frame->value_measurement);
+			else
+				outbuf_double_fixed(ob, frame->value_measurement);
+			break;
+		case WIRE_TEXT:
+			put_bytes(ob, frame->value_textual); break;
+		case WIRE_BINARY:
+			outbuf_puts(ob, "(BINARY DATA)"); break;
+		case WIRE_EMPTY:
+			outbuf_puts(ob, "(EMPTY)"); break;
 		default: 
-			fprintf(fp, "(UNKNOWN PAYLOAD TYPE)\n");
+			outbuf_puts(ob, "(UNKNOWN PAYLOAD TYPE)");
 			;;
 	}
+	outbuf_putc(ob, '\n');
 }
 
-int main(int argc, char **argv) {
-	DataFrame *frame;
-	uint8_t *buf;
-	size_t b;
-	FILE *outfp = stdout;
+enum frame_status {
+	FRAME_OK,
+	FRAME_MALFORMED,
+	FRAME_OVERFLOW
+};
 
-	buf = malloc(BUFFER_SIZE);
-	if (buf == NULL) { perror("malloc"); return 1; }
+/* Decode, check and dump a single frame
+ *
+ * Sources are formatted once and kept in sources, which nearly every
+ * frame finds its source in.
+ */
+enum frame_status format_frame(struct outbuf *ob, struct intern_table *sources, const uint8_t *buf, size_t len) {
+	struct wire_frame frame;
+	struct intern_entry *source;
+	struct wire_bytes key;
+	uint64_t hash;
+
+	if (filtering && !filter_match(&filter, buf, len))
+		return FRAME_OK;
+	if (wire_decode_frame(buf, len, &frame) < 0)
+		return FRAME_MALFORMED;
+
+	key = wire_frame_source(&frame);
+	hash = intern_hash(key.data, key.len);
+	source = intern_find(sources, key.data, key.len, hash);
+	if (check_frame_bounds(&frame, source == NULL))
+		return FRAME_OVERFLOW;
+
+	if (source == NULL) {
+		/* Format it where it'll go, and keep a copy */
+		size_t start = ob->len;
+
+		dump_frame_source(ob, &frame);
+		source = intern_add(sources, key.data, key.len, hash, ob->buf + start, ob->len - start);
+		ob->len = start;
+	}
+	dump_frame(ob, &frame, intern_string(sources, source), source->string_len);
+	return FRAME_OK;
+}
 
-	while (1) {
+/* Add up how a source cache did, and then with NULL say how they all
+ * did if we're verbose
+ */
+void report_sources(struct intern_table *sources) {
+	static uint64_t hits, misses, resets;
+
+	if (sources) {
+		hits += sources->hits;
+		misses += sources->misses;
+		resets += sources->resets;
+	} else if (verbose) {
+		fprintf(stderr, "sources: %lu cached, %lu formatted, cache emptied %lu times\n",
+			hits, misses, resets);
+	}
+}
+
+int report_frame_status(enum frame_status status) {
+	switch (status) {
+		case FRAME_MALFORMED:
+			fprintf(stderr, "malformed DataFrame\n");
+			return 1;
+		case FRAME_OVERFLOW:
+			perror("frame string overflow");
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * mmap()ed file mode
+ *
+ * Frames are indexed a batch at a time, and the batch split up between
+ * threads, each of which formats its share into a buffer of its own.
+ * The buffers are written out in order while the threads get on with
+ * the next batch.
+ */
+
+/* Frames each thread formats per batch */
+#define BATCH_FRAMES_PER_THREAD	16384
+
+struct frame_range {
+	const struct wire_bytes *frames;
+	size_t n_frames;
+
+	struct outbuf out;
+	struct intern_table sources;
+	size_t done;			/* frames formatted before status */
+	enum frame_status status;
+};
+
+struct batch {
+	struct wire_bytes *index;
+	size_t n_frames;
+
+	/* What stopped the indexing, to report once the batch is out */
+	enum {
+		INDEX_OK,
+		INDEX_END,
+		INDEX_TOO_BIG,
+		INDEX_TRUNCATED
+	} index_status;
+	uint32_t too_big;
+
+	int n_threads;
+	pthread_t *threads;
+	struct frame_range *ranges;
+};
+
+void *format_range(void *arg) {
+	struct frame_range *r = arg;
+	size_t i;
+
+	r->status = FRAME_OK;
+	r->done = 0;
+	for (i = 0; i < r->n_frames; i++) {
+		r->status = format_frame(&r->out, &r->sources, r->frames[i].data, r->frames[i].len);
+		if (r->status != FRAME_OK)
+			break;
+		r->done++;
+	}
+	return NULL;
+}
+
+/* Index the next batch of frames starting at *off
+ */
+void index_batch(struct batch *batch, const uint8_t *map, size_t size, size_t *off) {
+	size_t max = batch->n_threads * BATCH_FRAMES_PER_THREAD;
+
+	batch->n_frames = 0;
+	batch->index_status = INDEX_OK;
+	while (batch->n_frames < max) {
 		/* network ordered uint32_t leads saying how many bytes to read
 		 * for the next frame
 		 */
 		uint32_t prelude;
-		b = fread(&prelude, sizeof(prelude), 1, stdin);
-		if (b < 1) break;
 
+		if (size - *off < sizeof(prelude)) {
+			batch->index_status = INDEX_END;
+			return;
+		}
+		memcpy(&prelude, map + *off, sizeof(prelude));
 		prelude = ntohl(prelude);
-		if (prelude > BUFSIZ) {
-			fprintf(stderr, "header said frame was %u bytes, but our buffer is only %u bytes. Bailing\n",prelude, BUFSIZ);
+		if (prelude > max_frame_size) {
+			batch->index_status = INDEX_TOO_BIG;
+			batch->too_big = prelude;
+			return;
+		}
+		if (prelude == 0 || size - *off - sizeof(prelude) < prelude) {
+			batch->index_status = INDEX_TRUNCATED;
+			return;
+		}
+
+		batch->index[batch->n_frames].data = map + *off + sizeof(prelude);
+		batch->index[batch->n_frames].len = prelude;
+		batch->n_frames++;
+		*off += sizeof(prelude) + prelude;
+	}
+}
+
+/* Split the batch up and set the threads going
+ */
+void start_batch(struct batch *batch) {
+	size_t per_thread = (batch->n_frames + batch->n_threads - 1) / batch->n_threads;
+	size_t first = 0;
+	int t;
+
+	for (t = 0; t < batch->n_threads; t++) {
+		struct frame_range *r = &batch->ranges[t];
+
+		r->frames = batch->index + first;
+		r->n_frames = batch->n_frames - first < per_thread ? batch->n_frames - first : per_thread;
+		first += r->n_frames;
+		if (pthread_create(&batch->threads[t], NULL, format_range, r)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+}
+
+/* Wait for the threads, then write out what they made of the batch in
+ * order
+ *
+ * returns 0 to carry on, -1 when we're done and 1 on failure
+ */
+int finish_batch(struct batch *batch, int outfd) {
+	int t, ret = 0;
+
+	for (t = 0; t < batch->n_threads; t++)
+		pthread_join(batch->threads[t], NULL);
+
+	for (t = 0; t < batch->n_threads; t++) {
+		struct frame_range *r = &batch->ranges[t];
+
+		if (ret)
+			break;
+		if (outbuf_flush(&r->out, outfd) < 0)
+			return perror("write"), 1;
+		ret = report_frame_status(r->status);
+	}
+	if (ret)
+		return ret;
+
+	switch (batch->index_status) {
+		case INDEX_OK:
+			return 0;
+		case INDEX_END:
+			return -1;
+		case INDEX_TOO_BIG:
+			fprintf(stderr, "header said frame was %u bytes, but the limit is %zu bytes. Bailing\n", batch->too_big, max_frame_size);
 			return 1;
+		case INDEX_TRUNCATED:
+			fprintf(stderr, "file ends part way through a frame\n");
+			return 1;
+	}
+	return 1;
+}
+
+int cat_mapped(const char *path, int n_threads, int outfd) {
+	struct batch batches[2];
+	const uint8_t *map = NULL;
+	struct stat st;
+	size_t off = 0;
+	int fd, i, t, cur = 0, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return perror(path), 1;
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			return perror("mmap"), 1;
+		madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	for (i = 0; i < 2; i++) {
+		batches[i].n_threads = n_threads;
+		batches[i].index = malloc(n_threads * BATCH_FRAMES_PER_THREAD * sizeof(struct wire_bytes));
+		batches[i].threads = malloc(n_threads * sizeof(pthread_t));
+		batches[i].ranges = malloc(n_threads * sizeof(struct frame_range));
+		if (!batches[i].index || !batches[i].threads || !batches[i].ranges)
+			return perror("malloc"), 1;
+		/* Each thread keeps its output buffer and sources from batch
+		 * to batch
+		 */
+		for (t = 0; t < n_threads; t++) {
+			outbuf_init(&batches[i].ranges[t].out, 65536);
+			intern_init(&batches[i].ranges[t].sources, INTERN_DEFAULT_MAX_ENTRIES);
+		}
+	}
+
+	index_batch(&batches[cur], map, st.st_size, &off);
+	start_batch(&batches[cur]);
+	do {
+		/* Get the next batch going before writing this one out */
+		if (batches[cur].index_status == INDEX_OK) {
+			index_batch(&batches[!cur], map, st.st_size, &off);
+			start_batch(&batches[!cur]);
+		}
+		ret = finish_batch(&batches[cur], outfd);
+		cur = !cur;
+	} while (ret == 0);
+
+	/* On failure the next batch may still be going, but we're about
+	 * to exit anyway
+	 */
+	if (ret > 0)
+		return ret;
+
+	for (i = 0; i < 2; i++) {
+		for (t = 0; t < n_threads; t++) {
+			report_sources(&batches[i].ranges[t].sources);
+			outbuf_free(&batches[i].ranges[t].out);
+			intern_free(&batches[i].ranges[t].sources);
+		}
+		free(batches[i].index);
+		free(batches[i].threads);
+		free(batches[i].ranges);
+	}
+	report_sources(NULL);
+	if (map != NULL)
+		munmap((void *)map, st.st_size);
+	return 0;
+}
+
+/*
+ * stdin mode
+ *
+ * stdin is read a block at a time and frames are formatted right where
+ * they sit in the block. Only a frame (or burst) that straddles two
+ * blocks gets copied, into a scratch buffer that grows as big as the
+ * biggest such one (up to max_frame_size). If there's a block or more
+ * of it still to come, that's read straight into the scratch buffer
+ * rather than through the block.
+ *
+ * A regular file (or stdin redirected from one) is mmap()ed instead
+ * and read as one big block, so nothing in it is ever copied.
+ *
+ * With -b each length prefixed item is a DataBurst instead, and with -z
+ * the input is LZ4 compressed DataBursts, each with the 8 byte header
+ * burstnetsink gets them with.
+ */
+
+/* Decompress -z bursts this much at a time */
+#define LZ4_CHUNK_SIZE	(256 * 1024)
+
+struct frame_reader {
+	int fd;
+	uint8_t *block;
+	size_t pos;
+	size_t end;
+	uint64_t remaining;	/* bytes left to read from fd */
+
+	uint8_t *scratch;
+	size_t scratch_size;
+};
+
+enum read_status {
+	READ_OK,
+	READ_END,
+	READ_TOO_BIG,
+	READ_TRUNCATED,
+	READ_ERROR
+};
+
+/* Read the next block
+ *
+ * returns bytes read, 0 at end of file and -1 on failure
+ */
+ssize_t reader_fill(struct frame_reader *r) {
+	size_t want = r->remaining < READ_BLOCK_SIZE ? r->remaining : READ_BLOCK_SIZE;
+	ssize_t n = 0;
+
+	while (want && (n = read(r->fd, r->block, want)) < 0 && errno == EINTR)
+		;
+	r->pos = 0;
+	r->end = n > 0 ? n : 0;
+	r->remaining -= r->end;
+	return n;
+}
+
+/* Copy len bytes out, reading more blocks as we go
+ */
+enum read_status reader_copy(struct frame_reader *r, uint8_t *dst, size_t len) {
+	while (len) {
+		size_t n;
+
+		if (r->pos == r->end) {
+			ssize_t got = reader_fill(r);
+			if (got <= 0)
+				return got < 0 ? READ_ERROR : READ_TRUNCATED;
+		}
+		n = r->end - r->pos < len ? r->end - r->pos : len;
+		memcpy(dst, r->block + r->pos, n);
+		r->pos += n;
+		dst += n;
+		len -= n;
+	}
+	return READ_OK;
+}
+
+/* Read len bytes straight into dst, past the block
+ */
+enum read_status reader_read(struct frame_reader *r, uint8_t *dst, size_t len) {
+	while (len) {
+		size_t want = r->remaining < len ? r->remaining : len;
+		ssize_t n;
+
+		if (want == 0)
+			return READ_TRUNCATED;
+		n = read(r->fd, dst, want);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? READ_ERROR : READ_TRUNCATED;
+		r->remaining -= n;
+		dst += n;
+		len -= n;
+	}
+	return READ_OK;
+}
+
+/* Read a len byte header. Input that ends before a whole one does is
+ * just the end
+ */
+enum read_status reader_header(struct frame_reader *r, void *header, size_t len) {
+	enum read_status status;
+
+	if (r->pos == r->end) {
+		ssize_t got = reader_fill(r);
+		if (got <= 0)
+			return got < 0 ? READ_ERROR : READ_END;
+	}
+	if (r->end - r->pos >= len) {
+		memcpy(header, r->block + r->pos, len);
+		r->pos += len;
+		return READ_OK;
+	}
+	status = reader_copy(r, header, len);
+	return status == READ_TRUNCATED ? READ_END : status;
+}
+
+/* Find the next len bytes, which stay put until the next read
+ */
+enum read_status reader_bytes(struct frame_reader *r, size_t len, const uint8_t **data) {
+	size_t have = r->end - r->pos;
+
+	if (have >= len) {
+		*data = r->block + r->pos;
+		r->pos += len;
+		return READ_OK;
+	}
+
+	if (r->scratch_size < len) {
+		uint8_t *scratch = realloc(r->scratch, len);
+		if (scratch == NULL) {
+			perror("realloc");
+			exit(1);
 		}
-		b = fread(buf, prelude, 1, stdin);
-		if (b < 1) { perror("fread didn't return frame"); return 1;}
+		r->scratch = scratch;
+		r->scratch_size = len;
+	}
+	*data = r->scratch;
+	memcpy(r->scratch, r->block + r->pos, have);
+	r->pos = r->end;
+	if (len - have < READ_BLOCK_SIZE)
+		return reader_copy(r, r->scratch + have, len - have);
+	return reader_read(r, r->scratch + have, len - have);
+}
+
+/* Find the next length prefixed frame (or burst)
+ */
+enum read_status reader_next(struct frame_reader *r, const uint8_t **frame, uint32_t *len) {
+	enum read_status status;
+	/* network ordered uint32_t leads saying how many bytes to read
+	 * for the next frame
+	 */
+	uint32_t prelude;
+
+	status = reader_header(r, &prelude, sizeof(prelude));
+	if (status != READ_OK)
+		return status;
 
-		frame = data_frame__unpack(NULL,prelude,buf);
-		if (frame == NULL) { perror("data_frame__unpack"); return 1; }
+	*len = prelude = ntohl(prelude);
+	if (prelude > max_frame_size)
+		return READ_TOO_BIG;
+	if (prelude == 0)
+		return READ_TRUNCATED;
+	return reader_bytes(r, prelude, frame);
+}
+
+/* Where formatted frames go
+ */
+struct frame_output {
+	struct outbuf buf;
+	struct intern_table sources;
+	int fd;
+	struct col_writer *col;	/* -o, exporting instead */
+	int ret;		/* what to exit with once we stop */
+};
+
+/* Add a frame to the -o colfile
+ */
+int export_frame(struct frame_output *o, const uint8_t *buf, size_t len) {
+	struct wire_frame frame;
+
+	if (filtering && !filter_match(&filter, buf, len))
+		return 0;
+	if (wire_decode_frame(buf, len, &frame) < 0)
+		o->ret = report_frame_status(FRAME_MALFORMED);
+	else if (col_writer_add(o->col, &frame) < 0)
+		perror("writing colfile"), o->ret = 1;
+	return o->ret ? -1 : 0;
+}
+
+/* Format a frame, writing out what has built up if there's enough of
+ * it. Has the right signature for a frame_splitter
+ *
+ * returns -1 (with o->ret set) if we have to stop
+ */
+int output_frame(const uint8_t *frame, size_t len, void *arg) {
+	struct frame_output *o = arg;
+
+	if (o->col)
+		return export_frame(o, frame, len);
+	o->ret = report_frame_status(format_frame(&o->buf, &o->sources, frame, len));
+	if (o->ret || o->buf.len >= OUTPUT_FLUSH_SIZE) {
+		if (outbuf_flush(&o->buf, o->fd) < 0) {
+			perror("write");
+			o->ret = 1;
+		}
+	}
+	return o->ret ? -1 : 0;
+}
 
-		if (check_frame_bounds(frame)) { perror("frame string overflow"); return 1; }
+/* Format every frame in a DataBurst, where it sits
+ */
+int output_burst(struct frame_output *o, const uint8_t *buf, size_t len) {
+	const uint8_t *cursor = buf;
+	struct wire_bytes frame;
+	int more;
+
+	while ((more = wire_burst_next(&cursor, buf + len, &frame)) > 0) {
+		if (output_frame(frame.data, frame.len, o) < 0)
+			return o->ret;
+	}
+	if (more < 0) {
+		outbuf_flush(&o->buf, o->fd);
+		fprintf(stderr, "malformed DataBurst\n");
+		return o->ret = 1;
+	}
+	return 0;
+}
+
+struct lz4_stream {
+	struct frame_splitter splitter;
+	uint8_t *work;		/* LZ4_CHUNKED_WORKSIZE(LZ4_CHUNK_SIZE) */
+};
+
+/* Read the next LZ4 compressed burst and format the frames in it as
+ * they come out of the decompressor, a chunk at a time
+ *
+ * returns READ_OK, the reason we couldn't read a burst, or READ_ERROR
+ * with o->ret set if the burst was bad
+ */
+enum read_status output_lz4_burst(struct frame_output *o, struct frame_reader *r, struct lz4_stream *ls) {
+	enum read_status status;
+	const uint8_t *compressed;
+	uint32_t header[2];
+	long size;
+
+	/* 2 little endian uint32s: uncompressed size, then compressed */
+	status = reader_header(r, header, sizeof(header));
+	if (status != READ_OK)
+		return status;
+	header[0] = le32toh(header[0]);
+	header[1] = le32toh(header[1]);
+	if (header[0] > max_frame_size || header[1] > max_frame_size) {
+		fprintf(stderr, "header said DataBurst was %u bytes (%u compressed), but the limit is %zu bytes. Bailing\n", header[0], header[1], max_frame_size);
+		o->ret = 1;
+		return READ_ERROR;
+	}
+	status = reader_bytes(r, header[1], &compressed);
+	if (status != READ_OK)
+		return status;
+
+	splitter_reset(&ls->splitter);
+	size = lz4_decompress_chunked(compressed, header[1], header[0],
+		ls->work, LZ4_CHUNK_SIZE, splitter_feed, &ls->splitter);
+	if (o->ret)
+		return READ_ERROR;
+
+	outbuf_flush(&o->buf, o->fd);
+	o->ret = 1;
+	if (size == LZ4_CHUNKED_CORRUPT)
+		fprintf(stderr, "DataBurst decompression failure\n");
+	else if (size >= 0 && size != header[0])
+		fprintf(stderr, "uncompressed DataBurst size and header don't match\n");
+	else if (size < 0 || splitter_finish(&ls->splitter) < 0)
+		fprintf(stderr, "malformed DataBurst\n");
+	else
+		o->ret = 0;
+	return o->ret ? READ_ERROR : READ_OK;
+}
+
+/* Read frames (or bursts) until r runs out
+ *
+ * returns why we stopped, which is READ_ERROR with o->ret set if it was
+ * a bad frame
+ */
+enum read_status cat_frames(struct frame_output *o, struct frame_reader *r, struct lz4_stream *ls,
+		enum input_format format, uint32_t *len) {
+	enum read_status status = READ_END;
+	const uint8_t *data;
+
+	switch (format) {
+		case INPUT_FRAMES:
+			while ((status = reader_next(r, &data, len)) == READ_OK)
+				if (output_frame(data, *len, o) < 0)
+					return READ_ERROR;
+			break;
+		case INPUT_BURSTS:
+			while ((status = reader_next(r, &data, len)) == READ_OK)
+				if (output_burst(o, data, *len))
+					return READ_ERROR;
+			break;
+		case INPUT_LZ4_BURSTS:
+			while ((status = output_lz4_burst(o, r, ls)) == READ_OK)
+				;
+			break;
+	}
+	return status;
+}
+
+/* A stretch of a capture for cat_stream() to read
+ */
+struct span {
+	uint64_t offset;
+	uint64_t len;
+};
+
+/* Read everything from fd, or with spans just those parts of it
+ */
+int cat_stream(int fd, int outfd, enum input_format format, struct col_writer *col,
+		const struct span *spans, size_t n_spans) {
+	struct frame_reader r = { .fd = fd, .remaining = UINT64_MAX };
+	struct frame_output o = { .fd = outfd, .col = col };
+	struct lz4_stream ls;
+	enum read_status status = READ_END;
+	uint8_t *map = NULL;
+	struct stat st;
+	off_t start;
+	uint32_t len;
+	size_t i;
+
+	/* The whole file is one block, which reader_fill() never refills */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+			&& (start = lseek(fd, 0, SEEK_CUR)) >= 0 && start < st.st_size) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			return perror("mmap"), 1;
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		r.block = map;
+		r.pos = start;
+		r.end = st.st_size;
+		r.remaining = 0;
+	} else {
+		r.block = malloc(READ_BLOCK_SIZE);
+		if (r.block == NULL)
+			return perror("malloc"), 1;
+	}
+	outbuf_init(&o.buf, OUTPUT_FLUSH_SIZE * 2);
+	intern_init(&o.sources, INTERN_DEFAULT_MAX_ENTRIES);
+	if (format == INPUT_LZ4_BURSTS) {
+		ls.work = malloc(LZ4_CHUNKED_WORKSIZE(LZ4_CHUNK_SIZE));
+		if (ls.work == NULL)
+			return perror("malloc"), 1;
+		splitter_init(&ls.splitter, max_frame_size, output_frame, &o);
+	}
 
-		dump_frame(outfp, frame);
-		data_frame__free_unpacked(frame, NULL);
+	if (spans == NULL) {
+		status = cat_frames(&o, &r, &ls, format, &len);
+	} else {
+		for (i = 0; i < n_spans && status == READ_END; i++) {
+			if (map) {
+				r.pos = spans[i].offset;
+				r.end = spans[i].offset + spans[i].len;
+			} else {
+				if (lseek(fd, spans[i].offset, SEEK_SET) < 0)
+					return perror("lseek"), 1;
+				r.pos = r.end = 0;
+				r.remaining = spans[i].len;
+			}
+			status = cat_frames(&o, &r, &ls, format, &len);
+		}
 	}
+	if (o.ret)
+		return o.ret;
 
-	free(buf);
+	if (outbuf_flush(&o.buf, outfd) < 0)
+		return perror("write"), 1;
+	switch (status) {
+		case READ_TOO_BIG:
+			fprintf(stderr, "header said frame was %u bytes, but the limit is %zu bytes. Bailing\n", len, max_frame_size);
+			return 1;
+		case READ_TRUNCATED:
+			fprintf(stderr, "input ends part way through a %s\n",
+				format == INPUT_FRAMES ? "frame" : "burst");
+			return 1;
+		case READ_ERROR:
+			perror("read");
+			return 1;
+		default:
+			break;
+	}
 
+	if (!col) {
+		report_sources(&o.sources);
+		report_sources(NULL);
+	}
+	if (format == INPUT_LZ4_BURSTS) {
+		splitter_free(&ls.splitter);
+		free(ls.work);
+	}
+	intern_free(&o.sources);
+	outbuf_free(&o.buf);
+	free(r.scratch);
+	if (map)
+		munmap(map, st.st_size);
+	else
+		free(r.block);
 	return 0;
 }
+
+/* -i: work out which spans of the capture in fd could have frames from
+ * the -T time range in them, going by its time index (see timeidx.h),
+ * and whether it's DataBursts or DataFrames
+ *
+ * Neighbouring spans are read in one go, and whatever comes after the
+ * last one the index knows about is read regardless
+ *
+ * returns how many spans there are in *spans, or -1
+ */
+long read_index(const char *path, int fd, enum input_format *format, struct span **spans) {
+	const struct timeidx_entry *entries;
+	const uint8_t *map;
+	struct stat st, capture;
+	uint64_t alpha = 0, omega = UINT64_MAX, end = 0, total = 0;
+	size_t n_entries, lo, hi, i;
+	uint32_t kind;
+	long n = 0;
+	int index_fd;
+
+	index_fd = open(path, O_RDONLY);
+	if (index_fd < 0 || fstat(index_fd, &st) < 0 || fstat(fd, &capture) < 0)
+		return perror(path), -1;
+	if (st.st_size < TIMEIDX_HEADER_SIZE
+			|| (st.st_size - TIMEIDX_HEADER_SIZE) % sizeof(struct timeidx_entry))
+		return fprintf(stderr, "%s isn't a time index\n", path), -1;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, index_fd, 0);
+	if (map == MAP_FAILED)
+		return perror("mmap"), -1;
+	close(index_fd);
+
+	memcpy(&kind, map + 8, sizeof(kind));
+	if (memcmp(map, TIMEIDX_MAGIC, 8) || (kind != TIMEIDX_BURSTS && kind != TIMEIDX_FRAMES))
+		return fprintf(stderr, "%s isn't a time index\n", path), -1;
+	*format = kind == TIMEIDX_BURSTS ? INPUT_BURSTS : INPUT_FRAMES;
+
+	entries = (const struct timeidx_entry *)(map + TIMEIDX_HEADER_SIZE);
+	n_entries = (st.st_size - TIMEIDX_HEADER_SIZE) / sizeof(struct timeidx_entry);
+	if (n_entries)
+		end = entries[n_entries - 1].offset + entries[n_entries - 1].len;
+	if (end > (uint64_t)capture.st_size)
+		return fprintf(stderr, "%s indexes more than the capture has in it\n", path), -1;
+
+	if (filter.have_time) {
+		alpha = filter.alpha;
+		omega = filter.omega;
+	}
+
+	/* Everything before the first span with a max_so_far of at least
+	 * alpha ends too early
+	 */
+	lo = 0;
+	hi = n_entries;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (entries[mid].max_so_far < alpha)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*spans = malloc((n_entries - lo + 1) * sizeof(**spans));
+	if (*spans == NULL)
+		return perror("malloc"), -1;
+	for (i = lo; i <= n_entries; i++) {
+		struct span next;
+
+		if (i < n_entries) {
+			if (entries[i].min_timestamp > omega || entries[i].max_timestamp < alpha)
+				continue;
+			next.offset = entries[i].offset;
+			next.len = entries[i].len;
+		} else {
+			next.offset = end;
+			next.len = capture.st_size - end;
+			if (next.len == 0)
+				break;
+		}
+
+		total += next.len;
+		if (n && (*spans)[n - 1].offset + (*spans)[n - 1].len == next.offset)
+			(*spans)[n - 1].len += next.len;
+		else
+			(*spans)[n++] = next;
+	}
+	munmap((void *)map, st.st_size);
+
+	if (verbose)
+		fprintf(stderr, "index: reading %lu of %lu bytes, in %ld pieces\n",
+			total, (uint64_t)capture.st_size, n);
+	return n;
+}
+
+int main(int argc, char **argv) {
+	enum input_format format = INPUT_FRAMES;
+	const char *export_path = NULL, *index_path = NULL;
+	struct col_writer *col = NULL;
+	struct span *spans = NULL;
+	long n_spans = 0;
+	int n_threads = 0, fd, outfd = -1, ret;
+
+	argv++; argc--;
+	while (argc > 0 && **argv == '-') {
+		if (strncmp("-t", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			n_threads = atoi(*argv);
+		}
+		else if (strncmp("-m", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			max_frame_size = strtoul(*argv, NULL, 10);
+		}
+		else if (strncmp("-o", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			export_path = *argv;
+		}
+		else if (strncmp("-i", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			index_path = *argv;
+		}
+		else if (strncmp("-r", *argv, 3) == 0) {
+			shortest = 1;
+		}
+		else if (strncmp("-v", *argv, 3) == 0) {
+			verbose = 1;
+		}
+		else if (strncmp("-s", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			if (filter_add_tag(&filter, *argv, 0) < 0)
+				return fprintf(stderr, "-s wants field=value (and at most %d of them)\n", FILTER_MAX_TAGS), 1;
+		}
+		else if (strncmp("-S", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			if (filter_add_tag(&filter, *argv, 1) < 0)
+				return fprintf(stderr, "-S wants field=prefix (and at most %d of them)\n", FILTER_MAX_TAGS), 1;
+		}
+		else if (strncmp("-T", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			if (filter_set_time(&filter, *argv) < 0)
+				return fprintf(stderr, "-T wants alpha,omega\n"), 1;
+		}
+		else if (strncmp("-p", *argv, 3) == 0 && argc > 1) {
+			argv++; argc--;
+			if (filter_add_payload(&filter, *argv) < 0)
+				return fprintf(stderr, "-p wants EMPTY, NUMBER, REAL, TEXT or BINARY\n"), 1;
+		}
+		else if (strncmp("-b", *argv, 3) == 0 || strncmp("--burst", *argv, 8) == 0) {
+			format = INPUT_BURSTS;
+		}
+		else if (strncmp("-z", *argv, 3) == 0 || strncmp("--lz4", *argv, 6) == 0) {
+			format = INPUT_LZ4_BURSTS;
+		}
+		else {
+			fprintf(stderr, "framecat [-r] [-v] [-b|-z] [-m bytes] [-t threads] [-o colfile]\n"
+				"\t[-s field=value] [-S field=prefix] [-T alpha,omega] [-p type]\n"
+				"\t[-i index file | file]\n\n"
+					"\treads DataFrames from file (mmap()ed and formatted"
+					" by threads,\n\tone per CPU by default) or stdin\n\n"
+					"\t-r prints REAL values in as few digits as will read"
+					" back\n\t   exactly, rather than like printf's %%f\n"
+					"\t-v says how many sources were formatted and how many"
+					" were\n\t   already in the cache\n"
+					"\t-b (--burst) reads DataBursts, like burstnetsink writes\n"
+					"\t-z (--lz4) reads LZ4 compressed DataBursts with the"
+					" 8 byte\n\t   header they come over the wire with\n"
+					"\t-o writes frames to a columnar file (- for stdout) for\n\t   colcat instead\n"
+					"\t-m bails on frames (or bursts) bigger than this\n"
+					"\t   (default %d, or %lu with -b or -z)\n"
+					"\t-i only reads the parts of a burstnetsink capture its"
+					" -I time\n\t   index says could be in the -T range,"
+					" and whether it's\n\t   bursts or frames\n\n"
+					"\tonly frames with all the tags given by -s (or with values"
+					"\n\tstarting with -S), timestamps from alpha to omega"
+					" (either can be\n\tleft out) and one of the -p"
+					" payload types are output\n",
+					DEFAULT_MAX_FRAME_SIZE, DEFAULT_MAX_BURST_SIZE);
+			return 1;
+		}
+		argv++; argc--;
+	}
+
+	filtering = !filter_empty(&filter);
+
+	if (argc == 0) {
+		if (index_path)
+			return fprintf(stderr, "-i needs the capture it indexes\n"), 1;
+		fd = STDIN_FILENO;
+	} else if ((fd = open(*argv, O_RDONLY)) < 0) {
+		return perror(*argv), 1;
+	}
+	/* The index says what's in the capture as well as where to look */
+	if (index_path) {
+		if (format == INPUT_LZ4_BURSTS)
+			return fprintf(stderr, "-i is for burstnetsink captures, which aren't LZ4\n"), 1;
+		n_spans = read_index(index_path, fd, &format, &spans);
+		if (n_spans < 0)
+			return 1;
+	}
+	if (max_frame_size == 0)
+		max_frame_size = format == INPUT_FRAMES ? DEFAULT_MAX_FRAME_SIZE : DEFAULT_MAX_BURST_SIZE;
+
+	if (argc > 0 && format == INPUT_FRAMES && export_path == NULL && index_path == NULL) {
+		close(fd);
+		if (n_threads < 1)
+			n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_threads < 1)
+			n_threads = 1;
+		return cat_mapped(*argv, n_threads, STDOUT_FILENO);
+	}
+
+	/* Everything else is read a block at a time, from files too */
+	if (export_path) {
+		if (strcmp(export_path, "-") == 0)
+			outfd = dup(STDOUT_FILENO);
+		else
+			outfd = open(export_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (outfd < 0)
+			return perror(export_path), 1;
+		col = col_writer_open(outfd, COL_DEFAULT_ROWS_PER_GROUP);
+		if (col == NULL)
+			return perror("starting colfile"), 1;
+	}
+
+	ret = cat_stream(fd, STDOUT_FILENO, format, col, spans, n_spans);
+	close(fd);
+	free(spans);
+
+	if (col) {
+		/* Whatever made it in is still worth having */
+		if (col_writer_close(col) < 0)
+			return perror("writing colfile"), 1;
+		if (close(outfd) < 0)
+			return perror(export_path), 1;
+	}
+	return ret;
+}
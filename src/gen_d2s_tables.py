@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+#
+# Generate d2s_tables.h, the powers of 5 outbuf_double_shortest() needs
+#
+#	./gen_d2s_tables.py > d2s_tables.h
+#
+# These are the tables from Ulf Adams' Ryu, split into 64 bit halves.
+
+POW5_INV_BITCOUNT = 125
+POW5_BITCOUNT = 125
+POW5_INV_TABLE_SIZE = 342
+POW5_TABLE_SIZE = 326
+
+def split(v):
+    return "{ %du, %du }" % (v & ((1 << 64) - 1), v >> 64)
+
+def table(name, size, entry):
+    print("static const uint64_t %s[%d][2] = {" % (name, size))
+    for i in range(size):
+        print("\t%s," % split(entry(i)))
+    print("};")
+    print("")
+
+# ceil(2^(bitlength(5^q) - 1 + POW5_INV_BITCOUNT) / 5^q)
+def pow5_inv(q):
+    p = 5 ** q
+    return (1 << (p.bit_length() - 1 + POW5_INV_BITCOUNT)) // p + 1
+
+# the top POW5_BITCOUNT bits of 5^i
+def pow5(i):
+    p = 5 ** i
+    shift = p.bit_length() - POW5_BITCOUNT
+    return p >> shift if shift >= 0 else p << -shift
+
+print("/* Generated by gen_d2s_tables.py, don't edit */")
+print("#ifndef D2S_TABLES_H")
+print("#define D2S_TABLES_H")
+print("")
+print("#define DOUBLE_POW5_INV_BITCOUNT %d" % POW5_INV_BITCOUNT)
+print("#define DOUBLE_POW5_BITCOUNT %d" % POW5_BITCOUNT)
+print("")
+table("DOUBLE_POW5_INV_SPLIT", POW5_INV_TABLE_SIZE, pow5_inv)
+table("DOUBLE_POW5_SPLIT", POW5_TABLE_SIZE, pow5)
+print("#endif")
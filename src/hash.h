@@ -0,0 +1,33 @@
+/*
+ * hash.h - the one byte hash everything here uses
+ *
+ * FNV-1a a word at a time rather than a byte, which is much faster over
+ * the long keys (frame sources, whole bursts) we throw at it. Callers mix
+ * or fold the result to suit: see intern_hash() and spool_checksum().
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_FNV_OFFSET	14695981039346656037ULL
+#define HASH_FNV_PRIME	1099511628211ULL
+
+/* Carry on hashing buf from h, which starts as HASH_FNV_OFFSET */
+static inline uint64_t hash_fnv1a(uint64_t h, const uint8_t *buf, size_t len) {
+	uint64_t w;
+
+	while (len >= sizeof(w)) {
+		memcpy(&w, buf, sizeof(w));
+		h = (h ^ w) * HASH_FNV_PRIME;
+		buf += sizeof(w);
+		len -= sizeof(w);
+	}
+	while (len--)
+		h = (h ^ *(buf++)) * HASH_FNV_PRIME;
+	return h;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * intern - remember the sources we've already seen. See intern.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "intern.h"
+
+static void *alloc_or_die(void *p) {
+	if (p == NULL) {
+		perror("intern");
+		exit(1);
+	}
+	return p;
+}
+
+void intern_init(struct intern_table *t, size_t max_entries) {
+	memset(t, 0, sizeof(*t));
+	t->max_entries = max_entries ? max_entries : INTERN_DEFAULT_MAX_ENTRIES;
+	for (t->n_slots = 16; t->n_slots < t->max_entries * 2; t->n_slots *= 2)
+		;
+	t->slots = alloc_or_die(calloc(t->n_slots, sizeof(*t->slots)));
+	t->arena_size = 65536;
+	t->arena = alloc_or_die(malloc(t->arena_size));
+}
+
+void intern_free(struct intern_table *t) {
+	free(t->slots);
+	free(t->arena);
+	t->slots = NULL;
+	t->arena = NULL;
+}
+
+/* hash_fnv1a(), then mixed so the low bits are any good as a table
+ * index
+ */
+uint64_t intern_hash(const uint8_t *key, size_t len) {
+	uint64_t h = hash_fnv1a(HASH_FNV_OFFSET ^ len, key, len);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+struct intern_entry *intern_find(struct intern_table *t, const uint8_t *key, size_t len, uint64_t hash) {
+	size_t i;
+
+	for (i = hash & (t->n_slots - 1); t->slots[i].used; i = (i + 1) & (t->n_slots - 1)) {
+		struct intern_entry *e = &t->slots[i];
+
+		if (e->hash == hash && e->key_len == len
+				&& memcmp(t->arena + e->key, key, len) == 0) {
+			t->hits++;
+			return e;
+		}
+	}
+	t->misses++;
+	return NULL;
+}
+
+static size_t arena_put(struct intern_table *t, const void *data, size_t len) {
+	size_t off = t->arena_len;
+
+	if (t->arena_size - t->arena_len < len) {
+		while (t->arena_size - t->arena_len < len)
+			t->arena_size *= 2;
+		t->arena = alloc_or_die(realloc(t->arena, t->arena_size));
+	}
+	memcpy(t->arena + off, data, len);
+	t->arena_len += len;
+	return off;
+}
+
+struct intern_entry *intern_add(struct intern_table *t, const uint8_t *key, size_t len, uint64_t hash,
+		const char *string, size_t string_len) {
+	struct intern_entry *e;
+	size_t i;
+
+	if (t->n_entries == t->max_entries) {
+		memset(t->slots, 0, t->n_slots * sizeof(*t->slots));
+		t->n_entries = 0;
+		t->arena_len = 0;
+		t->resets++;
+	}
+
+	for (i = hash & (t->n_slots - 1); t->slots[i].used; i = (i + 1) & (t->n_slots - 1))
+		;
+	e = &t->slots[i];
+	e->used = 1;
+	e->hash = hash;
+	e->key_len = len;
+	e->key = arena_put(t, key, len);
+	e->string_len = string_len;
+	e->string = arena_put(t, string, string_len);
+	e->id = 0;
+	t->n_entries++;
+	return e;
+}
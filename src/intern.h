@@ -0,0 +1,72 @@
+/*
+ * intern - remember the sources we've already seen
+ *
+ * Nearly every frame in a burst has a source that some frame before it
+ * had too, so rather than walk and format the same tags over and over,
+ * look the frame's raw source bytes up here (see wire_frame_source())
+ * and keep whatever you made of them the first time: a formatted string,
+ * an ID, or both.
+ *
+ * It's an open addressing table with linear probing. Once it holds
+ * max_entries it's emptied and starts over, so a stream with ever more
+ * sources can't take all our memory.
+ *
+ * Not thread safe; give each thread its own.
+ */
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERN_DEFAULT_MAX_ENTRIES	65536
+
+struct intern_entry {
+	uint64_t hash;
+	size_t key;		/* offsets into the table's arena */
+	size_t string;
+	uint32_t key_len;
+	uint32_t string_len;
+	uint32_t id;		/* for the caller */
+	int used;
+};
+
+struct intern_table {
+	struct intern_entry *slots;
+	size_t n_slots;		/* a power of 2, at least twice max_entries */
+	size_t n_entries;
+	size_t max_entries;
+
+	/* Keys and strings */
+	char *arena;
+	size_t arena_len;
+	size_t arena_size;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t resets;	/* times it filled up and was emptied */
+};
+
+void intern_init(struct intern_table *t, size_t max_entries);
+void intern_free(struct intern_table *t);
+
+uint64_t intern_hash(const uint8_t *key, size_t len);
+
+/* Look key up, counting a hit or a miss
+ *
+ * returns NULL if it isn't there
+ */
+struct intern_entry *intern_find(struct intern_table *t, const uint8_t *key, size_t len, uint64_t hash);
+
+/* Add a key intern_find() didn't find, along with the string to keep
+ * for it (which can be empty). This can empty the table, so any other
+ * entries you have hold of are gone after it.
+ */
+struct intern_entry *intern_add(struct intern_table *t, const uint8_t *key, size_t len, uint64_t hash,
+	const char *string, size_t string_len);
+
+static inline const char *intern_string(const struct intern_table *t, const struct intern_entry *e) {
+	return t->arena + e->string;
+}
+
+#endif
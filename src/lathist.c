@@ -0,0 +1,69 @@
+/*
+ * lathist - log-linear latency histogram. See lathist.h
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "lathist.h"
+
+/* The biggest value that goes in bucket i */
+static uint64_t bucket_top(unsigned int i) {
+	unsigned int shift;
+
+	if (i < 2 * LATHIST_HALF)
+		return i;
+	shift = i / LATHIST_HALF - 1;
+	return ((uint64_t)(i - shift * LATHIST_HALF + 1) << shift) - 1;
+}
+
+void lathist_reset(struct lathist *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+void lathist_add(struct lathist *dst, const struct lathist *src) {
+	unsigned int i;
+
+	if (src->count == 0)
+		return;
+	for (i = 0; i < LATHIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+}
+
+void lathist_sub(struct lathist *dst, const struct lathist *src) {
+	unsigned int i;
+
+	if (src->count == 0)
+		return;
+	for (i = 0; i < LATHIST_BUCKETS; i++)
+		dst->buckets[i] -= src->buckets[i];
+	dst->count -= src->count;
+}
+
+uint64_t lathist_percentile(const struct lathist *h, double p) {
+	uint64_t want, seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+	want = p / 100 * h->count + 0.5;
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < LATHIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			return bucket_top(i);
+	}
+	return bucket_top(LATHIST_BUCKETS - 1);
+}
+
+uint64_t lathist_max(const struct lathist *h) {
+	unsigned int i = LATHIST_BUCKETS;
+
+	if (h->count == 0)
+		return 0;
+	while (i-- > 0)
+		if (h->buckets[i])
+			return bucket_top(i);
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * lathist - fixed size log-linear histogram of latencies, HdrHistogram
+ * style
+ *
+ * Values (microseconds, say) below 2^LATHIST_SUB_BITS get a bucket each.
+ * Above that every power of 2 range is split into 2^(LATHIST_SUB_BITS-1)
+ * equal buckets, so a value is only ever out by at most 1 part in 64,
+ * however big it is. Anything from 2^LATHIST_MAX_BITS up goes in the top
+ * bucket.
+ *
+ * Recording is an index calculation and an increment. Histograms of
+ * the same shape add and subtract bucket by bucket, so windows can be
+ * built up out of smaller ones (and taken apart again).
+ */
+#ifndef LATHIST_H
+#define LATHIST_H
+
+#include <stdint.h>
+
+#define LATHIST_SUB_BITS	7
+#define LATHIST_MAX_BITS	36
+#define LATHIST_HALF		(1 << (LATHIST_SUB_BITS - 1))
+#define LATHIST_BUCKETS		((LATHIST_MAX_BITS - LATHIST_SUB_BITS + 2) * LATHIST_HALF)
+
+struct lathist {
+	uint64_t count;
+	uint32_t buckets[LATHIST_BUCKETS];
+};
+
+static inline unsigned int lathist_index(uint64_t v) {
+	unsigned int shift;
+
+	if (v < 2 * LATHIST_HALF)
+		return v;
+	if (v >= 1ULL << LATHIST_MAX_BITS)
+		v = (1ULL << LATHIST_MAX_BITS) - 1;
+	shift = 63 - __builtin_clzll(v) - (LATHIST_SUB_BITS - 1);
+	return shift * LATHIST_HALF + (v >> shift);
+}
+
+static inline void lathist_record(struct lathist *h, uint64_t v) {
+	h->buckets[lathist_index(v)]++;
+	h->count++;
+}
+
+/* Put in (or take back out) a value that goes in bucket i, for callers
+ * that keep lathist_index() rather than the value
+ */
+static inline void lathist_record_bucket(struct lathist *h, unsigned int i) {
+	h->buckets[i]++;
+	h->count++;
+}
+
+static inline void lathist_remove_bucket(struct lathist *h, unsigned int i) {
+	h->buckets[i]--;
+	h->count--;
+}
+
+void lathist_reset(struct lathist *h);
+
+/* dst += src, and dst -= src for a src that's already been added */
+void lathist_add(struct lathist *dst, const struct lathist *src);
+void lathist_sub(struct lathist *dst, const struct lathist *src);
+
+/* The biggest value that would go in the same bucket as the p'th
+ * percentile (0 to 100), like HdrHistogram's getValueAtPercentile()
+ *
+ * returns 0 if there's nothing in it
+ */
+uint64_t lathist_percentile(const struct lathist *h, double p);
+
+/* The biggest value that would go in the highest bucket with anything in
+ * it, 0 if none do
+ */
+uint64_t lathist_max(const struct lathist *h);
+
+#endif
@@ -1,41 +1,432 @@
 /* marquise_telemetry - connect to a chateau broker and stream all marquise telemetry to stdout
+ *
+ * As text by default, one message a line. -c splits the messages up
+ * (see telemetry.h) and prints what's going on once a second, the same
+ * things marquise_throughput.py works out; -B writes them as binary
+ * records for something else to read without splitting them up again.
+ *
+ * Output is flushed once there's nothing more to read, or every -F
+ * milliseconds if there always is, rather than after every message.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <assert.h>
 #include <zmq.h>
 
+#include "intern.h"
+#include "outstanding.h"
+#include "telemetry.h"
+
+#define DEFAULT_FLUSH_MSECS	100
+#define DEFAULT_EXPIRE_SECONDS	600
+
+#define MARQUISED_PREFIX	"marquised:"
+
+static int print_counters = 0;
+static int binary_records = 0;
+static double expire_seconds = DEFAULT_EXPIRE_SECONDS;
+
+/* Kinds of message, by signature */
+typedef void (*handler_fn)(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed);
+static struct intern_table kind_names;
+static handler_fn kinds[TELEMETRY_MAX_KINDS];
+static unsigned int n_kinds;
+
+/* -B: identities */
+static struct intern_table idents;
+static unsigned int n_idents;
+
+/* -c: what's happened since the last line. Points are a burst's frames */
+static struct {
+	uint64_t messages;
+	uint64_t malformed;
+	uint64_t bursts;
+	uint64_t points;
+	uint64_t acked_bursts;
+	uint64_t acked_points;
+	double latency;		/* seconds, over the acked bursts */
+	uint64_t deferred_written;
+	uint64_t deferred_read;
+	uint64_t timed_out;
+} counts;
+
+static struct outstanding outstanding;
+static struct intern_table relaying_hosts;	/* those sending through marquised */
+static double latest;				/* newest message, in seconds */
+static unsigned long lines_printed;
+
+/* When to flush what's been written even if there's more to read, or 0
+ * when there's nothing to flush
+ */
+static double flush_at;
+
+static double now_seconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Bursts are outstanding by their host and burst id, whether the
+ * telemetry about them came from the host or from marquised on its
+ * behalf
+ */
+static int burst_points(const struct telemetry_msg *m, const struct telemetry_token *host,
+		double *received, uint32_t *points) {
+	uint64_t hash = intern_hash((const uint8_t *)host->p, host->len);
+
+	return outstanding_get(&outstanding, &hash, sizeof(hash), &m->burst_id, sizeof(m->burst_id),
+		received, points);
+}
+
+static void on_burst(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed) {
+	uint64_t hash = intern_hash((const uint8_t *)host->p, host->len);
+	int64_t frames;
+
+	if (!telemetry_value(m, "frames", &frames) || frames < 0) {
+		counts.malformed++;
+		return;
+	}
+	counts.bursts++;
+	counts.points += frames;
+	outstanding_add(&outstanding, &hash, sizeof(hash), &m->burst_id, sizeof(m->burst_id),
+		frames, m->timestamp / 1e9);
+}
+
+static void on_ack(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed) {
+	uint64_t hash = intern_hash((const uint8_t *)host->p, host->len);
+	double received;
+	uint32_t points;
+
+	/* Hosts sending through marquised are acked by it straight away.
+	 * Wait for the ack marquised gets from the broker instead
+	 */
+	if (!relayed && intern_find(&relaying_hosts, (const uint8_t *)host->p, host->len, hash))
+		return;
+	if (!outstanding_ack(&outstanding, &hash, sizeof(hash), &m->burst_id, sizeof(m->burst_id),
+			&received, &points))
+		return;
+
+	counts.acked_bursts++;
+	counts.acked_points += points;
+	if (m->timestamp / 1e9 > received)
+		counts.latency += m->timestamp / 1e9 - received;
+}
+
+static void on_deferred_write(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed) {
+	double received;
+	uint32_t points;
+
+	if (burst_points(m, host, &received, &points))
+		counts.deferred_written += points;
+}
+
+static void on_deferred_read(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed) {
+	double received;
+	uint32_t points;
+
+	if (burst_points(m, host, &received, &points))
+		counts.deferred_read += points;
+}
+
+static void on_send_timeout(const struct telemetry_msg *m, const struct telemetry_token *host, int relayed) {
+	double received;
+	uint32_t points;
+
+	if (burst_points(m, host, &received, &points)) {
+		counts.deferred_written += points;
+		counts.timed_out += points;
+	}
+}
+
+/* Signatures start with these. The first match wins */
+static const struct {
+	const char *prefix;
+	handler_fn handle;
+} handlers[] = {
+	{ "collator_thread created_databurst", on_burst },
+	{ "poller_thread rx_ack_from broker", on_ack },
+	{ "poller_thread defer_to_disk timeout_waiting_for_ack", on_send_timeout },
+	{ "poller_thread defer_to_disk", on_deferred_write },
+	{ "poller_thread read_from_disk", on_deferred_read },
+};
+
+static handler_fn find_handler(const char *sig, size_t len) {
+	size_t i;
+
+	for (i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+		size_t n = strlen(handlers[i].prefix);
+
+		if (len >= n && memcmp(sig, handlers[i].prefix, n) == 0 && (len == n || sig[n] == ' '))
+			return handlers[i].handle;
+	}
+	return NULL;
+}
+
+/* -B: write a record naming ID id, padded to 8 */
+static void write_name(uint8_t kind, unsigned int id, const char *name, size_t len) {
+	static const char zeros[8];
+	struct telemetry_record r = { 0, 0, id, kind, len };
+
+	fwrite(&r, sizeof(r), 1, stdout);
+	fwrite(name, len, 1, stdout);
+	fwrite(zeros, -len & 7, 1, stdout);
+}
+
+/* ID for the kind of message m is, which is named first if it's new
+ *
+ * returns -1 if its signature's too long
+ */
+static int find_kind(const struct telemetry_msg *m) {
+	char sig[TELEMETRY_MAX_SIGNATURE];
+	struct intern_entry *e;
+	uint64_t hash;
+	int len;
+
+	len = telemetry_signature(m, sig);
+	if (len < 0)
+		return -1;
+	hash = intern_hash((const uint8_t *)sig, len);
+	e = intern_find(&kind_names, (const uint8_t *)sig, len, hash);
+	if (e)
+		return e->id;
+
+	/* It empties itself when it's full, so the IDs start over */
+	if (kind_names.n_entries == kind_names.max_entries)
+		n_kinds = 0;
+	e = intern_add(&kind_names, (const uint8_t *)sig, len, hash, "", 0);
+	e->id = n_kinds++;
+	kinds[e->id] = find_handler(sig, len);
+	if (binary_records)
+		write_name(TELEMETRY_DEFINE_KIND, e->id, sig, len);
+	return e->id;
+}
+
+/* -B: ID for m's identity, named first if it's new
+ *
+ * returns -1 if it's too long to name
+ */
+static int find_ident(const struct telemetry_msg *m) {
+	const uint8_t *ident = (const uint8_t *)m->ident.p;
+	struct intern_entry *e;
+	uint64_t hash;
+
+	if (m->ident.len > UINT8_MAX)
+		return -1;
+	hash = intern_hash(ident, m->ident.len);
+	e = intern_find(&idents, ident, m->ident.len, hash);
+	if (e)
+		return e->id;
+
+	if (idents.n_entries == idents.max_entries)
+		n_idents = 0;
+	e = intern_add(&idents, ident, m->ident.len, hash, "", 0);
+	e->id = n_idents++;
+	write_name(TELEMETRY_DEFINE_IDENT, e->id, m->ident.p, m->ident.len);
+	return e->id;
+}
+
+static void handle_message(const char *buf, size_t len) {
+	struct telemetry_msg m;
+	struct telemetry_token host;
+	int kind, ident, relayed;
+
+	if (!print_counters && !binary_records) {
+		fwrite(buf, len, 1, stdout);
+		fputc('\n', stdout);
+		return;
+	}
+
+	counts.messages++;
+	if (telemetry_parse(buf, len, &m) < 0 || (kind = find_kind(&m)) < 0) {
+		counts.malformed++;
+		return;
+	}
+
+	if (binary_records) {
+		struct telemetry_record r;
+
+		if ((ident = find_ident(&m)) < 0) {
+			counts.malformed++;
+			return;
+		}
+		r.timestamp = m.timestamp;
+		r.burst_id = m.burst_id;
+		r.ident = ident;
+		r.kind = TELEMETRY_FIRST_KIND + kind;
+		r.n_values = m.n_values;
+		fwrite(&r, sizeof(r), 1, stdout);
+		fwrite(m.values, sizeof(m.values[0]), m.n_values, stdout);
+		return;
+	}
+
+	host = m.ident;
+	relayed = host.len >= strlen(MARQUISED_PREFIX)
+		&& memcmp(host.p, MARQUISED_PREFIX, strlen(MARQUISED_PREFIX)) == 0;
+	if (relayed) {
+		uint64_t hash;
+
+		host.p += strlen(MARQUISED_PREFIX);
+		host.len -= strlen(MARQUISED_PREFIX);
+		hash = intern_hash((const uint8_t *)host.p, host.len);
+		if (!intern_find(&relaying_hosts, (const uint8_t *)host.p, host.len, hash))
+			intern_add(&relaying_hosts, (const uint8_t *)host.p, host.len, hash, "", 0);
+	}
+	if (m.timestamp / 1e9 > latest)
+		latest = m.timestamp / 1e9;
+	if (kinds[kind])
+		kinds[kind](&m, &host, relayed);
+}
+
+/* -c: a line of what's happened since the last one, with the column
+ * headings every 20 lines
+ */
+static void print_line(void) {
+	if (lines_printed++ % 20 == 0)
+		printf("#%9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n"
+			"#%9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+			"messages", "malformed", "bursts", "points", "acked", "acked", "latency",
+			"deferred", "deferred", "timed out", "unacked", "unacked", "expired",
+			"", "", "", "", "bursts", "points", "ms/burst",
+			"written", "read", "points", "bursts", "points", "bursts");
+
+	if (expire_seconds > 0)
+		outstanding_expire(&outstanding, latest - expire_seconds);
+	printf(" %9lu %9lu %9lu %9lu %9lu %9lu %9.2f %9lu %9lu %9lu %9lu %9lu %9lu\n",
+		counts.messages, counts.malformed, counts.bursts, counts.points,
+		counts.acked_bursts, counts.acked_points,
+		counts.acked_bursts ? counts.latency * 1e3 / counts.acked_bursts : 0,
+		counts.deferred_written, counts.deferred_read, counts.timed_out,
+		outstanding.count, outstanding.points, outstanding.expired);
+	memset(&counts, 0, sizeof(counts));
+}
+
+/* Wait for something to read, printing -c lines on the way. What's been
+ * written is flushed once there's nothing to read, or by flush_at if
+ * there always is
+ *
+ * returns -1 on error
+ */
+static int wait_for_messages(void *sock) {
+	static double next_line;
+	zmq_pollitem_t item = { sock, 0, ZMQ_POLLIN, 0 };
+
+	if (next_line == 0)
+		next_line = now_seconds() + 1;
+
+	while (1) {
+		double now = now_seconds();
+		long timeout = -1;
+
+		if (print_counters && now >= next_line) {
+			while (now >= next_line) {
+				print_line();
+				next_line += 1;
+			}
+			if (fflush(stdout))
+				return perror("writing counters"), -1;
+		}
+
+		if (flush_at) {
+			if (now < flush_at) {
+				if (zmq_poll(&item, 1, 0) < 0) {
+					if (errno == EINTR) continue;
+					return perror("zmq_poll"), -1;
+				}
+				if (item.revents & ZMQ_POLLIN)
+					return 0;
+			}
+			flush_at = 0;
+			if (fflush(stdout))
+				return perror("writing telemetry"), -1;
+		}
+
+		if (print_counters)
+			timeout = (long)((next_line - now) * 1000) + 1;
+		if (zmq_poll(&item, 1, timeout) < 0) {
+			if (errno == EINTR) continue;
+			return perror("zmq_poll"), -1;
+		}
+		if (item.revents & ZMQ_POLLIN)
+			return 0;
+	}
+}
+
 int main(int argc, char **argv) {
 	char zmq_endpoint[256];
 	char *broker_hostname;
 	char *client_filter = "";
 	void *zmq_context;
 	void *broker_sock;
-	
+	long flush_msecs = DEFAULT_FLUSH_MSECS;
+
 	if (argc<2) {
-		fprintf(stderr, "marquise_telemetry <broker hostname> [client filter]\n");
+		fprintf(stderr, "%s [-c] [-B] <broker hostname> [client filter]\n\n"
+				"\t\t-c\tprint bursts, points, acks and ack latency,"
+				" deferred and\n\t\t\ttimed out points and unacked"
+				" bursts every second,\n\t\t\tlike marquise_throughput.py\n"
+				"\t\t-E secs\twith -c, give up on bursts that haven't"
+				" been acked\n\t\t\tafter this long (default %d, 0 never)\n"
+				"\t\t-B\twrite binary records rather than text."
+				" see telemetry.h\n"
+				"\t\t-F msecs\tflush output at least this often"
+				" (default %d)\n"
+				, argv[0], DEFAULT_EXPIRE_SECONDS, DEFAULT_FLUSH_MSECS);
+		return EXIT_FAILURE;
+	}
+
+	argv++; argc--;
+	while (argc > 1) {
+		if (strncmp("-c", *argv, 3) == 0)
+			print_counters = 1;
+		else if (strncmp("-B", *argv, 3) == 0)
+			binary_records = 1;
+		else if (strncmp("-E", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			expire_seconds = atof(*argv);
+		}
+		else if (strncmp("-F", *argv, 3) == 0 && argc > 2) {
+			argv++; argc--;
+			flush_msecs = atol(*argv);
+		}
+		else break;
+		argv++; argc--;
+	}
+	broker_hostname = argv[0];
+	if (argc > 1)
+		client_filter = argv[1];
+
+	if (print_counters && binary_records) {
+		fprintf(stderr, "-c and -B can't be used together\n");
 		return EXIT_FAILURE;
 	}
-	broker_hostname = argv[1];
-	if (argc > 2) 
-		client_filter = argv[2];
 
-	/* Make sure stdout is linebuffered */
-	setvbuf(stdout, NULL, _IOLBF, 0);
+	/* Flushed in batches, see wait_for_messages() */
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+	intern_init(&kind_names, TELEMETRY_MAX_KINDS);
+	intern_init(&idents, UINT16_MAX);
+	intern_init(&relaying_hosts, 0);
+	outstanding_init(&outstanding);
+	if (binary_records)
+		fwrite(TELEMETRY_MAGIC, 8, 1, stdout);
 
 	snprintf(zmq_endpoint, 256, "tcp://%s:5582/", broker_hostname);
 	zmq_endpoint[255] = 0;
 
 	/* Connect to broker and subscribe */
 	zmq_context = zmq_ctx_new();
-	if (zmq_context == NULL) 
+	if (zmq_context == NULL)
 		return perror("zmq_ctx_new"), EXIT_FAILURE;
 	broker_sock = zmq_socket(zmq_context, ZMQ_SUB);
-	if (broker_sock == NULL) 
+	if (broker_sock == NULL)
 		return perror("zmq_socket"), EXIT_FAILURE;
-	if (zmq_connect(broker_sock, zmq_endpoint)) 
+	if (zmq_connect(broker_sock, zmq_endpoint))
 		return perror("zmq_connect"), EXIT_FAILURE;
 	if (zmq_setsockopt(broker_sock, ZMQ_SUBSCRIBE, client_filter, 0))
 		return perror("zmq_subscribe"), EXIT_FAILURE;
@@ -43,6 +434,11 @@ int main(int argc, char **argv) {
 	/* Watch a while. Watch FOREVER */
 	int ret = 0;
 	while (1) {
+		if (wait_for_messages(broker_sock) < 0) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+
 		zmq_msg_t msg;
 		zmq_msg_init(&msg);
 
@@ -55,10 +451,10 @@ int main(int argc, char **argv) {
 			ret = EXIT_FAILURE;
 			break;
 		}
-		fwrite(zmq_msg_data(&msg), zmq_msg_size(&msg), 1,stdout);
-		fputc('\n', stdout);
-		fflush(stdout);
+		handle_message(zmq_msg_data(&msg), zmq_msg_size(&msg));
 		zmq_msg_close(&msg);
+		if (flush_at == 0 && !print_counters)
+			flush_at = now_seconds() + flush_msecs / 1e3;
 	}
 	zmq_close(broker_sock);
 	zmq_ctx_term(zmq_context);
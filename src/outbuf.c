@@ -0,0 +1,427 @@
+/*
+ * outbuf - a growable output buffer, and fast number formatting into it
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+#include "d2s_tables.h"
+
+void outbuf_init(struct outbuf *ob, size_t size) {
+	ob->len = 0;
+	ob->size = 0;
+	ob->buf = NULL;
+	outbuf_grow(ob, size);
+}
+
+void outbuf_free(struct outbuf *ob) {
+	free(ob->buf);
+	ob->buf = NULL;
+	ob->len = ob->size = 0;
+}
+
+void outbuf_grow(struct outbuf *ob, size_t n) {
+	size_t size = ob->size ? ob->size : 4096;
+	char *buf;
+
+	while (size - ob->len < n)
+		size *= 2;
+	buf = realloc(ob->buf, size);
+	if (buf == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+	ob->buf = buf;
+	ob->size = size;
+}
+
+int outbuf_flush(struct outbuf *ob, int fd) {
+	char *p = ob->buf;
+
+	while (ob->len) {
+		ssize_t n = write(fd, p, ob->len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		ob->len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Integers
+ */
+
+static const char digit_pairs[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static int decimal_length(uint64_t v) {
+	int n = 1;
+
+	for (;;) {
+		if (v < 10) return n;
+		if (v < 100) return n + 1;
+		if (v < 1000) return n + 2;
+		if (v < 10000) return n + 3;
+		v /= 10000;
+		n += 4;
+	}
+}
+
+/* Write v's digits ending just before end, two at a time */
+static void write_digits(char *end, uint64_t v) {
+	while (v >= 100) {
+		memcpy(end -= 2, digit_pairs + (v % 100) * 2, 2);
+		v /= 100;
+	}
+	if (v >= 10)
+		memcpy(end - 2, digit_pairs + v * 2, 2);
+	else
+		end[-1] = '0' + v;
+}
+
+void outbuf_u64(struct outbuf *ob, uint64_t v) {
+	int len = decimal_length(v);
+
+	write_digits(outbuf_reserve(ob, len) + len, v);
+	ob->len += len;
+}
+
+/*
+ * %f
+ *
+ * A finite double is m * 2^e exactly, so %f's six decimal places are
+ * m * 10^6 * 2^e rounded to an integer, half to even. For everything
+ * but huge numbers that fits in 128 bits.
+ */
+
+#define FIXED_DIGITS	6	/* written as three digit pairs */
+#define FIXED_SCALE	1000000
+
+void outbuf_double_fixed(struct outbuf *ob, double v) {
+	uint64_t bits, m, whole, frac;
+	unsigned __int128 scaled;
+	int e, len;
+	char *p;
+
+	memcpy(&bits, &v, sizeof(bits));
+	e = (bits >> 52) & 0x7ff;
+	m = bits & ((1ULL << 52) - 1);
+
+	if (e == 0x7ff)
+		goto fallback;
+	if (e == 0) {
+		e = 1 - 1075;
+	} else {
+		m |= 1ULL << 52;
+		e -= 1075;
+	}
+
+	if (e >= 0) {
+		if (e > 10)	/* m << e could be more than 64 bits */
+			goto fallback;
+		scaled = (unsigned __int128)(m << e) * FIXED_SCALE;
+	} else if (-e >= 128) {
+		scaled = 0;	/* way under half of the last place */
+	} else {
+		unsigned __int128 product = (unsigned __int128)m * FIXED_SCALE;
+		unsigned __int128 rest, half;
+
+		scaled = product >> -e;
+		rest = product & (((unsigned __int128)1 << -e) - 1);
+		half = (unsigned __int128)1 << (-e - 1);
+		if (rest > half || (rest == half && (scaled & 1)))
+			scaled++;
+	}
+
+	if (scaled >> 64)
+		goto fallback;
+	whole = (uint64_t)scaled / FIXED_SCALE;
+	frac = (uint64_t)scaled % FIXED_SCALE;
+
+	len = decimal_length(whole);
+	p = outbuf_reserve(ob, 1 + len + 1 + FIXED_DIGITS);
+	if (bits >> 63)
+		*(p++) = '-';
+	write_digits(p + len, whole);
+	p += len;
+	*(p++) = '.';
+	memcpy(p, digit_pairs + (frac / 10000) * 2, 2);
+	memcpy(p + 2, digit_pairs + (frac / 100 % 100) * 2, 2);
+	memcpy(p + 4, digit_pairs + (frac % 100) * 2, 2);
+	p += FIXED_DIGITS;
+	ob->len = p - ob->buf;
+	return;
+
+fallback:
+	p = outbuf_reserve(ob, OUTBUF_NUMBER_MAX);
+	ob->len += snprintf(p, OUTBUF_NUMBER_MAX, "%f", v);
+}
+
+/*
+ * Shortest round trip, after Ulf Adams' Ryu
+ * (https://github.com/ulfjack/ryu, Apache 2.0 / Boost)
+ *
+ * Works out the interval of decimals that would read back as v, then
+ * takes digits off the end of both ends and v itself until they meet.
+ */
+
+#define DOUBLE_MANTISSA_BITS	52
+#define DOUBLE_BIAS		1023
+
+static inline uint32_t log10_pow2(int32_t e) {
+	return ((uint32_t)e * 78913) >> 18;
+}
+
+static inline uint32_t log10_pow5(int32_t e) {
+	return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline int32_t pow5_bits(int32_t e) {
+	return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static inline int multiple_of_pow5(uint64_t v, uint32_t p) {
+	uint32_t count = 0;
+
+	while (v % 5 == 0) {
+		v /= 5;
+		count++;
+	}
+	return count >= p;
+}
+
+static inline int multiple_of_pow2(uint64_t v, uint32_t p) {
+	return (v & ((1ULL << p) - 1)) == 0;
+}
+
+static inline uint64_t mul_shift(uint64_t m, const uint64_t *mul, int32_t j) {
+	unsigned __int128 b0 = (unsigned __int128)m * mul[0];
+	unsigned __int128 b2 = (unsigned __int128)m * mul[1];
+
+	return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+}
+
+/* v = output * 10^exponent, output as short as it can be */
+struct decimal {
+	uint64_t output;
+	int32_t exponent;
+};
+
+/* Integers up to 2^53 are just themselves */
+static int small_int(uint64_t mantissa, uint32_t exponent, struct decimal *d) {
+	uint64_t m2 = (1ULL << DOUBLE_MANTISSA_BITS) | mantissa;
+	int32_t e2 = (int32_t)exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS;
+
+	if (e2 > 0 || e2 < -52)
+		return 0;
+	if (m2 & ((1ULL << -e2) - 1))
+		return 0;
+
+	d->output = m2 >> -e2;
+	d->exponent = 0;
+	while (d->output % 10 == 0) {
+		d->output /= 10;
+		d->exponent++;
+	}
+	return 1;
+}
+
+static struct decimal shortest(uint64_t mantissa, uint32_t exponent) {
+	int32_t e2, e10, removed = 0;
+	uint64_t m2, mv, vr, vp, vm, output;
+	int even, mm_shift, vm_zeros = 0, vr_zeros = 0;
+	uint8_t last_removed = 0;
+	struct decimal d;
+
+	if (exponent == 0) {
+		e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = mantissa;
+	} else {
+		e2 = (int32_t)exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = (1ULL << DOUBLE_MANTISSA_BITS) | mantissa;
+	}
+	even = (m2 & 1) == 0;
+	mv = 4 * m2;
+	mm_shift = mantissa != 0 || exponent <= 1;
+
+	/* vr, vp and vm are v and either end of its interval, scaled by
+	 * 10^-e10
+	 */
+	if (e2 >= 0) {
+		uint32_t q = log10_pow2(e2) - (e2 > 3);
+		int32_t k = DOUBLE_POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+		int32_t i = -e2 + (int32_t)q + k;
+
+		e10 = q;
+		vr = mul_shift(4 * m2, DOUBLE_POW5_INV_SPLIT[q], i);
+		vp = mul_shift(4 * m2 + 2, DOUBLE_POW5_INV_SPLIT[q], i);
+		vm = mul_shift(4 * m2 - 1 - mm_shift, DOUBLE_POW5_INV_SPLIT[q], i);
+		if (q <= 21) {
+			if (mv % 5 == 0)
+				vr_zeros = multiple_of_pow5(mv, q);
+			else if (even)
+				vm_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				vp -= multiple_of_pow5(mv + 2, q);
+		}
+	} else {
+		uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+		int32_t i = -e2 - (int32_t)q;
+		int32_t k = pow5_bits(i) - DOUBLE_POW5_BITCOUNT;
+		int32_t j = (int32_t)q - k;
+
+		e10 = (int32_t)q + e2;
+		vr = mul_shift(4 * m2, DOUBLE_POW5_SPLIT[i], j);
+		vp = mul_shift(4 * m2 + 2, DOUBLE_POW5_SPLIT[i], j);
+		vm = mul_shift(4 * m2 - 1 - mm_shift, DOUBLE_POW5_SPLIT[i], j);
+		if (q <= 1) {
+			vr_zeros = 1;
+			if (even)
+				vm_zeros = mm_shift == 1;
+			else
+				vp--;
+		} else if (q < 63) {
+			vr_zeros = multiple_of_pow2(mv, q);
+		}
+	}
+
+	if (vm_zeros || vr_zeros) {
+		/* Rare, and has to keep track of the digits it drops */
+		while (vp / 10 > vm / 10) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last_removed == 0;
+			last_removed = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if (vm_zeros) {
+			while (vm % 10 == 0) {
+				vr_zeros &= last_removed == 0;
+				last_removed = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		}
+		/* Exactly half way, round to even */
+		if (vr_zeros && last_removed == 5 && vr % 2 == 0)
+			last_removed = 4;
+		output = vr + ((vr == vm && (!even || !vm_zeros)) || last_removed >= 5);
+	} else {
+		int round_up = 0;
+
+		if (vp / 100 > vm / 100) {
+			round_up = vr % 100 >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+			removed += 2;
+		}
+		while (vp / 10 > vm / 10) {
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+
+	d.output = output;
+	d.exponent = e10 + removed;
+	return d;
+}
+
+void outbuf_double_shortest(struct outbuf *ob, double v) {
+	uint64_t bits, mantissa;
+	uint32_t exponent;
+	struct decimal d;
+	int olen, point;
+	char *start, *p;
+
+	memcpy(&bits, &v, sizeof(bits));
+	mantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+	exponent = (bits >> DOUBLE_MANTISSA_BITS) & 0x7ff;
+
+	if (exponent == 0x7ff) {
+		p = outbuf_reserve(ob, OUTBUF_NUMBER_MAX);
+		ob->len += snprintf(p, OUTBUF_NUMBER_MAX, "%f", v);
+		return;
+	}
+
+	start = p = outbuf_reserve(ob, OUTBUF_NUMBER_MAX);
+	if (bits >> 63)
+		*(p++) = '-';
+
+	if (exponent == 0 && mantissa == 0) {
+		*(p++) = '0';
+		ob->len += p - start;
+		return;
+	}
+
+	if (!small_int(mantissa, exponent, &d))
+		d = shortest(mantissa, exponent);
+
+	/* v is 0.digits * 10^point */
+	olen = decimal_length(d.output);
+	point = olen + d.exponent;
+
+	if (olen <= point && point <= 21) {
+		/* integer */
+		write_digits(p + olen, d.output);
+		p += olen;
+		memset(p, '0', point - olen);
+		p += point - olen;
+	} else if (0 < point && point <= 21) {
+		/* digits either side of the point */
+		write_digits(p + olen + 1, d.output);
+		memmove(p, p + 1, point);
+		p[point] = '.';
+		p += olen + 1;
+	} else if (-6 < point && point <= 0) {
+		/* 0.000digits */
+		*(p++) = '0';
+		*(p++) = '.';
+		memset(p, '0', -point);
+		p += -point;
+		write_digits(p + olen, d.output);
+		p += olen;
+	} else {
+		/* d.igitse+x */
+		int e = point - 1;
+
+		write_digits(p + olen + 1, d.output);
+		p[0] = p[1];
+		if (olen > 1) {
+			p[1] = '.';
+			p += olen + 1;
+		} else {
+			p++;
+		}
+		*(p++) = 'e';
+		*(p++) = e < 0 ? '-' : '+';
+		if (e < 0)
+			e = -e;
+		olen = decimal_length(e);
+		write_digits(p + olen, e);
+		p += olen;
+	}
+	ob->len += p - start;
+}
@@ -0,0 +1,70 @@
+/*
+ * outbuf - a growable output buffer, and fast number formatting into it
+ *
+ * Everything appends to the end of the buffer, growing it if need be.
+ * Running out of memory is fatal.
+ */
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct outbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/* Big enough for any number we format */
+#define OUTBUF_NUMBER_MAX	400
+
+void outbuf_init(struct outbuf *ob, size_t size);
+void outbuf_free(struct outbuf *ob);
+
+/* Make room for at least n more bytes, for outbuf_reserve() */
+void outbuf_grow(struct outbuf *ob, size_t n);
+
+/* Somewhere to write n bytes, which the caller then adds to ob->len */
+static inline char *outbuf_reserve(struct outbuf *ob, size_t n) {
+	if (ob->size - ob->len < n)
+		outbuf_grow(ob, n);
+	return ob->buf + ob->len;
+}
+
+static inline void outbuf_put(struct outbuf *ob, const void *data, size_t len) {
+	memcpy(outbuf_reserve(ob, len), data, len);
+	ob->len += len;
+}
+
+static inline void outbuf_putc(struct outbuf *ob, char c) {
+	*outbuf_reserve(ob, 1) = c;
+	ob->len++;
+}
+
+static inline void outbuf_puts(struct outbuf *ob, const char *s) {
+	outbuf_put(ob, s, strlen(s));
+}
+
+/* printf("%lu") */
+void outbuf_u64(struct outbuf *ob, uint64_t v);
+
+/* printf("%f"), exactly. Falls back to snprintf() for the odd number
+ * too big to do quickly
+ */
+void outbuf_double_fixed(struct outbuf *ob, double v);
+
+/* The fewest digits that read back as exactly v, found the way Ryu
+ * does. Laid out like JavaScript's Number toString(): plain decimal
+ * from 1e-7 up to 1e21, exponent notation outside that
+ */
+void outbuf_double_shortest(struct outbuf *ob, double v);
+
+/* Write the whole buffer to fd and empty it
+ *
+ * returns -1 on failure
+ */
+int outbuf_flush(struct outbuf *ob, int fd);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * outstanding - unacked bursts. See outstanding.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "intern.h"
+#include "outstanding.h"
+
+#define SLOT(hash, i)		((uint64_t)(uint32_t)(hash) << 32 | ((i) + 1))
+#define SLOT_ENTRY(slot)	((uint32_t)(slot) - 1)
+#define SLOT_HOME(o, slot)	(((slot) >> 32) & ((o)->n_slots - 1))
+
+static void *alloc_or_die(void *p) {
+	if (p == NULL) {
+		perror("outstanding");
+		exit(1);
+	}
+	return p;
+}
+
+void outstanding_init(struct outstanding *o) {
+	memset(o, 0, sizeof(*o));
+	o->n_slots = 1024;
+	o->slots = alloc_or_die(calloc(o->n_slots, sizeof(*o->slots)));
+	o->max_entries = o->n_slots / 2;
+	o->entries = alloc_or_die(malloc(o->max_entries * sizeof(*o->entries)));
+	o->free = o->oldest = o->newest = OUTSTANDING_NONE;
+}
+
+void outstanding_free(struct outstanding *o) {
+	free(o->slots);
+	free(o->entries);
+	o->slots = NULL;
+	o->entries = NULL;
+}
+
+/* The key is the identity's length, the identity and then the message
+ * id, so no two different pairs end up the same
+ *
+ * returns the key's length, or 0 if it's too long to keep
+ */
+static size_t make_key(uint8_t *key, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len) {
+	size_t len = 1 + ident_len + msg_id_len;
+
+	if (len > OUTSTANDING_KEY_MAX)
+		return 0;
+	key[0] = ident_len;
+	memcpy(key + 1, ident, ident_len);
+	memcpy(key + 1 + ident_len, msg_id, msg_id_len);
+	return len;
+}
+
+/* Find key's slot, or the empty one it would go in */
+static size_t find_slot(const struct outstanding *o, const uint8_t *key, size_t len, uint64_t hash) {
+	size_t mask = o->n_slots - 1;
+	size_t i;
+
+	for (i = hash & mask; o->slots[i]; i = (i + 1) & mask) {
+		const struct outstanding_burst *b;
+
+		if ((uint32_t)(o->slots[i] >> 32) != (uint32_t)hash)
+			continue;
+		b = &o->entries[SLOT_ENTRY(o->slots[i])];
+		if (b->key_len == len && memcmp(b->key, key, len) == 0)
+			break;
+	}
+	return i;
+}
+
+static void grow_slots(struct outstanding *o) {
+	uint64_t *old = o->slots;
+	size_t i, j, n_old = o->n_slots;
+
+	o->n_slots *= 2;
+	o->slots = alloc_or_die(calloc(o->n_slots, sizeof(*o->slots)));
+	for (i = 0; i < n_old; i++) {
+		if (!old[i])
+			continue;
+		for (j = SLOT_HOME(o, old[i]); o->slots[j]; j = (j + 1) & (o->n_slots - 1))
+			;
+		o->slots[j] = old[i];
+	}
+	free(old);
+}
+
+/* Empty slot i, shifting back whatever comes after it that would no
+ * longer be found
+ */
+static void remove_slot(struct outstanding *o, size_t hole) {
+	size_t mask = o->n_slots - 1;
+	size_t i;
+
+	o->slots[hole] = 0;
+	for (i = (hole + 1) & mask; o->slots[i]; i = (i + 1) & mask) {
+		size_t home = SLOT_HOME(o, o->slots[i]);
+
+		/* Leave it be if its home is after the hole */
+		if (((i - home) & mask) < ((i - hole) & mask))
+			continue;
+		o->slots[hole] = o->slots[i];
+		o->slots[i] = 0;
+		hole = i;
+	}
+}
+
+static void unlink_entry(struct outstanding *o, uint32_t e) {
+	struct outstanding_burst *b = &o->entries[e];
+
+	if (b->older == OUTSTANDING_NONE)
+		o->oldest = b->newer;
+	else
+		o->entries[b->older].newer = b->newer;
+	if (b->newer == OUTSTANDING_NONE)
+		o->newest = b->older;
+	else
+		o->entries[b->newer].older = b->older;
+}
+
+static void link_newest(struct outstanding *o, uint32_t e) {
+	struct outstanding_burst *b = &o->entries[e];
+
+	b->older = o->newest;
+	b->newer = OUTSTANDING_NONE;
+	if (o->newest == OUTSTANDING_NONE)
+		o->oldest = e;
+	else
+		o->entries[o->newest].newer = e;
+	o->newest = e;
+}
+
+static uint32_t new_entry(struct outstanding *o) {
+	uint32_t e;
+
+	if (o->free != OUTSTANDING_NONE) {
+		e = o->free;
+		o->free = o->entries[e].newer;
+		return e;
+	}
+	if (o->n_entries == o->max_entries) {
+		o->max_entries *= 2;
+		o->entries = alloc_or_die(realloc(o->entries, o->max_entries * sizeof(*o->entries)));
+	}
+	return o->n_entries++;
+}
+
+/* Take entry e, in slot i, out of everything */
+static void drop_entry(struct outstanding *o, size_t i, uint32_t e) {
+	remove_slot(o, i);
+	unlink_entry(o, e);
+	o->entries[e].newer = o->free;
+	o->free = e;
+	o->count--;
+	o->points -= o->entries[e].points;
+}
+
+int outstanding_add(struct outstanding *o, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len, uint32_t points, double now) {
+	uint8_t key[OUTSTANDING_KEY_MAX];
+	struct outstanding_burst *b;
+	uint64_t hash;
+	size_t len, i;
+	uint32_t e;
+
+	len = make_key(key, ident, ident_len, msg_id, msg_id_len);
+	if (len == 0)
+		return -1;
+	if ((o->count + 1) * 2 > o->n_slots)
+		grow_slots(o);
+
+	hash = intern_hash(key, len);
+	i = find_slot(o, key, len, hash);
+	if (o->slots[i]) {
+		/* Sent again, so it starts over as the newest */
+		e = SLOT_ENTRY(o->slots[i]);
+		unlink_entry(o, e);
+		o->points -= o->entries[e].points;
+	} else {
+		e = new_entry(o);
+		o->slots[i] = SLOT(hash, e);
+		o->count++;
+		b = &o->entries[e];
+		b->hash = hash;
+		b->key_len = len;
+		memcpy(b->key, key, len);
+	}
+	b = &o->entries[e];
+	b->received = now;
+	b->points = points;
+	o->points += points;
+	link_newest(o, e);
+	return 0;
+}
+
+int outstanding_ack(struct outstanding *o, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len, double *received, uint32_t *points) {
+	uint8_t key[OUTSTANDING_KEY_MAX];
+	size_t len, i;
+	uint32_t e;
+
+	len = make_key(key, ident, ident_len, msg_id, msg_id_len);
+	if (len == 0)
+		return 0;
+	i = find_slot(o, key, len, intern_hash(key, len));
+	if (!o->slots[i])
+		return 0;
+
+	e = SLOT_ENTRY(o->slots[i]);
+	*received = o->entries[e].received;
+	*points = o->entries[e].points;
+	drop_entry(o, i, e);
+	return 1;
+}
+
+int outstanding_get(const struct outstanding *o, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len, double *received, uint32_t *points) {
+	uint8_t key[OUTSTANDING_KEY_MAX];
+	size_t len, i;
+	uint32_t e;
+
+	len = make_key(key, ident, ident_len, msg_id, msg_id_len);
+	if (len == 0)
+		return 0;
+	i = find_slot(o, key, len, intern_hash(key, len));
+	if (!o->slots[i])
+		return 0;
+
+	e = SLOT_ENTRY(o->slots[i]);
+	*received = o->entries[e].received;
+	*points = o->entries[e].points;
+	return 1;
+}
+
+uint64_t outstanding_expire(struct outstanding *o, double before) {
+	uint64_t n = 0;
+
+	while (o->oldest != OUTSTANDING_NONE && o->entries[o->oldest].received < before) {
+		uint32_t e = o->oldest;
+		struct outstanding_burst *b = &o->entries[e];
+
+		o->expired++;
+		o->expired_points += b->points;
+		drop_entry(o, find_slot(o, b->key, b->key_len, b->hash), e);
+		n++;
+	}
+	return n;
+}
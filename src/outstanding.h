@@ -0,0 +1,89 @@
+/*
+ * outstanding - bursts that haven't been acked yet, by identity and
+ * message id
+ *
+ * Bursts live in one array of 64 byte entries, found through a flat
+ * open addressing table of 8 byte slots (low 32 bits of the hash, and
+ * where the entry is), so millions of them fit when ingestd stalls and
+ * a lookup rarely touches more than one entry.
+ *
+ * Every burst gets the same time to be acked in, so they expire in the
+ * order they arrived: entries are also on a list from oldest to newest,
+ * and expiring is taking them off the old end until one's young enough.
+ * That's the one level timer wheel that a single timeout needs, and
+ * adding, acking and expiring a burst are all O(1).
+ *
+ * How many bursts and points are outstanding, and how many have expired,
+ * are kept as we go. Not thread safe.
+ */
+#ifndef OUTSTANDING_H
+#define OUTSTANDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest identity and message id, together, we'll keep track of.
+ * Bursts with longer ones are never matched to an ack
+ */
+#define OUTSTANDING_KEY_MAX	31
+
+/* The end of a list */
+#define OUTSTANDING_NONE	UINT32_MAX
+
+struct outstanding_burst {
+	uint64_t hash;
+	double received;
+	uint32_t points;
+	uint32_t older;		/* arrival order, or the free list in newer */
+	uint32_t newer;
+	uint8_t key_len;
+	uint8_t key[OUTSTANDING_KEY_MAX];
+};
+
+struct outstanding {
+	uint64_t *slots;	/* hash << 32 | entry + 1, 0 when empty */
+	size_t n_slots;		/* a power of 2, at least twice count */
+
+	struct outstanding_burst *entries;
+	uint32_t n_entries;	/* in use or on the free list */
+	uint32_t max_entries;	/* allocated */
+	uint32_t free;
+	uint32_t oldest;
+	uint32_t newest;
+
+	uint64_t count;
+	uint64_t points;
+	uint64_t expired;
+	uint64_t expired_points;
+};
+
+void outstanding_init(struct outstanding *o);
+void outstanding_free(struct outstanding *o);
+
+/* A burst of points frames from ident with msg_id turned up. One that's
+ * already outstanding starts over
+ *
+ * returns -1 if the key is too long to keep
+ */
+int outstanding_add(struct outstanding *o, const void *ident, size_t ident_len,
+	const void *msg_id, size_t msg_id_len, uint32_t points, double now);
+
+/* ident acked msg_id. Fills in when it was received and how many points
+ * it had
+ *
+ * returns 0 if it isn't outstanding
+ */
+int outstanding_ack(struct outstanding *o, const void *ident, size_t ident_len,
+	const void *msg_id, size_t msg_id_len, double *received, uint32_t *points);
+
+/* Like outstanding_ack(), but the burst stays outstanding */
+int outstanding_get(const struct outstanding *o, const void *ident, size_t ident_len,
+	const void *msg_id, size_t msg_id_len, double *received, uint32_t *points);
+
+/* Give up on everything received before before
+ *
+ * returns how many bursts that was
+ */
+uint64_t outstanding_expire(struct outstanding *o, double before);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define bail_if( assertion, message ) do { \
+        if ( assertion ) {                 \
+                perror( message );         \
+                exit( 1 );                 \
+        }                                  \
+} while( 0 )
+
+/* Where rados_bench's appends and reads go: RADOS, or a stand-in for it.
+ *
+ * Operations are asynchronous. Each is started with an op from new_op()
+ * (one per queue slot, used over and over) and finishes by calling
+ * op_done() for its slot, from whatever thread, with the bytes read or a
+ * negative errno. release() is called on the op once op_done() has been,
+ * before the op is used again.
+ *
+ * Only rados_bench's main thread calls connect(), open_ioctx() and the
+ * rest outside the ops. Each worker thread starts ops on its own ioctx.
+ */
+struct aio_slot;
+
+void op_done(struct aio_slot *slot, int ret);
+
+struct backend {
+        const char *name;
+        void (*connect)(void);
+        void (*shutdown)(void);
+        void *(*open_ioctx)(void);
+        void (*close_ioctx)(void *io);
+        void (*remove)(void *io, const char *oid);
+
+        void *(*new_op)(void);
+        void (*free_op)(void *op);
+        void (*release)(void *op);
+
+        void (*append)(void *io, void *op, struct aio_slot *slot, const char *oid,
+                const char *buf, size_t len);
+        /* Several appends of buf, one after the other, as one op */
+        void (*appends)(void *io, void *op, struct aio_slot *slot, const char *oid,
+                const char *buf, const int *lens, int n);
+        void (*read)(void *io, void *op, struct aio_slot *slot, const char *oid,
+                char *buf, size_t len, uint64_t off);
+};
+
+/* librados */
+extern const struct backend rados_backend;
+
+/* Objects in memory or in files in RADOS_DIR, which finish
+ * RADOS_LATENCY_US after they're started (see local_backend.c)
+ */
+extern const struct backend memory_backend;
+extern const struct backend file_backend;
+
+#endif
@@ -0,0 +1,390 @@
+/* Stand-ins for RADOS, so rados_bench runs anywhere
+ *
+ * Objects are kept in memory, or in files named by their OID in
+ * RADOS_DIR. Appends and reads happen straight away, in the order
+ * they're started, but don't finish until RADOS_LATENCY_US
+ * microseconds later ("base,jitter" adds up to jitter more, at random),
+ * when a thread of our own calls op_done() the way librados' callbacks
+ * would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "backend.h"
+
+#define OBJECT_BUCKETS 4096
+
+struct object {
+        char *oid;
+        pthread_mutex_t lock;
+        int fd;                 /* files */
+        char *data;             /* memory */
+        size_t size;
+        size_t max_size;
+        struct object *next;
+};
+
+static struct object *objects[OBJECT_BUCKETS];
+static pthread_mutex_t objects_lock = PTHREAD_MUTEX_INITIALIZER;
+static int use_files;
+static char *dir;
+
+/* Ops waiting to finish, a heap ordered by when they're due */
+struct pending {
+        double due;
+        struct aio_slot *slot;
+        int ret;
+};
+
+static struct pending *pending;
+static int num_pending;
+static int max_pending;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t finisher;
+static int stopping;
+static int latency_us;
+static int jitter_us;
+static unsigned int seed = 1;
+
+static double now_realtime() {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* The heap's on the realtime clock, so it can be waited on */
+static void *finish_ops(void *arg) {
+        pthread_mutex_lock(&pending_lock);
+        while (1) {
+                struct pending p;
+                int i, child;
+                if (num_pending == 0) {
+                        if (stopping) {
+                                break;
+                        }
+                        pthread_cond_wait(&pending_cond, &pending_lock);
+                        continue;
+                }
+                if (pending[0].due > now_realtime()) {
+                        struct timespec until;
+                        until.tv_sec = pending[0].due;
+                        until.tv_nsec = (pending[0].due - until.tv_sec) * 1e9;
+                        pthread_cond_timedwait(&pending_cond, &pending_lock, &until);
+                        continue;
+                }
+
+                p = pending[0];
+                pending[0] = pending[--num_pending];
+                for (i = 0; (child = 2 * i + 1) < num_pending; i = child) {
+                        if (child + 1 < num_pending && pending[child + 1].due < pending[child].due) {
+                                child++;
+                        }
+                        if (pending[i].due <= pending[child].due) {
+                                break;
+                        }
+                        struct pending tmp = pending[i];
+                        pending[i] = pending[child];
+                        pending[child] = tmp;
+                }
+                pthread_mutex_unlock(&pending_lock);
+                op_done(p.slot, p.ret);
+                pthread_mutex_lock(&pending_lock);
+        }
+        pthread_mutex_unlock(&pending_lock);
+        return NULL;
+}
+
+static void finish_later(struct aio_slot *slot, int ret) {
+        int i;
+        pthread_mutex_lock(&pending_lock);
+        if (num_pending == max_pending) {
+                max_pending = max_pending ? max_pending * 2 : 1024;
+                pending = realloc(pending, max_pending * sizeof(*pending));
+                bail_if(!pending, "realloc");
+        }
+        i = num_pending++;
+        pending[i].due = now_realtime() + (latency_us + (jitter_us ? rand_r(&seed) % (jitter_us + 1) : 0)) / 1e6;
+        pending[i].slot = slot;
+        pending[i].ret = ret;
+        for (; i > 0 && pending[(i - 1) / 2].due > pending[i].due; i = (i - 1) / 2) {
+                struct pending tmp = pending[i];
+                pending[i] = pending[(i - 1) / 2];
+                pending[(i - 1) / 2] = tmp;
+        }
+        pthread_cond_signal(&pending_cond);
+        pthread_mutex_unlock(&pending_lock);
+}
+
+static unsigned int oid_hash(const char *oid) {
+        unsigned int h = 2166136261u;
+        for (; *oid; oid++) {
+                h = (h ^ (unsigned char)*oid) * 16777619;
+        }
+        return h % OBJECT_BUCKETS;
+}
+
+/* The object called oid, locked. If it isn't there yet it's made if
+ * create is set, and otherwise it's NULL, like librados' -ENOENT
+ */
+static struct object *lock_object(const char *oid, int create) {
+        struct object **o;
+        pthread_mutex_lock(&objects_lock);
+        for (o = &objects[oid_hash(oid)]; *o; o = &(*o)->next) {
+                if (strcmp((*o)->oid, oid) == 0) {
+                        break;
+                }
+        }
+        if (!*o) {
+                int fd = -1;
+                if (use_files) {
+                        char path[4096];
+                        snprintf(path, sizeof(path), "%s/%s", dir, oid);
+                        fd = open(path, O_RDWR | O_APPEND | (create ? O_CREAT : 0), 0644);
+                        bail_if(fd < 0 && (create || errno != ENOENT), path);
+                }
+                if (!create && fd < 0) {
+                        pthread_mutex_unlock(&objects_lock);
+                        return NULL;
+                }
+                *o = calloc(1, sizeof(**o));
+                bail_if(!*o, "calloc");
+                (*o)->oid = strdup(oid);
+                bail_if(!(*o)->oid, "strdup");
+                (*o)->fd = fd;
+                pthread_mutex_init(&(*o)->lock, NULL);
+                if (use_files) {
+                        (*o)->size = lseek(fd, 0, SEEK_END);
+                }
+        }
+        pthread_mutex_lock(&(*o)->lock);
+        pthread_mutex_unlock(&objects_lock);
+        return *o;
+}
+
+/* returns 0 or -errno, like librados */
+static int append_object(struct object *o, const char *buf, size_t len) {
+        if (use_files) {
+                while (len > 0) {
+                        ssize_t n = write(o->fd, buf, len);
+                        if (n < 0) {
+                                if (errno == EINTR) {
+                                        continue;
+                                }
+                                return -errno;
+                        }
+                        buf += n;
+                        len -= n;
+                        o->size += n;
+                }
+                return 0;
+        }
+        if (o->size + len > o->max_size) {
+                size_t max = o->max_size ? o->max_size : 4096;
+                char *data;
+                while (max < o->size + len) {
+                        max *= 2;
+                }
+                data = realloc(o->data, max);
+                if (!data) {
+                        return -ENOMEM;
+                }
+                o->data = data;
+                o->max_size = max;
+        }
+        memcpy(o->data + o->size, buf, len);
+        o->size += len;
+        return 0;
+}
+
+static void local_connect() {
+        char *latency = getenv("RADOS_LATENCY_US");
+        char *end;
+        if (latency) {
+                errno = 0;
+                latency_us = strtol(latency, &end, 10);
+                if (*end == ',') {
+                        jitter_us = strtol(end + 1, &end, 10);
+                }
+                bail_if(errno || *end || latency_us < 0 || jitter_us < 0,
+                        "RADOS_LATENCY_US must be microseconds, and optionally a comma and up to how many more");
+        }
+        errno = pthread_create(&finisher, NULL, finish_ops, NULL);
+        bail_if(errno, "pthread_create");
+}
+
+static void memory_connect() {
+        local_connect();
+}
+
+static void file_connect() {
+        dir = getenv("RADOS_DIR");
+        bail_if(!dir, "Must set RADOS_DIR");
+        use_files = 1;
+        local_connect();
+}
+
+static void local_shutdown() {
+        int i;
+        pthread_mutex_lock(&pending_lock);
+        stopping = 1;
+        pthread_cond_signal(&pending_cond);
+        pthread_mutex_unlock(&pending_lock);
+        pthread_join(finisher, NULL);
+        free(pending);
+
+        for (i = 0; i < OBJECT_BUCKETS; i++) {
+                while (objects[i]) {
+                        struct object *o = objects[i];
+                        objects[i] = o->next;
+                        if (o->fd >= 0) {
+                                close(o->fd);
+                        }
+                        pthread_mutex_destroy(&o->lock);
+                        free(o->data);
+                        free(o->oid);
+                        free(o);
+                }
+        }
+}
+
+/* There's nothing to an ioctx or an op here, but NULL looks like a
+ * mistake
+ */
+static void *local_open_ioctx() {
+        return objects;
+}
+
+static void local_close_ioctx(void *io) {
+}
+
+static void *local_new_op() {
+        return NULL;
+}
+
+static void local_free_op(void *op) {
+}
+
+static void local_release(void *op) {
+}
+
+static void local_remove(void *io, const char *oid) {
+        struct object **o, *gone;
+        pthread_mutex_lock(&objects_lock);
+        for (o = &objects[oid_hash(oid)]; *o; o = &(*o)->next) {
+                if (strcmp((*o)->oid, oid) == 0) {
+                        break;
+                }
+        }
+        gone = *o;
+        if (gone) {
+                *o = gone->next;
+        }
+        pthread_mutex_unlock(&objects_lock);
+        if (!gone) {
+                return;
+        }
+        if (gone->fd >= 0) {
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s", dir, oid);
+                close(gone->fd);
+                unlink(path);
+        }
+        pthread_mutex_destroy(&gone->lock);
+        free(gone->data);
+        free(gone->oid);
+        free(gone);
+}
+
+static void local_append(void *io, void *op, struct aio_slot *slot, const char *oid,
+                const char *buf, size_t len) {
+        struct object *o = lock_object(oid, 1);
+        int ret = append_object(o, buf, len);
+        pthread_mutex_unlock(&o->lock);
+        finish_later(slot, ret);
+}
+
+/* All or nothing, like a write op */
+static void local_appends(void *io, void *op, struct aio_slot *slot, const char *oid,
+                const char *buf, const int *lens, int n) {
+        struct object *o = lock_object(oid, 1);
+        size_t size = o->size;
+        int i, ret = 0;
+        for (i = 0; i < n && ret == 0; i++) {
+                ret = append_object(o, buf, lens[i]);
+        }
+        if (ret < 0) {
+                if (use_files && ftruncate(o->fd, size) == 0) {
+                        o->size = size;
+                } else if (!use_files) {
+                        o->size = size;
+                }
+        }
+        pthread_mutex_unlock(&o->lock);
+        finish_later(slot, ret);
+}
+
+/* Short at the end of the object, 0 past it, and -ENOENT if nothing's
+ * been appended to it yet
+ */
+static void local_read(void *io, void *op, struct aio_slot *slot, const char *oid,
+                char *buf, size_t len, uint64_t off) {
+        struct object *o = lock_object(oid, 0);
+        int ret = 0;
+        if (!o) {
+                finish_later(slot, -ENOENT);
+                return;
+        }
+        if (off < o->size) {
+                if (len > o->size - off) {
+                        len = o->size - off;
+                }
+                if (use_files) {
+                        ret = pread(o->fd, buf, len, off);
+                        if (ret < 0) {
+                                ret = -errno;
+                        }
+                } else {
+                        memcpy(buf, o->data + off, len);
+                        ret = len;
+                }
+        }
+        pthread_mutex_unlock(&o->lock);
+        finish_later(slot, ret);
+}
+
+const struct backend memory_backend = {
+        .name = "memory",
+        .connect = memory_connect,
+        .shutdown = local_shutdown,
+        .open_ioctx = local_open_ioctx,
+        .close_ioctx = local_close_ioctx,
+        .remove = local_remove,
+        .new_op = local_new_op,
+        .free_op = local_free_op,
+        .release = local_release,
+        .append = local_append,
+        .appends = local_appends,
+        .read = local_read,
+};
+
+const struct backend file_backend = {
+        .name = "file",
+        .connect = file_connect,
+        .shutdown = local_shutdown,
+        .open_ioctx = local_open_ioctx,
+        .close_ioctx = local_close_ioctx,
+        .remove = local_remove,
+        .new_op = local_new_op,
+        .free_op = local_free_op,
+        .release = local_release,
+        .append = local_append,
+        .appends = local_appends,
+        .read = local_read,
+};
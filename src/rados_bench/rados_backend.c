@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rados/librados.h>
+
+#include "backend.h"
+
+/* A slot's op: its completion, and the write op if it's a batch */
+struct rados_op {
+        rados_completion_t comp;
+        rados_write_op_t write_op;
+        struct aio_slot *slot;
+};
+
+static rados_t cluster;
+
+static void rados_backend_connect() {
+        int err;
+        char *user = getenv("RADOS_USER");
+        bail_if(!user, "Must set RADOS_USER");
+        err = rados_create(&cluster, user);
+        bail_if(err < 0, "rados_create");
+        err = rados_conf_read_file(cluster, "/etc/ceph/ceph.conf");
+        bail_if(err < 0, "rados_conf_read_file: ");
+        err = rados_connect(cluster);
+        bail_if(err < 0, "rados_connect: ");
+}
+
+static void rados_backend_shutdown() {
+        rados_shutdown(cluster);
+}
+
+static void *rados_backend_open_ioctx() {
+        rados_ioctx_t io;
+        int err;
+        char *pool = getenv("RADOS_POOL");
+        bail_if(!pool, "Must set RADOS_POOL");
+        err = rados_ioctx_create(cluster, pool, &io);
+        bail_if(err < 0, "rados_ioctx_create: ");
+        return io;
+}
+
+static void rados_backend_close_ioctx(void *io) {
+        rados_ioctx_destroy(io);
+}
+
+static void rados_backend_remove(void *io, const char *oid) {
+        rados_remove(io, oid);
+}
+
+static void *rados_backend_new_op() {
+        struct rados_op *op = calloc(1, sizeof(*op));
+        bail_if(!op, "calloc");
+        return op;
+}
+
+static void rados_backend_free_op(void *op) {
+        free(op);
+}
+
+static void op_complete(rados_completion_t comp, void *arg) {
+        struct rados_op *op = arg;
+        op_done(op->slot, rados_aio_get_return_value(comp));
+}
+
+/* librados completions can't be used twice, so each op gets a new one,
+ * released when the op is.
+ */
+static void start_op(struct rados_op *op, struct aio_slot *slot) {
+        int ret;
+        op->slot = slot;
+        ret = rados_aio_create_completion(op, op_complete, NULL, &op->comp);
+        bail_if(ret < 0, "rados_aio_create_completion");
+}
+
+static void rados_backend_release(void *arg) {
+        struct rados_op *op = arg;
+        rados_aio_release(op->comp);
+        if (op->write_op) {
+                rados_release_write_op(op->write_op);
+                op->write_op = NULL;
+        }
+}
+
+static void rados_backend_append(void *io, void *arg, struct aio_slot *slot, const char *oid,
+                const char *buf, size_t len) {
+        struct rados_op *op = arg;
+        int ret;
+        start_op(op, slot);
+        ret = rados_aio_append(io, oid, op->comp, buf, len);
+        bail_if(ret < 0, "rados_aio_append");
+}
+
+static void rados_backend_appends(void *io, void *arg, struct aio_slot *slot, const char *oid,
+                const char *buf, const int *lens, int n) {
+        struct rados_op *op = arg;
+        int i, ret;
+        op->write_op = rados_create_write_op();
+        bail_if(!op->write_op, "rados_create_write_op");
+        for (i = 0; i < n; i++) {
+                rados_write_op_append(op->write_op, buf, lens[i]);
+        }
+        start_op(op, slot);
+        ret = rados_aio_write_op_operate(op->write_op, io, op->comp, oid, NULL, 0);
+        bail_if(ret < 0, "rados_aio_write_op_operate");
+}
+
+static void rados_backend_read(void *io, void *arg, struct aio_slot *slot, const char *oid,
+                char *buf, size_t len, uint64_t off) {
+        struct rados_op *op = arg;
+        int ret;
+        start_op(op, slot);
+        ret = rados_aio_read(io, oid, op->comp, buf, len, off);
+        bail_if(ret < 0, "rados_aio_read");
+}
+
+const struct backend rados_backend = {
+        .name = "rados",
+        .connect = rados_backend_connect,
+        .shutdown = rados_backend_shutdown,
+        .open_ioctx = rados_backend_open_ioctx,
+        .close_ioctx = rados_backend_close_ioctx,
+        .remove = rados_backend_remove,
+        .new_op = rados_backend_new_op,
+        .free_op = rados_backend_free_op,
+        .release = rados_backend_release,
+        .append = rados_backend_append,
+        .appends = rados_backend_appends,
+        .read = rados_backend_read,
+};
@@ -1,18 +1,49 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <time.h>
-
-#include <rados/librados.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 #include "words.h"
+#include "backend.h"
+#include "../lathist.h"
+
+#define MAX_QUEUE_DEPTHS 32
+#define MAX_CPUS 1024
+
+/* Biggest append we'll make, from a capture or otherwise */
+#define MAX_WRITE_SIZE (64 << 20)
+
+#define OP_WRITE 0
+#define OP_READ 1
+#define OP_KINDS 2
+
+/* RADOS_BACKEND's */
+const struct backend *backend;
 
-#define bail_if( assertion, message ) do { \
-        if ( assertion ) {                 \
-                perror( message );         \
-                exit( 1 );                 \
-        }                                  \
-} while( 0 )
+/* RADOS_OUTPUT=csv, and RADOS_INTERVAL seconds between lines of it */
+int csv_output = 0;
+int report_interval = 1;
+
+/* The workload: what each append's size is, how many sources they're
+ * from, how many go to an OID in each write op, and how often to read
+ * instead.
+ */
+int *write_sizes;               /* RADOS_CAPTURE's, or NULL */
+int num_write_sizes;
+int min_write_size = 4;         /* RADOS_SIZES, otherwise */
+int max_write_size = 4;
+int num_sources = 1000;
+int batch_size = 1;
+int read_percent = 0;
+int read_size = 65536;
+char *write_data;               /* what's appended, MAX_WRITE_SIZE of it */
 
 
 char get_envvar_int(const char *name, int *v) {
@@ -28,29 +59,27 @@ char get_envvar_int(const char *name, int *v) {
         return 1;
 }
 
-void init_rados(rados_t *cluster, rados_ioctx_t *io) {
-        int err;
-        char *user = getenv("RADOS_USER");
-        bail_if(!user, "Must set RADOS_USER");
-        err = rados_create(cluster, user);
-        bail_if(err < 0, "rados_create");
-        err = rados_conf_read_file(*cluster, "/etc/ceph/ceph.conf");
-        bail_if(err < 0, "rados_conf_read_file: ");
-        err = rados_connect(*cluster);
-        bail_if(err < 0, "rados_connect: ");
-        char *pool = getenv("RADOS_POOL");
-        bail_if(!pool, "Must set RADOS_POOL");
-        err = rados_ioctx_create(*cluster, pool, io);
-        bail_if(err < 0, "rados_ioctx_create: ");
+/* Like get_envvar_int(), for settings where 0 means something */
+char get_envvar_int_or_zero(const char *name, int *v) {
+        char *var = getenv(name);
+        char *end;
+        if (!var) {
+                return 0;
+        }
+        errno = 0;
+        *v = strtol(var, &end, 10);
+        if (errno != 0 || end == var || *end) {
+                return -1;
+        }
+        return 1;
 }
 
-void init_oids(int n, char **oids, int *oid_len) {
+void init_oids(int n, char **oids, int *oid_len, int thread) {
         int i;
-        srand(time(NULL));
         for (i = 0; i < n; i++) {
                 int j = rand() % word_list_size; // I know why this is wrong.
                 oids[i] = malloc(MAX_OID_SIZE);
-                sprintf(oids[i], "bench_rados_%lld_%s", (long long)time(NULL), word_list[j]);
+                sprintf(oids[i], "bench_rados_%lld_%d_%s", (long long)time(NULL), thread, word_list[j]);
                 oid_len[i] = strlen(oids[i]);
         }
 }
@@ -64,62 +93,598 @@ void cleanup_oids(int n, char **oids, int *oid_len) {
         free(oids);
 }
 
-void write_oid(rados_ioctx_t *io, char *oid, int nwrites, int (*wait)(rados_completion_t)) {
-        int i;
+double now_seconds() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Operations in flight. Each one has a slot, and the backend's op to
+ * run it, handed back by op_done() when it's finished.
+ */
+struct aio_slot {
+        struct aio_queue *q;
+        void *op;
         int ret;
-        printf("%s\n", oid);
-        for (i = 0; i < nwrites; i++) {
-                rados_completion_t comp;
-                ret = rados_aio_create_completion(NULL, NULL, NULL, &comp);
-                bail_if(ret < 0, "rados_aio_create_completion");
-                rados_aio_append(*io, oid, comp, "four", 4);
-                (*wait)(comp);
+        int kind;
+        double issued;
+        double completed;
+        size_t len;
+        char *buf;              /* to read into */
+        size_t buf_size;
+        struct aio_slot *next;
+};
+
+/* Latencies are in microseconds */
+struct op_stats {
+        struct lathist latency;
+        long ops;
+        long errors;
+        long long bytes;
+};
+
+struct aio_queue {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct aio_slot *slots;
+        struct aio_slot *free;  /* ours */
+        struct aio_slot *done;  /* the callbacks', under lock */
+        int depth;
+        int in_flight;
+        struct op_stats stats[OP_KINDS];        /* since they were last taken */
+};
+
+void init_queue(struct aio_queue *q, int depth) {
+        int i;
+        memset(q, 0, sizeof(*q));
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->cond, NULL);
+        q->depth = depth;
+        q->slots = calloc(depth, sizeof(*q->slots));
+        bail_if(!q->slots, "calloc");
+        for (i = 0; i < depth; i++) {
+                q->slots[i].q = q;
+                q->slots[i].op = backend->new_op();
+                q->slots[i].next = q->free;
+                q->free = &q->slots[i];
+        }
+}
+
+void cleanup_queue(struct aio_queue *q) {
+        int i;
+        for (i = 0; i < q->depth; i++) {
+                backend->free_op(q->slots[i].op);
+                free(q->slots[i].buf);
+        }
+        free(q->slots);
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->cond);
+}
+
+void op_done(struct aio_slot *slot, int ret) {
+        struct aio_queue *q = slot->q;
+        slot->completed = now_seconds();
+        slot->ret = ret;
+        pthread_mutex_lock(&q->lock);
+        slot->next = q->done;
+        q->done = slot;
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+}
+
+/* Wait for at least one operation to finish, and free the slots of all that
+ * have. The stats are under the lock too, so they can be taken from
+ * another thread.
+ */
+void reap(struct aio_queue *q) {
+        struct aio_slot *slot, *next;
+        pthread_mutex_lock(&q->lock);
+        while (!q->done) {
+                pthread_cond_wait(&q->cond, &q->lock);
+        }
+        slot = q->done;
+        q->done = NULL;
+
+        for (; slot; slot = next) {
+                struct op_stats *stats = &q->stats[slot->kind];
+                int ret = slot->ret;
+                next = slot->next;
+                if (ret < 0) {
+                        stats->errors++;
+                } else {
+                        lathist_record(&stats->latency,
+                                (slot->completed - slot->issued) * 1e6 + 0.5);
+                        stats->ops++;
+                        /* Reads can come up short */
+                        stats->bytes += slot->kind == OP_READ ? ret : slot->len;
+                }
+                backend->release(slot->op);
+                q->in_flight--;
+                slot->next = q->free;
+                q->free = slot;
+        }
+        pthread_mutex_unlock(&q->lock);
+}
+
+/* A slot for an operation that's about to be issued, waiting for one if
+ * they're all in flight.
+ */
+struct aio_slot *next_slot(struct aio_queue *q, int kind, size_t len) {
+        struct aio_slot *slot;
+        if (!q->free) {
+                reap(q);
+        }
+        slot = q->free;
+        q->free = slot->next;
+        slot->kind = kind;
+        slot->len = len;
+        q->in_flight++;
+        slot->issued = now_seconds();
+        return slot;
+}
+
+void queue_append(struct aio_queue *q, void *io, const char *oid, const char *buf, size_t len) {
+        struct aio_slot *slot = next_slot(q, OP_WRITE, len);
+        backend->append(io, slot->op, slot, oid, buf, len);
+}
+
+/* Several appends to one OID, as one write op */
+void queue_appends(struct aio_queue *q, void *io, const char *oid, const int *lens, int n) {
+        struct aio_slot *slot;
+        size_t len = 0;
+        int i;
+        for (i = 0; i < n; i++) {
+                len += lens[i];
+        }
+        slot = next_slot(q, OP_WRITE, len);
+        backend->appends(io, slot->op, slot, oid, write_data, lens, n);
+}
+
+void queue_read(struct aio_queue *q, void *io, const char *oid, size_t len, uint64_t off) {
+        struct aio_slot *slot = next_slot(q, OP_READ, len);
+        if (slot->buf_size < len) {
+                free(slot->buf);
+                slot->buf = malloc(len);
+                bail_if(!slot->buf, "malloc");
+                slot->buf_size = len;
+        }
+        backend->read(io, slot->op, slot, oid, slot->buf, len, off);
+}
+
+void drain_queue(struct aio_queue *q) {
+        while (q->in_flight) {
+                reap(q);
+        }
+}
+
+void add_stats(struct op_stats *dst, const struct op_stats *src) {
+        lathist_add(&dst->latency, &src->latency);
+        dst->ops += src->ops;
+        dst->errors += src->errors;
+        dst->bytes += src->bytes;
+}
+
+void reset_stats(struct op_stats *s) {
+        memset(s, 0, sizeof(*s));
+}
+
+/* dst += what's happened on q since last time, for each kind of op */
+void take_stats(struct op_stats *dst, struct aio_queue *q) {
+        int i;
+        pthread_mutex_lock(&q->lock);
+        for (i = 0; i < OP_KINDS; i++) {
+                add_stats(&dst[i], &q->stats[i]);
+                reset_stats(&q->stats[i]);
         }
+        pthread_mutex_unlock(&q->lock);
+}
+
+void print_csv_header() {
+        printf("kind,op,depth,seconds,interval,ops,errors,ops_per_sec,mb_per_sec,"
+                "p50_us,p99_us,p999_us,max_us\n");
+}
+
+/* A line of what op did over the seconds up to at seconds in, or in
+ * total if at is 0.
+ */
+void print_stats(const char *op, int depth, double at, double seconds, const struct op_stats *s) {
+        const struct lathist *h = &s->latency;
+        if (csv_output) {
+                printf("%s,%s,%d,%.3f,%.3f,%ld,%ld,%.1f,%.3f,%lu,%lu,%lu,%lu\n",
+                        at > 0 ? "interval" : "total", op, depth, at > 0 ? at : seconds, seconds, s->ops, s->errors,
+                        s->ops / seconds, s->bytes / seconds / 1e6,
+                        lathist_percentile(h, 50), lathist_percentile(h, 99),
+                        lathist_percentile(h, 99.9), lathist_max(h));
+                return;
+        }
+        if (at > 0) {
+                printf("depth %4d %8.1fs %5s:", depth, at, op);
+        } else {
+                printf("depth %4d    total %5s:", depth, op);
+        }
+        printf(" %10.1f ops/s %9.3f MB/s   p50 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms",
+                s->ops / seconds, s->bytes / seconds / 1e6,
+                lathist_percentile(h, 50) / 1e3, lathist_percentile(h, 99) / 1e3,
+                lathist_percentile(h, 99.9) / 1e3, lathist_max(h) / 1e3);
+        if (s->errors) {
+                printf(", %ld failed", s->errors);
+        }
+        printf("\n");
+}
+
+/* Both kinds of op, if there are reads */
+void print_all_stats(int depth, double at, double seconds, const struct op_stats *s) {
+        print_stats("write", depth, at, seconds, &s[OP_WRITE]);
+        if (read_percent) {
+                print_stats("read", depth, at, seconds, &s[OP_READ]);
+        }
+}
+
+/* A thread appending to its own OIDs through its own ioctx and queue.
+ * The OIDs are the buckets sources' appends go to.
+ */
+struct worker {
+        pthread_t thread;
+        int id;
+        int cpu;        /* to pin it to, or -1 */
+        void *io;
+        char **oids;
+        int *oid_len;
+        int num_oids;
+        int nwrites;
+        struct aio_queue q;
+
+        unsigned int seed;
+        int next_size;          /* in write_sizes */
+        uint64_t *oid_size;     /* how much we've appended to each */
+        int *pending;           /* batch_size appends waiting for each OID */
+        int *num_pending;
+};
+
+/* Same source, same bucket, like ingestd */
+int bucket_of(uint64_t source, int num_buckets) {
+        /* splitmix64's finaliser */
+        source = (source ^ (source >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        source = (source ^ (source >> 27)) * 0x94d049bb133111ebULL;
+        source ^= source >> 31;
+        return source % num_buckets;
+}
+
+/* The next append's size: the capture's, in order, or between the
+ * smallest and biggest with log(size) uniformly distributed, so there
+ * are as many in each power of 2.
+ */
+int next_write_size(struct worker *w) {
+        double u;
+        if (write_sizes) {
+                int size = write_sizes[w->next_size];
+                w->next_size = (w->next_size + 1) % num_write_sizes;
+                return size;
+        }
+        u = (double)rand_r(&w->seed) / RAND_MAX;
+        return min_write_size * pow((double)max_write_size / min_write_size, u) + 0.5;
+}
+
+void queue_workload_read(struct worker *w) {
+        int oid = rand_r(&w->seed) % w->num_oids;
+        uint64_t off = 0;
+        if (w->oid_size[oid] > (uint64_t)read_size) {
+                off = ((uint64_t)rand_r(&w->seed) * RAND_MAX + rand_r(&w->seed))
+                        % (w->oid_size[oid] - read_size);
+        }
+        queue_read(&w->q, w->io, w->oids[oid], read_size, off);
+}
+
+/* Before each write op, reads until one doesn't come up read_percent.
+ * That's read_percent / (100 - read_percent) reads a write on average,
+ * so read_percent of the ops issued are reads however many appends go
+ * in a write op
+ */
+void queue_workload_reads(struct worker *w) {
+        while (read_percent && rand_r(&w->seed) % 100 < read_percent) {
+                queue_workload_read(w);
+        }
+}
+
+void flush_pending(struct worker *w, int oid) {
+        if (w->num_pending[oid]) {
+                queue_workload_reads(w);
+                queue_appends(&w->q, w->io, w->oids[oid], &w->pending[oid * batch_size],
+                        w->num_pending[oid]);
+                w->num_pending[oid] = 0;
+        }
+}
+
+pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t run_cond = PTHREAD_COND_INITIALIZER;
+int workers_running;
+
+/* Append nwrites times, each from a random source to its bucket, with up
+ * to the queue's depth of ops in flight. Appends go batch_size at a time
+ * per bucket, and read_percent of the ops issued (write ops, however many
+ * appends are in them, and reads) are reads from a random bucket.
+ */
+void *write_oids(void *arg) {
+        struct worker *w = arg;
+        int i;
+
+        if (w->cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(w->cpu, &cpus);
+                errno = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+                bail_if(errno, "pthread_setaffinity_np");
+        }
+        for (i = 0; i < w->nwrites; i++) {
+                int oid, size;
+                oid = bucket_of(rand_r(&w->seed) % num_sources, w->num_oids);
+                size = next_write_size(w);
+                w->oid_size[oid] += size;
+                if (batch_size == 1) {
+                        queue_workload_reads(w);
+                        queue_append(&w->q, w->io, w->oids[oid], write_data, size);
+                        continue;
+                }
+                w->pending[oid * batch_size + w->num_pending[oid]++] = size;
+                if (w->num_pending[oid] == batch_size) {
+                        flush_pending(w, oid);
+                }
+        }
+        for (i = 0; i < w->num_oids; i++) {
+                flush_pending(w, i);
+        }
+        drain_queue(&w->q);
+
+        pthread_mutex_lock(&run_lock);
+        workers_running--;
+        pthread_cond_signal(&run_cond);
+        pthread_mutex_unlock(&run_lock);
+        return NULL;
+}
+
+/* Run the workers with queues of depth. Every report_interval seconds,
+ * and at the end, print the throughput and latency percentiles of all
+ * of them together.
+ */
+void run_workers(struct worker *workers, int num_workers, int depth) {
+        struct op_stats total[OP_KINDS], interval[OP_KINDS];
+        double start, last_report, now;
+        int i;
+
+        for (i = 0; i < OP_KINDS; i++) {
+                reset_stats(&total[i]);
+                reset_stats(&interval[i]);
+        }
+
+        start = last_report = now_seconds();
+        workers_running = num_workers;
+        for (i = 0; i < num_workers; i++) {
+                init_queue(&workers[i].q, depth);
+                errno = pthread_create(&workers[i].thread, NULL, write_oids, &workers[i]);
+                bail_if(errno, "pthread_create");
+        }
+
+        pthread_mutex_lock(&run_lock);
+        while (workers_running) {
+                struct timespec until;
+                double wait = last_report + report_interval - now_seconds();
+                if (wait > 0) {
+                        clock_gettime(CLOCK_REALTIME, &until);
+                        until.tv_sec += (long)wait;
+                        until.tv_nsec += (wait - (long)wait) * 1e9;
+                        if (until.tv_nsec >= 1000000000) {
+                                until.tv_sec++;
+                                until.tv_nsec -= 1000000000;
+                        }
+                        pthread_cond_timedwait(&run_cond, &run_lock, &until);
+                }
+                now = now_seconds();
+                if (now - last_report < report_interval) {
+                        continue;
+                }
+                pthread_mutex_unlock(&run_lock);
+                for (i = 0; i < num_workers; i++) {
+                        take_stats(interval, &workers[i].q);
+                }
+                print_all_stats(depth, now - start, now - last_report, interval);
+                fflush(stdout);
+                for (i = 0; i < OP_KINDS; i++) {
+                        add_stats(&total[i], &interval[i]);
+                        reset_stats(&interval[i]);
+                }
+                last_report = now;
+                pthread_mutex_lock(&run_lock);
+        }
+        pthread_mutex_unlock(&run_lock);
+        now = now_seconds();
+
+        for (i = 0; i < num_workers; i++) {
+                pthread_join(workers[i].thread, NULL);
+                take_stats(total, &workers[i].q);
+                cleanup_queue(&workers[i].q);
+        }
+        print_all_stats(depth, 0, now - start, total);
+}
+
+/* A list of integers in an environment variable, comma separated. Returns
+ * how many, filling in at most max of them, 0 if it isn't set or -1 if
+ * it's not a list of integers.
+ */
+int get_envvar_ints(const char *name, int *v, int max) {
+        char *var = getenv(name);
+        char *end;
+        int n = 0;
+        if (!var) {
+                return 0;
+        }
+        while (n < max) {
+                errno = 0;
+                v[n] = strtol(var, &end, 10);
+                if (errno != 0 || end == var) {
+                        return -1;
+                }
+                n++;
+                if (*end != ',') {
+                        break;
+                }
+                var = end + 1;
+        }
+        return *end ? -1 : n;
+}
+
+/* Sizes of the bursts in a burstnetsink capture: each is a 4 byte
+ * network order length and then that many bytes.
+ */
+void load_capture_sizes(const char *path) {
+        FILE *f = fopen(path, "r");
+        uint32_t len;
+        int max = 0;
+        bail_if(!f, path);
+        while (fread(&len, sizeof(len), 1, f) == 1) {
+                len = ntohl(len);
+                bail_if(fseeko(f, len, SEEK_CUR) < 0, path);
+                if (len == 0) {
+                        continue;
+                }
+                if (num_write_sizes == max) {
+                        max = max ? max * 2 : 4096;
+                        write_sizes = realloc(write_sizes, max * sizeof(*write_sizes));
+                        bail_if(!write_sizes, "realloc");
+                }
+                write_sizes[num_write_sizes++] = len < MAX_WRITE_SIZE ? len : MAX_WRITE_SIZE;
+        }
+        bail_if(ferror(f), path);
+        fclose(f);
+        errno = 0;
+        bail_if(num_write_sizes == 0, "RADOS_CAPTURE has no bursts in it");
 }
 
 int main() {
         int ret;
         int num_oids;
         int num_writes;
-        int writes_per_oid;
-        time_t write_start;
-        time_t write_end;
-        int i;
-        char **oids;
-        int *oid_len;
-        rados_ioctx_t io;
-        rados_t cluster;
+        int num_workers = 1;
+        int depths[MAX_QUEUE_DEPTHS];
+        int num_depths;
+        int cpus[MAX_CPUS];
+        int num_cpus;
+        int sizes[2];
+        int i, j;
+        struct worker *workers;
+        char *backend_name = getenv("RADOS_BACKEND");
 
-        init_rados(&cluster, &io);
+        if (backend_name && strcmp(backend_name, "memory") == 0) {
+                backend = &memory_backend;
+        } else if (backend_name && strcmp(backend_name, "file") == 0) {
+                backend = &file_backend;
+        } else {
+                errno = 0;
+#ifdef NO_RADOS
+                bail_if(1, "Built with NO_RADOS, so RADOS_BACKEND must be memory or file");
+#else
+                bail_if(backend_name && strcmp(backend_name, "rados") != 0,
+                        "RADOS_BACKEND must be rados, memory or file");
+                backend = &rados_backend;
+#endif
+        }
+        backend->connect();
 
         ret = get_envvar_int("RADOS_NUM_OIDS", &num_oids);
         bail_if(ret != 1, "Must set RADOS_NUM_OIDS to an integral value");
         ret = get_envvar_int("RADOS_NUM_WRITES", &num_writes);
         bail_if(ret != 1, "Must set RADOS_NUM_WRITES to an integral value");
+        num_depths = get_envvar_ints("RADOS_QUEUE_DEPTH", depths, MAX_QUEUE_DEPTHS);
+        if (num_depths == 0) {
+                depths[num_depths++] = 1;
+        }
+        for (i = 0; i < num_depths && depths[i] > 0; i++);
+        bail_if(num_depths < 0 || i < num_depths, "RADOS_QUEUE_DEPTH must be positive integers, comma separated");
+        ret = get_envvar_int("RADOS_INTERVAL", &report_interval);
+        bail_if(ret < 0, "RADOS_INTERVAL must be a whole number of seconds");
+        ret = get_envvar_int("RADOS_THREADS", &num_workers);
+        bail_if(ret < 0 || num_workers < 1, "RADOS_THREADS must be a positive integer");
+        num_cpus = get_envvar_ints("RADOS_CPUS", cpus, MAX_CPUS);
+        for (i = 0; i < num_cpus && cpus[i] >= 0 && cpus[i] < CPU_SETSIZE; i++);
+        bail_if(num_cpus < 0 || i < num_cpus, "RADOS_CPUS must be CPU numbers, comma separated");
+        csv_output = getenv("RADOS_OUTPUT") && strcmp(getenv("RADOS_OUTPUT"), "csv") == 0;
+
+        if (getenv("RADOS_CAPTURE")) {
+                load_capture_sizes(getenv("RADOS_CAPTURE"));
+        }
+        ret = get_envvar_ints("RADOS_SIZES", sizes, 2);
+        bail_if(ret == 1 || ret < 0 || (ret == 2 && (sizes[0] < 1 || sizes[1] < sizes[0]
+                || sizes[1] > MAX_WRITE_SIZE)), "RADOS_SIZES must be the smallest and biggest append, comma separated");
+        if (ret == 2) {
+                min_write_size = sizes[0];
+                max_write_size = sizes[1];
+        }
+        ret = get_envvar_int("RADOS_SOURCES", &num_sources);
+        bail_if(ret < 0 || num_sources < 1, "RADOS_SOURCES must be a positive integer");
+        ret = get_envvar_int("RADOS_BATCH", &batch_size);
+        bail_if(ret < 0 || batch_size < 1, "RADOS_BATCH must be a positive integer");
+        ret = get_envvar_int_or_zero("RADOS_READ_PERCENT", &read_percent);
+        bail_if(ret < 0 || read_percent < 0 || read_percent > 99, "RADOS_READ_PERCENT must be 0 to 99");
+        ret = get_envvar_int("RADOS_READ_SIZE", &read_size);
+        bail_if(ret < 0 || read_size < 1, "RADOS_READ_SIZE must be a positive integer");
+
+        /* "four" over and over, like the appends always were */
+        write_data = malloc(MAX_WRITE_SIZE);
+        bail_if(!write_data, "malloc");
+        for (i = 0; i < MAX_WRITE_SIZE; i++) {
+                write_data[i] = "four"[i % 4];
+        }
+
+        /* Each thread has RADOS_NUM_OIDS of its own, and appends
+         * RADOS_NUM_WRITES times
+         */
+        workers = calloc(num_workers, sizeof(*workers));
+        bail_if(!workers, "calloc");
+        srand(time(NULL));
+        for (i = 0; i < num_workers; i++) {
+                struct worker *w = &workers[i];
+                w->id = i;
+                w->cpu = num_cpus ? cpus[i % num_cpus] : -1;
+                w->num_oids = num_oids;
+                w->nwrites = num_writes;
+                w->oids = malloc(num_oids * sizeof(char*));
+                w->oid_len = malloc(num_oids * sizeof(int));
+                init_oids(num_oids, w->oids, w->oid_len, i);
+                w->io = backend->open_ioctx();
+                w->seed = rand();
+                w->next_size = num_write_sizes ? (long long)i * num_write_sizes / num_workers : 0;
+                w->oid_size = calloc(num_oids, sizeof(*w->oid_size));
+                w->pending = malloc((size_t)num_oids * batch_size * sizeof(*w->pending));
+                w->num_pending = calloc(num_oids, sizeof(*w->num_pending));
+                bail_if(!w->oid_size || !w->pending || !w->num_pending, "malloc");
+        }
+
+        if (csv_output) {
+                print_csv_header();
+        } else {
+                for (i = 0; i < num_workers; i++) {
+                        for (j = 0; j < num_oids; j++) {
+                                printf("%s\n", workers[i].oids[j]);
+                        }
+                }
+        }
+        for (i = 0; i < num_depths; i++) {
+                run_workers(workers, num_workers, depths[i]);
+        }
+
+        for (i = 0; i < num_workers; i++) {
+                for (j = 0; j < num_oids; j++) {
+                        backend->remove(workers[i].io, workers[i].oids[j]);
+                }
+                cleanup_oids(num_oids, workers[i].oids, workers[i].oid_len);
+                backend->close_ioctx(workers[i].io);
+                free(workers[i].oid_size);
+                free(workers[i].pending);
+                free(workers[i].num_pending);
+        }
+        free(workers);
+        free(write_sizes);
+        free(write_data);
+        backend->shutdown();
 
-        writes_per_oid = num_writes / num_oids;
-        if (num_writes % num_oids != 0) {
-                printf("Warning: num_oids is not a factor of num_writes.\n");
-        }
-         
-        oids = malloc(num_oids * sizeof(char*));
-        oid_len = malloc(num_oids * sizeof(int));
-        init_oids(num_oids, oids, oid_len);
-
-        write_start = time(NULL);
-        for (i = 0; i < num_oids; i++) {
-                write_oid(&io, oids[i], writes_per_oid, rados_aio_wait_for_complete);
-        }
-        write_end = time(NULL);
-        printf("%f\n", difftime(write_end, write_start));
-        for (i = 0; i < num_oids; i++) {
-                rados_remove(io, oids[i]);
-        }
-       
-        cleanup_oids(num_oids, oids, oid_len); 
-        rados_ioctx_destroy(io);
-        rados_shutdown(cluster);
-        
         return 0;
 }
-        
@@ -0,0 +1,48 @@
+/*
+ * spool.h - on disk format of burstnetsink's spool
+ *
+ * A spool is a directory of segment files named spool.<sequence>, with
+ * the sequence number zero padded so they sort in the order written.
+ * Segments are preallocated to their full size up front so that syncing
+ * a write never has to touch the file's metadata.
+ *
+ * Each segment starts with a header:
+ *
+ *	[ 8 bytes magic, SPOOL_MAGIC ]
+ *	[ 8 bytes sequence number, network byte order ]
+ *
+ * followed by records:
+ *
+ *	[ 4 bytes length of burst, network byte order ]
+ *	[ 4 bytes spool_checksum() of burst, network byte order ]
+ *	[ burst ]
+ *
+ * and then zeros for whatever space is left, so a zero length marks the
+ * end of a segment.
+ */
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+
+#include "hash.h"
+
+#define SPOOL_MAGIC		"BNSPOOL1"
+#define SPOOL_HEADER_SIZE	16
+#define SPOOL_RECORD_HEADER	(2 * sizeof(uint32_t))
+#define SPOOL_PREFIX		"spool."
+#define SPOOL_NAME_FORMAT	SPOOL_PREFIX "%016llu"
+
+#define SPOOL_DEFAULT_SEGMENT_SIZE	(256 * 1024 * 1024)
+
+/* hash_fnv1a(), folded in half. It's only there so a replay can tell
+ * that a burst never made it to disk in one piece, so it needs to be
+ * fast more than it needs to be good.
+ */
+static inline uint32_t spool_checksum(const uint8_t *buf, size_t len) {
+	uint64_t h = hash_fnv1a(HASH_FNV_OFFSET, buf, len);
+
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+#endif
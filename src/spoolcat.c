@@ -0,0 +1,178 @@
+/*
+ * spoolcat: replay the DataBursts in a burstnetsink spool to stdout
+ *
+ * Output is the same as burstnetsink's: each DataBurst preceded by its
+ * length as a network byte ordered uint32.
+ *
+ * Arguments are spool directories (every segment in them is replayed in
+ * order) or individual segment files. A record that doesn't check out
+ * was never acked, so we warn and move on to the next segment.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "spool.h"
+
+/* write out a DataBurst
+ *
+ * returns -1 on failure
+ */
+int write_burst(int fd, const uint8_t *burst, uint32_t size) {
+	uint32_t n_burstlen = htonl(size);
+	struct iovec iov[2];
+	struct iovec *v = iov;
+	int iovcnt = 2;
+
+	iov[0].iov_base = &n_burstlen;
+	iov[0].iov_len = sizeof(n_burstlen);
+	iov[1].iov_base = (void *)burst;
+	iov[1].iov_len = size;
+
+	while (iovcnt) {
+		ssize_t n = writev(fd, v, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		while (iovcnt && (size_t)n >= v->iov_len) {
+			n -= v->iov_len;
+			v++; iovcnt--;
+		}
+		if (n) {
+			v->iov_base = (uint8_t *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/* Replay a single segment
+ *
+ * returns -1 if we couldn't write to stdout, 1 if the segment had
+ * something wrong with it
+ */
+int replay_segment(const char *path) {
+	struct stat st;
+	uint8_t *seg;
+	size_t off;
+	int fd, ret = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+	if (st.st_size < SPOOL_HEADER_SIZE) {
+		fprintf(stderr, "%s: too short to be a spool segment\n", path);
+		close(fd);
+		return 1;
+	}
+
+	seg = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED)
+		return perror("mmap"), 1;
+	madvise(seg, st.st_size, MADV_SEQUENTIAL);
+
+	if (memcmp(seg, SPOOL_MAGIC, strlen(SPOOL_MAGIC)) != 0) {
+		fprintf(stderr, "%s: not a spool segment\n", path);
+		munmap(seg, st.st_size);
+		return 1;
+	}
+
+	off = SPOOL_HEADER_SIZE;
+	while (off + SPOOL_RECORD_HEADER <= st.st_size) {
+		uint32_t size, checksum;
+
+		memcpy(&size, seg + off, sizeof(size));
+		memcpy(&checksum, seg + off + sizeof(size), sizeof(checksum));
+		size = ntohl(size);
+		checksum = ntohl(checksum);
+
+		/* Preallocated space we never got to */
+		if (size == 0)
+			break;
+
+		if (size > st.st_size - off - SPOOL_RECORD_HEADER
+				|| spool_checksum(seg + off + SPOOL_RECORD_HEADER, size) != checksum) {
+			fprintf(stderr, "%s: incomplete burst at offset %zu, skipping rest of segment\n",
+				path, off);
+			ret = 1;
+			break;
+		}
+
+		if (write_burst(STDOUT_FILENO, seg + off + SPOOL_RECORD_HEADER, size) < 0) {
+			perror("writing databurst");
+			ret = -1;
+			break;
+		}
+		off += SPOOL_RECORD_HEADER + size;
+	}
+
+	munmap(seg, st.st_size);
+	return ret;
+}
+
+static int is_segment(const struct dirent *de) {
+	return strncmp(de->d_name, SPOOL_PREFIX, strlen(SPOOL_PREFIX)) == 0;
+}
+
+/* Replay every segment in a spool directory, oldest first
+ */
+int replay_spool(const char *dir) {
+	struct dirent **segments;
+	char path[PATH_MAX];
+	int i, n, ret = 0;
+
+	n = scandir(dir, &segments, is_segment, alphasort);
+	if (n < 0)
+		return perror(dir), 1;
+
+	for (i = 0; i < n; i++) {
+		if (ret >= 0) {
+			int r;
+			snprintf(path, sizeof(path), "%s/%s", dir, segments[i]->d_name);
+			r = replay_segment(path);
+			if (r) ret = r;
+		}
+		free(segments[i]);
+	}
+	free(segments);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	int i, ret = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "%s <spool directory | segment> ...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc && ret >= 0; i++) {
+		struct stat st;
+		int r;
+
+		if (stat(argv[i], &st) < 0) {
+			perror(argv[i]);
+			ret = 1;
+			continue;
+		}
+		r = S_ISDIR(st.st_mode) ? replay_spool(argv[i]) : replay_segment(argv[i]);
+		if (r) ret = r;
+	}
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * telemetry - marquise telemetry messages. See telemetry.h
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* returns 0 when there are no more */
+static int next_token(const char **cur, const char *end, struct telemetry_token *t) {
+	const char *p = *cur;
+
+	while (p < end && is_space(*p))
+		p++;
+	if (p == end)
+		return 0;
+	t->p = p;
+	while (p < end && !is_space(*p))
+		p++;
+	t->len = p - t->p;
+	*cur = p;
+	return 1;
+}
+
+static int parse_u64(const struct telemetry_token *t, uint64_t *v) {
+	size_t i;
+
+	if (t->len == 0 || t->len > 20)
+		return -1;
+	*v = 0;
+	for (i = 0; i < t->len; i++) {
+		unsigned int digit = t->p[i] - '0';
+
+		if (digit > 9 || *v > (UINT64_MAX - digit) / 10)
+			return -1;
+		*v = *v * 10 + digit;
+	}
+	return 0;
+}
+
+static int parse_i64(const struct telemetry_token *t, int64_t *v) {
+	struct telemetry_token digits = *t;
+	uint64_t u;
+	int negative = digits.len > 0 && digits.p[0] == '-';
+
+	if (negative) {
+		digits.p++;
+		digits.len--;
+	}
+	if (parse_u64(&digits, &u) < 0 || u > (uint64_t)INT64_MAX + negative)
+		return -1;
+	*v = negative ? -(int64_t)(u - 1) - 1 : (int64_t)u;
+	return 0;
+}
+
+static int parse_hex32(const struct telemetry_token *t, uint32_t *v) {
+	size_t i;
+
+	if (t->len == 0 || t->len > 8)
+		return -1;
+	*v = 0;
+	for (i = 0; i < t->len; i++) {
+		char c = t->p[i];
+		unsigned int digit;
+
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			return -1;
+		*v = *v << 4 | digit;
+	}
+	return 0;
+}
+
+int telemetry_parse(const char *buf, size_t len, struct telemetry_msg *m) {
+	const char *cur = buf, *end = buf + len;
+	struct telemetry_token t, eq, value;
+
+	m->n_words = m->n_values = 0;
+	if (!next_token(&cur, end, &m->ident)
+			|| !next_token(&cur, end, &t) || parse_u64(&t, &m->timestamp) < 0
+			|| !next_token(&cur, end, &t) || parse_hex32(&t, &m->burst_id) < 0)
+		return -1;
+
+	while (next_token(&cur, end, &t)) {
+		const char *after = cur;
+
+		if (next_token(&cur, end, &eq) && eq.len == 1 && eq.p[0] == '=') {
+			if (!next_token(&cur, end, &value))
+				return -1;
+			if (m->n_values < TELEMETRY_MAX_VALUES
+					&& parse_i64(&value, &m->values[m->n_values]) == 0) {
+				m->keys[m->n_values++] = t;
+				continue;
+			}
+			/* Not a number (or too many), so the lot's a word */
+			t.len = value.p + value.len - t.p;
+		} else {
+			cur = after;
+		}
+		if (m->n_words == TELEMETRY_MAX_WORDS)
+			return -1;
+		m->words[m->n_words++] = t;
+	}
+	return 0;
+}
+
+int telemetry_signature(const struct telemetry_msg *m, char *buf) {
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < m->n_words; i++) {
+		if (len + !!len + m->words[i].len > TELEMETRY_MAX_SIGNATURE)
+			return -1;
+		if (len)
+			buf[len++] = ' ';
+		memcpy(buf + len, m->words[i].p, m->words[i].len);
+		len += m->words[i].len;
+	}
+	for (i = 0; i < m->n_values; i++) {
+		if (len + !!len + m->keys[i].len + 1 > TELEMETRY_MAX_SIGNATURE)
+			return -1;
+		if (len)
+			buf[len++] = ' ';
+		memcpy(buf + len, m->keys[i].p, m->keys[i].len);
+		len += m->keys[i].len;
+		buf[len++] = '=';
+	}
+	return len;
+}
+
+int telemetry_value(const struct telemetry_msg *m, const char *key, int64_t *value) {
+	size_t key_len = strlen(key);
+	unsigned int i;
+
+	for (i = 0; i < m->n_values; i++) {
+		if (m->keys[i].len == key_len && memcmp(m->keys[i].p, key, key_len) == 0) {
+			*value = m->values[i];
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * telemetry - marquise telemetry messages, split up once in C rather than
+ * on every line by each python script watching them
+ *
+ * A message is whitespace separated:
+ *
+ *	<identity> <ns timestamp> <burst id in hex> <words ...> [<key> = <value> ...]
+ *
+ * e.g.
+ *
+ *	fishhook.engineroom.anchor.net.au 1395212041732118000 8c087c0b collator_thread created_databurst frames = 1618 compressed_bytes = 16921
+ *	marquised:astrolabe.syd1.anchor.net.au 1395375377705126042 c87ba112 poller_thread rx_msg_from collate_thread
+ *	TTT 1393979427248973000 ffffffff messages_in = 68751
+ *
+ * The words are usually the thread and what happened, and the values are
+ * integers. A key whose value isn't an integer is kept as one more word,
+ * "key = value" and all. Tokens point into the message, nothing's copied.
+ *
+ * What kind of message it is, its signature, is the words and then
+ * "key=" for each value, e.g.
+ *
+ *	collator_thread created_databurst frames= compressed_bytes=
+ *
+ * marquise_telemetry -B writes messages out as a stream of binary
+ * records, all little endian:
+ *
+ *	"MQTELEM1"
+ *	[ struct telemetry_record ] [ n_values int64_t values ]
+ *	[ struct telemetry_record ] [ n_values bytes of name, 0 padded to 8 ]
+ *	...
+ *
+ * Records of kind TELEMETRY_FIRST_KIND and up are messages, followed by
+ * their values in the order the signature has their keys. The two kinds
+ * below that give names to the IDs the messages use, and are followed by
+ * the name instead: TELEMETRY_DEFINE_IDENT names the identity with ID
+ * ident and TELEMETRY_DEFINE_KIND the kind with ID ident (its signature).
+ * A name always comes before the first record that needs it, and an ID
+ * can be named again later, when it's been given to something else.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_MAGIC		"MQTELEM1"
+
+/* Most words and values a message can have. Messages with more are
+ * malformed
+ */
+#define TELEMETRY_MAX_WORDS	8
+#define TELEMETRY_MAX_VALUES	8
+
+/* Longest signature, so it fits in n_values */
+#define TELEMETRY_MAX_SIGNATURE	255
+
+#define TELEMETRY_DEFINE_IDENT	0
+#define TELEMETRY_DEFINE_KIND	1
+#define TELEMETRY_FIRST_KIND	2
+#define TELEMETRY_MAX_KINDS	(256 - TELEMETRY_FIRST_KIND)
+
+struct telemetry_record {
+	uint64_t timestamp;	/* ns since the epoch, 0 for names */
+	uint32_t burst_id;
+	uint16_t ident;
+	uint8_t kind;
+	uint8_t n_values;	/* or the name's length */
+};
+
+struct telemetry_token {
+	const char *p;
+	size_t len;
+};
+
+struct telemetry_msg {
+	struct telemetry_token ident;
+	uint64_t timestamp;
+	uint32_t burst_id;
+
+	unsigned int n_words;
+	struct telemetry_token words[TELEMETRY_MAX_WORDS];
+
+	unsigned int n_values;
+	struct telemetry_token keys[TELEMETRY_MAX_VALUES];
+	int64_t values[TELEMETRY_MAX_VALUES];
+};
+
+/* Split up the len bytes of a message
+ *
+ * returns 0, or -1 if it's malformed
+ */
+int telemetry_parse(const char *buf, size_t len, struct telemetry_msg *m);
+
+/* Write m's signature into buf, which should have room for
+ * TELEMETRY_MAX_SIGNATURE bytes. It isn't 0 terminated
+ *
+ * returns its length, or -1 if it's too long
+ */
+int telemetry_signature(const struct telemetry_msg *m, char *buf);
+
+/* Find the value of key
+ *
+ * returns 0 if m doesn't have one
+ */
+int telemetry_value(const struct telemetry_msg *m, const char *key, int64_t *value);
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * throughput - broker_throughput.py, natively. See throughput.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "throughput.h"
+
+/* What broker_throughput.py prints means over, in seconds */
+static const int mean_over[] = { 600, 60, 1 };
+#define N_MEANS (sizeof(mean_over) / sizeof(mean_over[0]))
+
+static void *alloc_or_die(void *p) {
+	if (p == NULL) {
+		perror("throughput");
+		exit(1);
+	}
+	return p;
+}
+
+void throughput_init(struct throughput *t, double now) {
+	memset(t, 0, sizeof(*t));
+	t->last_tick = now;
+	outstanding_init(&t->outstanding);
+	t->latency_bins = alloc_or_die(calloc(THROUGHPUT_BINS, sizeof(*t->latency_bins)));
+	t->ident_bins = alloc_or_die(calloc(THROUGHPUT_BINS, sizeof(*t->ident_bins)));
+	t->ident_60 = alloc_or_die(calloc(THROUGHPUT_MAX_IDENTS, sizeof(*t->ident_60)));
+	t->ident_all = alloc_or_die(calloc(THROUGHPUT_MAX_IDENTS, sizeof(*t->ident_all)));
+	intern_init(&t->idents, THROUGHPUT_MAX_IDENTS);
+}
+
+void throughput_free(struct throughput *t) {
+	int i;
+
+	outstanding_free(&t->outstanding);
+	free(t->latency_bins);
+	for (i = 0; i < THROUGHPUT_BINS; i++)
+		free(t->ident_bins[i].samples);
+	free(t->ident_bins);
+	free(t->ident_60);
+	free(t->ident_all);
+	intern_free(&t->idents);
+	t->latency_bins = NULL;
+	t->ident_bins = NULL;
+	t->ident_60 = NULL;
+	t->ident_all = NULL;
+}
+
+#define SAMPLE(id, bucket)	((uint32_t)(id) << 16 | (bucket))
+#define SAMPLE_ID(s)		((s) >> 16)
+#define SAMPLE_BUCKET(s)	((s) & 0xffff)
+
+/* Take a bin's identity latencies back out of hists, a histogram per
+ * identity
+ */
+static void ident_sub(struct lathist *hists, const struct ident_samples *bin) {
+	size_t i;
+
+	for (i = 0; i < bin->n; i++)
+		lathist_remove_bucket(&hists[SAMPLE_ID(bin->samples[i])],
+			SAMPLE_BUCKET(bin->samples[i]));
+}
+
+/* Move on a bin for every second that's gone by, emptying each one
+ */
+static void tick(struct throughput *t, double now) {
+	struct time_hist *hists[] = {
+		&t->points, &t->bursts, &t->acks, &t->acked_bursts, &t->latency
+	};
+	unsigned int i;
+
+	/* Been away long enough to empty the lot */
+	if (now - t->last_tick >= THROUGHPUT_BINS + 1) {
+		uint64_t skip = (uint64_t)(now - t->last_tick) - THROUGHPUT_BINS;
+
+		t->ticks += skip;
+		t->last_tick += skip;
+		t->current_bin = (t->current_bin + skip) % THROUGHPUT_BINS;
+		memset(t->latency_bins, 0, THROUGHPUT_BINS * sizeof(*t->latency_bins));
+		lathist_reset(&t->latency_60);
+		lathist_reset(&t->latency_all);
+		for (i = 0; i < THROUGHPUT_BINS; i++)
+			t->ident_bins[i].n = 0;
+		memset(t->ident_60, 0, t->n_idents * sizeof(*t->ident_60));
+		memset(t->ident_all, 0, t->n_idents * sizeof(*t->ident_all));
+	}
+
+	while (now - t->last_tick >= 1) {
+		t->ticks++;
+		t->last_tick += 1;
+		t->current_bin = (t->current_bin + 1) % THROUGHPUT_BINS;
+		for (i = 0; i < sizeof(hists) / sizeof(hists[0]); i++)
+			hists[i]->bins[t->current_bin] = 0;
+
+		/* The bin we're about to reuse drops out of everything, and the
+		 * one 60 back out of the last 60
+		 */
+		lathist_sub(&t->latency_60,
+			&t->latency_bins[(t->current_bin - 60 + THROUGHPUT_BINS) % THROUGHPUT_BINS]);
+		lathist_sub(&t->latency_all, &t->latency_bins[t->current_bin]);
+		lathist_reset(&t->latency_bins[t->current_bin]);
+
+		/* And the same for each identity */
+		ident_sub(t->ident_60,
+			&t->ident_bins[(t->current_bin - 60 + THROUGHPUT_BINS) % THROUGHPUT_BINS]);
+		ident_sub(t->ident_all, &t->ident_bins[t->current_bin]);
+		t->ident_bins[t->current_bin].n = 0;
+	}
+}
+
+/* Total of the last k bins, the current one included
+ */
+static double hist_sum(const struct throughput *t, const struct time_hist *h, int k) {
+	double sum = 0;
+	int i;
+
+	if (k > THROUGHPUT_BINS)
+		k = THROUGHPUT_BINS;
+	for (i = 0; i < k; i++)
+		sum += h->bins[(t->current_bin - i + THROUGHPUT_BINS) % THROUGHPUT_BINS];
+	return sum;
+}
+
+/* Per second over the last k seconds, or as long as we've been going
+ */
+static double hist_mean(const struct throughput *t, const struct time_hist *h, int k) {
+	if (t->ticks < (uint64_t)k)
+		k = t->ticks;
+	return k ? hist_sum(t, h, k) / k : 0;
+}
+
+void throughput_burst(struct throughput *t, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len, uint32_t points, double now) {
+	tick(t, now);
+	t->bursts.bins[t->current_bin] += 1;
+	t->points.bins[t->current_bin] += points;
+	outstanding_add(&t->outstanding, ident, ident_len, msg_id, msg_id_len, points, now);
+}
+
+/* Put an ack latency (in microseconds) in the histograms, including
+ * ident's if it has one or there's room for one
+ */
+static void record_latency(struct throughput *t, const uint8_t *ident, size_t ident_len, uint64_t usec) {
+	struct ident_samples *bin = &t->ident_bins[t->current_bin];
+	unsigned int bucket = lathist_index(usec);
+	struct intern_entry *e;
+	uint64_t hash;
+
+	lathist_record(&t->latency_bins[t->current_bin], usec);
+	lathist_record(&t->latency_60, usec);
+	lathist_record(&t->latency_all, usec);
+
+	hash = intern_hash(ident, ident_len);
+	e = intern_find(&t->idents, ident, ident_len, hash);
+	if (e == NULL) {
+		/* Keep the identity as burstnetsink -v prints it */
+		char name[2 + 2 * OUTSTANDING_KEY_MAX + 1] = "0x";
+		size_t i;
+
+		if (t->n_idents == THROUGHPUT_MAX_IDENTS || ident_len > OUTSTANDING_KEY_MAX)
+			return;
+		for (i = 0; i < ident_len; i++)
+			sprintf(name + 2 + 2 * i, "%02x", ident[i]);
+		e = intern_add(&t->idents, ident, ident_len, hash, name, 2 + 2 * ident_len + 1);
+		e->id = t->n_idents++;
+	}
+	lathist_record_bucket(&t->ident_60[e->id], bucket);
+	lathist_record_bucket(&t->ident_all[e->id], bucket);
+
+	if (bin->n == bin->size) {
+		bin->size = bin->size ? bin->size * 2 : 1024;
+		bin->samples = alloc_or_die(realloc(bin->samples, bin->size * sizeof(*bin->samples)));
+	}
+	bin->samples[bin->n++] = SAMPLE(e->id, bucket);
+}
+
+void throughput_ack(struct throughput *t, const void *ident, size_t ident_len,
+		const void *msg_id, size_t msg_id_len, double now) {
+	double received;
+	uint32_t points;
+
+	tick(t, now);
+	if (!outstanding_ack(&t->outstanding, ident, ident_len, msg_id, msg_id_len, &received, &points))
+		return;
+
+	t->acks.bins[t->current_bin] += points;
+	t->acked_bursts.bins[t->current_bin] += 1;
+	t->latency.bins[t->current_bin] += now - received;
+	record_latency(t, ident, ident_len, (now - received) * 1e6 + 0.5);
+}
+
+/* Give up on bursts that have waited too long for their ack, and say how
+ * many we've given up on since last time
+ */
+static void expire(struct throughput *t, double now) {
+	struct outstanding *o = &t->outstanding;
+
+	if (t->expire_after <= 0 || outstanding_expire(o, now - t->expire_after) == 0)
+		return;
+	fprintf(stderr, "%lu bursts (%lu points) not acked after %g seconds, given up on. %lu outstanding\n",
+		o->expired - t->expired_reported, o->expired_points - t->expired_points_reported,
+		t->expire_after, o->count);
+	t->expired_reported = o->expired;
+	t->expired_points_reported = o->expired_points;
+}
+
+/* Print the percentiles of each latency window, in milliseconds */
+static void print_percentiles(const struct lathist *h, FILE *fp) {
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+		fprintf(fp, " %9.2f", lathist_percentile(h, percentiles[i]) / 1e3);
+	fprintf(fp, " %9.2f", lathist_max(h) / 1e3);
+}
+
+/* Print each identity's latencies over the same windows as the line
+ * before, for those that have had an ack in the last THROUGHPUT_BINS
+ * seconds
+ */
+static void print_idents(struct throughput *t, FILE *fp) {
+	const struct ident_samples *last =
+		&t->ident_bins[(t->current_bin - 1 + THROUGHPUT_BINS) % THROUGHPUT_BINS];
+	size_t i, j;
+
+	fputs("#                                acks"
+		"                ack latency (ms), last 600 seconds  "
+		"                 ack latency (ms), last 60 seconds  "
+		"                     ack latency (ms), last second\n"
+		"# identity                   (600sec)"
+		"       p50       p90       p99     p99.9       max  "
+		"       p50       p90       p99     p99.9       max  "
+		"       p50       p90       p99     p99.9       max\n", fp);
+	for (i = 0; i < t->idents.n_slots; i++) {
+		struct intern_entry *e = &t->idents.slots[i];
+
+		if (!e->used || t->ident_all[e->id].count == 0)
+			continue;
+
+		/* Nothing keeps a second's worth by identity, so pick it
+		 * out of the bin's samples */
+		lathist_reset(&t->ident_scratch);
+		for (j = 0; j < last->n; j++)
+			if (SAMPLE_ID(last->samples[j]) == e->id)
+				lathist_record_bucket(&t->ident_scratch, SAMPLE_BUCKET(last->samples[j]));
+
+		fprintf(fp, "  %-24s %10lu", intern_string(&t->idents, e), t->ident_all[e->id].count);
+		print_percentiles(&t->ident_all[e->id], fp);
+		fputs("  ", fp);
+		print_percentiles(&t->ident_60[e->id], fp);
+		fputs("  ", fp);
+		print_percentiles(&t->ident_scratch, fp);
+		fputc('\n', fp);
+	}
+}
+
+void throughput_print(struct throughput *t, FILE *fp, double now) {
+	unsigned int i;
+
+	tick(t, now);
+	expire(t, now);
+	if (t->percentiles) {
+		const struct lathist *windows[] = {
+			&t->latency_all, &t->latency_60,
+			&t->latency_bins[(t->current_bin - 1 + THROUGHPUT_BINS) % THROUGHPUT_BINS]
+		};
+
+		if (t->lines_printed++ % 20 == 0)
+			fputs("#       ack latency (ms), last 600 seconds      "
+				"            ack latency (ms), last 60 seconds     "
+				"                ack latency (ms), last second\n"
+				"#      p50       p90       p99     p99.9       max"
+				"         p50       p90       p99     p99.9       max"
+				"         p50       p90       p99     p99.9       max\n", fp);
+		for (i = 0; i < N_MEANS; i++) {
+			if (i)
+				fputs("  ", fp);
+			print_percentiles(windows[i], fp);
+		}
+		fputc('\n', fp);
+		if (t->lines_printed % 60 == 0)
+			print_idents(t, fp);
+		return;
+	}
+
+	if (t->lines_printed++ % 20 == 0)
+		fputs("#    mean points per second           mean acks per second"
+			"            mean latency per point          unacked\n"
+			"# (600sec)   (60sec)    (1sec)     (600sec)   (60sec)    (1sec)"
+			"     (600sec)   (60sec)    (1sec)       points\n"
+			"# ----------------------------   ------------------------------"
+			"   ------------------------------   ----------\n", fp);
+
+	for (i = 0; i < N_MEANS; i++)
+		fprintf(fp, " %9.2f", hist_mean(t, &t->points, mean_over[i]));
+	fputs("   ", fp);
+	for (i = 0; i < N_MEANS; i++)
+		fprintf(fp, " %9.2f", hist_mean(t, &t->acks, mean_over[i]));
+	fputs("   ", fp);
+	for (i = 0; i < N_MEANS; i++) {
+		double n = hist_sum(t, &t->acked_bursts, mean_over[i]);
+
+		fprintf(fp, " %9.2f", n > 0 ? hist_sum(t, &t->latency, mean_over[i]) / n : 0);
+	}
+	fprintf(fp, "   %10lu\n", t->outstanding.points);
+}
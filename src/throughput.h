@@ -0,0 +1,116 @@
+/*
+ * throughput - what telemetry/broker_throughput.py works out from
+ * burstnetsink -v -p -b output, without the text in between
+ *
+ * Points received, points acked, ack latency and acked bursts each go
+ * in a rolling histogram of THROUGHPUT_BINS one second bins, and means
+ * over the last 600, 60 and 1 seconds of them are printed once a
+ * second in the same columns broker_throughput.py prints.
+ *
+ * Like broker_throughput.py, the means are over however long we've been
+ * running if that's less, and include the second that's still going.
+ *
+ * Ack latencies also go in log-linear histograms (see lathist.h), one
+ * per second and sums of the last 60 and 600 of those, so with
+ * percentiles set the line has the 50th, 90th, 99th and 99.9th
+ * percentile and biggest latency over each window instead (the last
+ * whole second, rather than the one that's only just started). Every 60
+ * lines the same is printed for each identity. Rather than a histogram
+ * per identity per second, each second keeps which identity and bucket
+ * its latencies went in, to take them back out of that identity's 60
+ * and THROUGHPUT_BINS second histograms as they drop out of the window.
+ *
+ * Bursts are remembered by identity and message id until their ack
+ * turns up, which is when their latency is known (see outstanding.h).
+ * Bursts that haven't been acked expire_after seconds on are given up
+ * on, and said so on stderr. With expire_after 0 they stay outstanding
+ * (and count as unacked points) forever, same as they do in
+ * broker_throughput.py.
+ *
+ * Times are seconds, from whatever clock the caller likes so long as it
+ * doesn't go backwards. Not thread safe.
+ */
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "intern.h"
+#include "lathist.h"
+#include "outstanding.h"
+
+#define THROUGHPUT_BINS		600
+
+/* Most identities we'll keep latencies of. Any more only count overall */
+#define THROUGHPUT_MAX_IDENTS	1024
+
+struct time_hist {
+	double bins[THROUGHPUT_BINS];
+};
+
+/* Latencies recorded for identities in one bin: the identity's ID in
+ * the top 16 bits and the lathist bucket in the bottom 16
+ */
+struct ident_samples {
+	uint32_t *samples;
+	size_t n;
+	size_t size;
+};
+
+struct throughput {
+	double last_tick;
+	uint64_t ticks;		/* whole seconds since we started */
+	int current_bin;
+
+	struct time_hist points;
+	struct time_hist bursts;
+	struct time_hist acks;	/* points, when their burst is acked */
+	struct time_hist acked_bursts;
+	struct time_hist latency;
+
+	/* Ack latency in microseconds: a histogram for each bin, and the
+	 * last 60 and THROUGHPUT_BINS of them added up
+	 */
+	int percentiles;	/* print these rather than the means */
+	struct lathist *latency_bins;
+	struct lathist latency_60;
+	struct lathist latency_all;
+
+	/* ...and by identity: what went in each bin, and the last 60 and
+	 * THROUGHPUT_BINS of them added up for each identity
+	 */
+	struct intern_table idents;
+	struct ident_samples *ident_bins;
+	struct lathist *ident_60;
+	struct lathist *ident_all;
+	struct lathist ident_scratch;	/* the last second, when printing */
+	size_t n_idents;
+
+	struct outstanding outstanding;
+	double expire_after;
+	uint64_t expired_reported;
+	uint64_t expired_points_reported;
+
+	unsigned long lines_printed;
+};
+
+void throughput_init(struct throughput *t, double now);
+void throughput_free(struct throughput *t);
+
+/* A burst of points frames came in from ident with msg_id */
+void throughput_burst(struct throughput *t, const void *ident, size_t ident_len,
+	const void *msg_id, size_t msg_id_len, uint32_t points, double now);
+
+/* ingestd acked ident's msg_id. Acks for bursts we never saw are ignored
+ */
+void throughput_ack(struct throughput *t, const void *ident, size_t ident_len,
+	const void *msg_id, size_t msg_id_len, double now);
+
+/* Print a line of means (or percentiles), with the column headings
+ * every 20 lines
+ */
+void throughput_print(struct throughput *t, FILE *fp, double now);
+
+#endif
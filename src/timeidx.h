@@ -0,0 +1,57 @@
+/*
+ * timeidx.h - time index of a burstnetsink capture
+ *
+ * burstnetsink -I writes one of these alongside whatever it's writing to
+ * stdout, so that framecat -i can go straight to the part of a capture
+ * holding the time range it's been asked for (-T) rather than reading
+ * all of it.
+ *
+ * The index is a header:
+ *
+ *	[ 8 bytes magic, TIMEIDX_MAGIC ]
+ *	[ 4 bytes what the capture holds, TIMEIDX_BURSTS or TIMEIDX_FRAMES ]
+ *	[ 4 bytes reserved ]
+ *
+ * followed by a struct timeidx_entry for each span of the capture, in
+ * the order they were written. A span is a run of whole length prefixed
+ * records (bursts, or frames with -f) at least the span size long, or
+ * just the one burst's worth if the span size is 0. min_timestamp and
+ * max_timestamp are those of the frames in the span; max_so_far is the
+ * biggest max_timestamp of it and every span before it, so it never
+ * goes down and can be binary searched for the first span that might
+ * hold a given time. A span without a single timestamp in it has a
+ * min_timestamp bigger than its max_timestamp, so it never matches.
+ *
+ * Entries only go in once their span has been written, so whatever
+ * comes after the last one is unindexed (a span that was still filling
+ * up when burstnetsink stopped) and has to be read regardless.
+ *
+ * Offsets are from the start of the capture file. Everything is little
+ * endian.
+ */
+#ifndef TIMEIDX_H
+#define TIMEIDX_H
+
+#include <stdint.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error timeidx files are read and written in place, so little endian only
+#endif
+
+#define TIMEIDX_MAGIC		"BNTIDX01"
+#define TIMEIDX_HEADER_SIZE	16
+
+#define TIMEIDX_BURSTS		1
+#define TIMEIDX_FRAMES		2
+
+#define TIMEIDX_DEFAULT_SPAN	(1024 * 1024)
+
+struct timeidx_entry {
+	uint64_t offset;
+	uint64_t len;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	uint64_t max_so_far;
+};
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * wire - decode DataFrames and DataBursts straight off the wire
+ */
+#include <string.h>
+#include <endian.h>
+
+#include "wire.h"
+
+#define KEY(field, wire_type)	WIRE_KEY(field, wire_type)
+
+int wire_skip(const uint8_t **p, const uint8_t *end, int wire_type) {
+	uint64_t v;
+
+	switch (wire_type) {
+		case WIRE_VARINT:
+			return wire_varint(p, end, &v);
+		case WIRE_FIXED64:
+			if (end - *p < 8) return -1;
+			*p += 8;
+			return 0;
+		case WIRE_LEN:
+			if (wire_varint(p, end, &v) < 0 || v > end - *p)
+				return -1;
+			*p += v;
+			return 0;
+		case WIRE_FIXED32:
+			if (end - *p < 4) return -1;
+			*p += 4;
+			return 0;
+	}
+	return -1;
+}
+
+static int read_bytes(const uint8_t **p, const uint8_t *end, struct wire_bytes *bytes) {
+	uint64_t len;
+
+	if (wire_varint(p, end, &len) < 0 || len > end - *p)
+		return -1;
+	bytes->data = *p;
+	bytes->len = len;
+	*p += len;
+	return 0;
+}
+
+static int read_fixed64(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+	if (end - *p < 8)
+		return -1;
+	memcpy(v, *p, sizeof(*v));
+	*v = le64toh(*v);
+	*p += 8;
+	return 0;
+}
+
+/* A field we know about turning up with the wrong wire type is an error,
+ * anything else we've never heard of gets skipped.
+ */
+static int skip_unknown(const uint8_t **p, const uint8_t *end, uint64_t key, int known_fields) {
+	uint64_t field = key >> 3;
+
+	if (field == 0 || field <= known_fields)
+		return -1;
+	return wire_skip(p, end, key & 7);
+}
+
+/* DataFrame.Tag, both fields required */
+int wire_decode_tag(const uint8_t *p, const uint8_t *end, struct wire_tag *tag) {
+	int have = 0;
+
+	while (p < end) {
+		uint64_t key;
+
+		if (wire_varint(&p, end, &key) < 0)
+			return -1;
+		switch (key) {
+			case KEY(1, WIRE_LEN):
+				if (read_bytes(&p, end, &tag->field) < 0) return -1;
+				have |= 1;
+				break;
+			case KEY(2, WIRE_LEN):
+				if (read_bytes(&p, end, &tag->value) < 0) return -1;
+				have |= 2;
+				break;
+			default:
+				if (skip_unknown(&p, end, key, 2) < 0) return -1;
+		}
+	}
+	return have == 3 ? 0 : -1;
+}
+
+int wire_decode_frame(const uint8_t *buf, size_t len, struct wire_frame *frame) {
+	const uint8_t *p = buf, *end = buf + len;
+	int have_timestamp = 0, have_payload = 0;
+	struct wire_bytes bytes;
+	struct wire_tag tag;
+	uint64_t v;
+
+	frame->source = NULL;
+	frame->source_end = NULL;
+	frame->end = end;
+	frame->n_source = 0;
+
+	/* Whatever isn't there reads as 0 or empty, like protobuf-c */
+	frame->has = 0;
+	frame->value_numeric = 0;
+	frame->value_measurement = 0;
+	memset(&frame->value_textual, 0, sizeof(frame->value_textual));
+	memset(&frame->value_blob, 0, sizeof(frame->value_blob));
+	memset(&frame->origin, 0, sizeof(frame->origin));
+
+	while (p < end) {
+		const uint8_t *start = p;
+		uint64_t key;
+
+		if (wire_varint(&p, end, &key) < 0)
+			return -1;
+		switch (key) {
+			case KEY(1, WIRE_LEN):
+				if (read_bytes(&p, end, &bytes) < 0
+						|| wire_decode_tag(bytes.data, bytes.data + bytes.len, &tag) < 0)
+					return -1;
+				if (frame->source == NULL)
+					frame->source = start;
+				frame->source_end = p;
+				frame->n_source++;
+				break;
+			case KEY(2, WIRE_FIXED64):
+				if (read_fixed64(&p, end, &frame->timestamp) < 0) return -1;
+				have_timestamp = 1;
+				break;
+			case KEY(3, WIRE_VARINT):
+				if (wire_varint(&p, end, &v) < 0) return -1;
+				frame->payload = (enum wire_payload)v;
+				have_payload = 1;
+				break;
+			case KEY(4, WIRE_VARINT):
+				if (wire_varint(&p, end, &v) < 0) return -1;
+				frame->value_numeric = (int64_t)v;
+				frame->has |= WIRE_HAS_NUMERIC;
+				break;
+			case KEY(5, WIRE_FIXED64):
+				if (read_fixed64(&p, end, &v) < 0) return -1;
+				memcpy(&frame->value_measurement, &v, sizeof(v));
+				frame->has |= WIRE_HAS_MEASUREMENT;
+				break;
+			case KEY(6, WIRE_LEN):
+				if (read_bytes(&p, end, &frame->value_textual) < 0) return -1;
+				frame->has |= WIRE_HAS_TEXTUAL;
+				break;
+			case KEY(7, WIRE_LEN):
+				if (read_bytes(&p, end, &frame->value_blob) < 0) return -1;
+				frame->has |= WIRE_HAS_BLOB;
+				break;
+			case KEY(8, WIRE_LEN):
+				if (read_bytes(&p, end, &frame->origin) < 0) return -1;
+				frame->has |= WIRE_HAS_ORIGIN;
+				break;
+			default:
+				if (skip_unknown(&p, end, key, 8) < 0) return -1;
+		}
+	}
+
+	return have_timestamp && have_payload ? 0 : -1;
+}
+
+int wire_frame_timestamp(const uint8_t *buf, size_t len, uint64_t *timestamp) {
+	const uint8_t *p = buf, *end = buf + len;
+
+	while (p < end) {
+		uint64_t key;
+
+		if (wire_varint(&p, end, &key) < 0)
+			return -1;
+		if (key == KEY(2, WIRE_FIXED64))
+			return read_fixed64(&p, end, timestamp);
+		if (wire_skip(&p, end, key & 7) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+int wire_next_tag(const struct wire_frame *frame, const uint8_t **cursor, struct wire_tag *tag) {
+	const uint8_t *p = *cursor;
+	struct wire_bytes bytes;
+
+	if (p == NULL)
+		return 0;
+
+	/* wire_decode_frame() has already checked all of this over */
+	while (p < frame->end) {
+		uint64_t key;
+
+		if (wire_varint(&p, frame->end, &key) < 0)
+			return 0;
+		if (key != KEY(1, WIRE_LEN)) {
+			if (wire_skip(&p, frame->end, key & 7) < 0)
+				return 0;
+			continue;
+		}
+		if (read_bytes(&p, frame->end, &bytes) < 0
+				|| wire_decode_tag(bytes.data, bytes.data + bytes.len, tag) < 0)
+			return 0;
+		*cursor = p;
+		return 1;
+	}
+	*cursor = p;
+	return 0;
+}
+
+int wire_burst_next(const uint8_t **cursor, const uint8_t *end, struct wire_bytes *frame) {
+	while (*cursor < end) {
+		uint64_t key;
+
+		if (wire_varint(cursor, end, &key) < 0)
+			return -1;
+		if (key == KEY(1, WIRE_LEN))
+			return read_bytes(cursor, end, frame) < 0 ? -1 : 1;
+		if (skip_unknown(cursor, end, key, 1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Finding frames in a burst
+ *
+ * There's no getting around finding each frame's length before we know
+ * where the next one starts, so each frame costs at least a load that
+ * depends on the one before. Prefetching well ahead keeps that load in
+ * L1.
+ *
+ * The scalar scanner branches on how long the length varint is, and
+ * the CPU guesses right nearly every time, so it can get on with the
+ * next frame before it knows. The vector scanners load the key and
+ * length in one go and find the end of the varint from the continuation
+ * bits without branching, which puts all of that on the critical path
+ * instead. wire_bench shows the scalar scanner well ahead on the
+ * machines we've tried, so that's what we use unless told otherwise.
+ *
+ * Anything that isn't a frame, and the last few bytes, go the long way.
+ */
+
+/* How far ahead of the frame we're on to prefetch */
+#define PREFETCH_DISTANCE	1024
+
+static long index_scalar(const uint8_t *buf, size_t len, struct wire_bytes *frames, size_t max) {
+	const uint8_t *p = buf, *end = buf + len;
+	long n = 0;
+	int ret;
+
+	while (p < end) {
+		struct wire_bytes frame;
+
+		__builtin_prefetch(p + PREFETCH_DISTANCE);
+		if (end - p >= 3 && p[0] == KEY(1, WIRE_LEN) && !(p[1] & 0x80)) {
+			frame.len = p[1];
+			p += 2;
+		} else if (end - p >= 3 && p[0] == KEY(1, WIRE_LEN) && !(p[2] & 0x80)) {
+			frame.len = (p[1] & 0x7f) | (p[2] << 7);
+			p += 3;
+		} else {
+			ret = wire_burst_next(&p, end, &frame);
+			if (ret <= 0)
+				return ret < 0 ? -1 : n;
+			goto found;
+		}
+
+		if (frame.len > end - p)
+			return -1;
+		frame.data = p;
+		p += frame.len;
+	found:
+		if (n < max)
+			frames[n] = frame;
+		n++;
+	}
+	return n;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* Bursts come from a uint32 sized buffer, so no frame length needs more
+ * than 5 varint bytes unless it's padded out
+ */
+#define MAX_LENGTH_BYTES	5
+
+/* The low 7 bits of each of the bytes in x, packed together */
+static inline uint64_t pack_varint(uint64_t x) {
+	return (x & 0x7f)
+		| ((x >> 1) & (0x7fULL << 7))
+		| ((x >> 2) & (0x7fULL << 14))
+		| ((x >> 3) & (0x7fULL << 21))
+		| ((x >> 4) & (0x7fULL << 28));
+}
+
+__attribute__((target("bmi2")))
+static inline uint64_t pext_varint(uint64_t x) {
+	return _pext_u64(x, 0x7f7f7f7f7fULL);
+}
+
+#define INDEX_FRAMES(pack) do {						\
+	const uint8_t *p = buf, *end = buf + len;			\
+	long n = 0, tail;						\
+									\
+	/* The key, and 16 bytes after it for the length */		\
+	while (end - p >= 17) {						\
+		unsigned int more;					\
+		uint64_t x, frame_len;					\
+		int len_bytes;						\
+									\
+		__builtin_prefetch(p + PREFETCH_DISTANCE);		\
+		if (*p != KEY(1, WIRE_LEN)) {				\
+			uint64_t key;					\
+			if (wire_varint(&p, end, &key) < 0		\
+					|| skip_unknown(&p, end, key, 1) < 0)	\
+				return -1;				\
+			continue;					\
+		}							\
+									\
+		more = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + 1))); \
+		len_bytes = __builtin_ctz(~more) + 1;			\
+		if (len_bytes > MAX_LENGTH_BYTES) {			\
+			struct wire_bytes frame;			\
+			if (wire_burst_next(&p, end, &frame) < 0)	\
+				return -1;				\
+			if (n < max)					\
+				frames[n] = frame;			\
+			n++;						\
+			continue;					\
+		}							\
+		memcpy(&x, p + 1, sizeof(x));				\
+		x = le64toh(x) & (~0ULL >> (64 - 8 * len_bytes));	\
+		frame_len = pack(x);					\
+									\
+		p += 1 + len_bytes;					\
+		if (frame_len > end - p)				\
+			return -1;					\
+		if (n < max) {						\
+			frames[n].data = p;				\
+			frames[n].len = frame_len;			\
+		}							\
+		n++;							\
+		p += frame_len;						\
+	}								\
+									\
+	tail = n < max							\
+		? index_scalar(p, end - p, frames + n, max - n)		\
+		: index_scalar(p, end - p, NULL, 0);			\
+	return tail < 0 ? -1 : n + tail;				\
+} while (0)
+
+static long index_sse2(const uint8_t *buf, size_t len, struct wire_bytes *frames, size_t max) {
+	INDEX_FRAMES(pack_varint);
+}
+
+__attribute__((target("bmi2")))
+static long index_bmi2(const uint8_t *buf, size_t len, struct wire_bytes *frames, size_t max) {
+	INDEX_FRAMES(pext_varint);
+}
+#endif
+
+typedef long (*index_fn)(const uint8_t *, size_t, struct wire_bytes *, size_t);
+
+static index_fn scanner = index_scalar;
+static const char *scanner_name = "scalar";
+
+int wire_set_scanner(enum wire_scanner which) {
+	index_fn fn = index_scalar;
+	const char *name = "scalar";
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	switch (which) {
+		case WIRE_SCAN_BMI2:
+			if (!__builtin_cpu_supports("bmi2"))
+				return -1;
+			fn = index_bmi2;
+			name = "bmi2";
+			break;
+		case WIRE_SCAN_SSE2:
+			fn = index_sse2;
+			name = "sse2";
+			break;
+		default:
+			break;
+	}
+#else
+	if (which != WIRE_SCAN_AUTO && which != WIRE_SCAN_SCALAR)
+		return -1;
+#endif
+
+	__atomic_store_n(&scanner_name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&scanner, fn, __ATOMIC_RELAXED);
+	return 0;
+}
+
+const char *wire_scanner_name(void) {
+	return __atomic_load_n(&scanner_name, __ATOMIC_RELAXED);
+}
+
+long wire_burst_index(const uint8_t *buf, size_t len, struct wire_bytes *frames, size_t max) {
+	index_fn fn = __atomic_load_n(&scanner, __ATOMIC_RELAXED);
+
+	return fn(buf, len, frames, max);
+}
+
+long wire_burst_count(const uint8_t *buf, size_t len) {
+	return wire_burst_index(buf, len, NULL, 0);
+}
@@ -0,0 +1,167 @@
+/*
+ * wire - decode DataFrames and DataBursts straight off the wire
+ *
+ * A stand in for protobuf-c's unpack functions for just the two messages
+ * in protobuf/DataFrame.proto and protobuf/DataBurst.proto. Nothing is
+ * allocated or copied: strings and blobs come back as views into the
+ * buffer that was decoded, which has to outlive them.
+ */
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* DataFrame.Type */
+enum wire_payload {
+	WIRE_EMPTY = 0,
+	WIRE_NUMBER = 1,
+	WIRE_REAL = 2,
+	WIRE_TEXT = 3,
+	WIRE_BINARY = 4
+};
+
+/* Protobuf wire types */
+#define WIRE_VARINT	0
+#define WIRE_FIXED64	1
+#define WIRE_LEN	2
+#define WIRE_FIXED32	5
+
+/* The key a field starts with */
+#define WIRE_KEY(field, wire_type)	(((field) << 3) | (wire_type))
+
+/* Bytes somewhere in the buffer being decoded. Not null terminated */
+struct wire_bytes {
+	const uint8_t *data;
+	size_t len;
+};
+
+struct wire_tag {
+	struct wire_bytes field;
+	struct wire_bytes value;
+};
+
+/* Which optional fields turned up */
+#define WIRE_HAS_NUMERIC	(1 << 0)
+#define WIRE_HAS_MEASUREMENT	(1 << 1)
+#define WIRE_HAS_TEXTUAL	(1 << 2)
+#define WIRE_HAS_BLOB		(1 << 3)
+#define WIRE_HAS_ORIGIN		(1 << 4)
+
+struct wire_frame {
+	/* Where the source tags are. Walk them with wire_next_tag() */
+	const uint8_t *source;
+	const uint8_t *source_end;	/* just past the last one */
+	const uint8_t *end;
+	size_t n_source;
+
+	uint64_t timestamp;
+	enum wire_payload payload;
+
+	unsigned int has;
+	int64_t value_numeric;
+	double value_measurement;
+	struct wire_bytes value_textual;
+	struct wire_bytes value_blob;
+	struct wire_bytes origin;
+};
+
+/* Read a varint at *p, moving *p past it
+ *
+ * returns -1 if it runs off end or is more than 10 bytes long
+ */
+static inline int wire_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+	const uint8_t *q = *p;
+	uint64_t x = 0;
+	int shift;
+
+	for (shift = 0; shift < 70 && q < end; shift += 7) {
+		uint8_t b = *(q++);
+		x |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = x;
+			*p = q;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Move *p past a field of the given wire type, whose key we've read
+ *
+ * returns -1 if it runs off end or we don't know the wire type
+ */
+int wire_skip(const uint8_t **p, const uint8_t *end, int wire_type);
+
+/* Decode a DataFrame.Tag, the bytes of a source field
+ *
+ * returns -1 if it's malformed
+ */
+int wire_decode_tag(const uint8_t *p, const uint8_t *end, struct wire_tag *tag);
+
+/* Decode the DataFrame in buf, checking it's all there and well formed
+ * (including its source tags) the same way protobuf-c would.
+ *
+ * returns -1 if it isn't
+ */
+int wire_decode_frame(const uint8_t *buf, size_t len, struct wire_frame *frame);
+
+/* Find a frame's timestamp without decoding the rest of it
+ *
+ * returns -1 if it hasn't got one (or is malformed before it)
+ */
+int wire_frame_timestamp(const uint8_t *buf, size_t len, uint64_t *timestamp);
+
+/* Walk the source tags of a decoded frame. *cursor starts as
+ * frame->source
+ *
+ * returns 0 once there are no more
+ */
+int wire_next_tag(const struct wire_frame *frame, const uint8_t **cursor, struct wire_tag *tag);
+
+/* The raw bytes the source tags are in. Two frames with the same bytes
+ * here have the same source, so it's something to look sources up by
+ * (see intern.h)
+ */
+static inline struct wire_bytes wire_frame_source(const struct wire_frame *frame) {
+	struct wire_bytes b = { frame->source, frame->source_end - frame->source };
+	return b;
+}
+
+/* How many frames there are in a DataBurst, without decoding them
+ *
+ * returns -1 if the burst is malformed
+ */
+long wire_burst_count(const uint8_t *buf, size_t len);
+
+/* Find every frame in a DataBurst without decoding them. The first max
+ * go in frames (which can be NULL if max is 0)
+ *
+ * returns how many frames there are, which can be more than max, or -1
+ * if the burst is malformed
+ */
+long wire_burst_index(const uint8_t *buf, size_t len, struct wire_bytes *frames, size_t max);
+
+/* Ways wire_burst_index() can look for frames. By default it uses the
+ * scalar one, see wire.c for why
+ */
+enum wire_scanner {
+	WIRE_SCAN_AUTO,
+	WIRE_SCAN_SCALAR,
+	WIRE_SCAN_SSE2,		/* one load and movemask per frame header */
+	WIRE_SCAN_BMI2		/* and pext to put the length together */
+};
+
+/* returns -1 if this CPU can't run it
+ */
+int wire_set_scanner(enum wire_scanner scanner);
+const char *wire_scanner_name(void);
+
+/* Walk the frames in a DataBurst. *cursor starts as buf
+ *
+ * returns 1 and sets frame to the next one, 0 at the end of the burst,
+ * or -1 if the burst is malformed
+ */
+int wire_burst_next(const uint8_t **cursor, const uint8_t *end, struct wire_bytes *frame);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * wire_bench: how fast can we find (and decode) the frames in a DataBurst
+ *
+ * Builds some DataBursts that look like what marquise clients send us
+ * (1600 frames a burst by default, which is what collator_thread
+ * telemetry shows) and times protobuf-c against the wire decoder, with
+ * each of the frame scanners the CPU can run.
+ *
+ * wire_bench [bursts] [frames per burst]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "DataFrame.pb-c.h"
+#include "DataBurst.pb-c.h"
+#include "wire.h"
+
+/* Keep going for at least this long on each test */
+#define MIN_SECONDS	1.0
+
+/* Most source tags a frame gets */
+#define MAX_TAGS	5
+
+struct burst {
+	uint8_t *buf;
+	size_t len;
+};
+
+static const char *hosts[] = { "astrolabe", "fishhook", "tamborine", "gunnedah", "tuggerah" };
+static const char *metrics[] = { "cpu", "load1", "load5", "rx_bytes", "tx_bytes", "disk_used" };
+static const char *services[] = { "collectd", "nagios", "marquise" };
+static const char *collection_points[] = {
+	"syd1",
+	"syd1.rack4.chassis2.blade7",
+	"sydney/equinix-sy3/row-f/rack-14/pdu-b/outlet-22",
+	"melbourne/nextdc-m1/hall-2/row-c/rack-09/switch-2/port-47/vlan-1180/subif-3",
+};
+
+static struct burst make_burst(int n_frames, uint64_t *ts) {
+	DataBurst burst = DATA_BURST__INIT;
+	DataFrame *frames, **framep;
+	DataFrame__Tag *tags, **tagp;
+	char (*values)[32];
+	struct burst b;
+	int i, t;
+
+	frames = calloc(n_frames, sizeof(*frames));
+	framep = calloc(n_frames, sizeof(*framep));
+	tags = calloc(n_frames * MAX_TAGS, sizeof(*tags));
+	tagp = calloc(n_frames * MAX_TAGS, sizeof(*tagp));
+	values = calloc(n_frames, sizeof(*values));
+	if (!frames || !framep || !tags || !tagp || !values)
+		perror("calloc"), exit(1);
+
+	for (i = 0; i < n_frames; i++) {
+		DataFrame *f = &frames[i];
+
+		data_frame__init(f);
+		f->n_source = 3 + rand() % (MAX_TAGS - 2);
+		f->source = &tagp[i * MAX_TAGS];
+		for (t = 0; t < f->n_source; t++) {
+			DataFrame__Tag *tag = &tags[i * MAX_TAGS + t];
+
+			data_frame__tag__init(tag);
+			switch (t) {
+				case 0: tag->field = "hostname"; tag->value = (char *)hosts[rand() % 5]; break;
+				case 1: tag->field = "metric"; tag->value = (char *)metrics[rand() % 6]; break;
+				case 2: tag->field = "service"; tag->value = (char *)services[rand() % 3]; break;
+				case 3: tag->field = "unit"; tag->value = "bytes"; break;
+				default:
+					tag->field = "collection_point";
+					tag->value = (char *)collection_points[rand() % 4];
+			}
+			f->source[t] = tag;
+		}
+
+		f->timestamp = (*ts += 1000000 + rand() % 1000);
+		switch (rand() % 8) {
+			case 0:
+				f->payload = DATA_FRAME__TYPE__TEXT;
+				snprintf(values[i], sizeof(values[i]), "state_%d", rand() % 100);
+				f->value_textual = values[i];
+				break;
+			case 1:
+			case 2:
+				f->payload = DATA_FRAME__TYPE__NUMBER;
+				f->has_value_numeric = 1;
+				f->value_numeric = rand();
+				break;
+			default:
+				f->payload = DATA_FRAME__TYPE__REAL;
+				f->has_value_measurement = 1;
+				f->value_measurement = rand() / 1000.0;
+		}
+		framep[i] = f;
+	}
+
+	burst.n_frames = n_frames;
+	burst.frames = framep;
+	b.len = data_burst__get_packed_size(&burst);
+	b.buf = malloc(b.len);
+	if (b.buf == NULL)
+		perror("malloc"), exit(1);
+	data_burst__pack(&burst, b.buf);
+
+	free(values);
+	free(tagp);
+	free(tags);
+	free(framep);
+	free(frames);
+	return b;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run test over every burst until MIN_SECONDS is up, and say how it went
+ *
+ * test returns how many frames it found (or -1)
+ */
+static void run(const char *name, long (*test)(struct burst *, struct wire_bytes *),
+		struct burst *bursts, int n_bursts, long expect, struct wire_bytes *index) {
+	double start = now(), elapsed;
+	long frames = 0;
+	int i;
+
+	do {
+		for (i = 0; i < n_bursts; i++) {
+			long n = test(&bursts[i], index);
+			if (n != expect) {
+				fprintf(stderr, "%s: found %ld frames, not %ld\n", name, n, expect);
+				exit(1);
+			}
+			frames += n;
+		}
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	printf("%-32s %8.2f ns/frame %8.2f Mframes/s\n", name,
+		elapsed * 1e9 / frames, frames / elapsed / 1e6);
+}
+
+/* What burstnetsink -p and framecat used to do */
+static long pbc_count(struct burst *b, struct wire_bytes *index) {
+	DataBurst *db = data_burst__unpack(NULL, b->len, b->buf);
+	long n;
+
+	if (db == NULL)
+		return -1;
+	n = db->n_frames;
+	data_burst__free_unpacked(db, NULL);
+	return n;
+}
+
+static long wire_count(struct burst *b, struct wire_bytes *index) {
+	return wire_burst_index(b->buf, b->len, NULL, 0);
+}
+
+static size_t index_size;
+
+static long wire_index(struct burst *b, struct wire_bytes *index) {
+	return wire_burst_index(b->buf, b->len, index, index_size);
+}
+
+static long wire_decode(struct burst *b, struct wire_bytes *index) {
+	struct wire_frame frame;
+	long i, n;
+
+	n = wire_burst_index(b->buf, b->len, index, index_size);
+	for (i = 0; i < n; i++)
+		if (wire_decode_frame(index[i].data, index[i].len, &frame) < 0)
+			return -1;
+	return n;
+}
+
+int main(int argc, char **argv) {
+	static const struct {
+		enum wire_scanner scanner;
+		const char *name;
+	} scanners[] = {
+		{ WIRE_SCAN_SCALAR, "scalar" },
+		{ WIRE_SCAN_SSE2, "sse2" },
+		{ WIRE_SCAN_BMI2, "bmi2" },
+	};
+	int n_bursts = argc > 1 ? atoi(argv[1]) : 64;
+	int n_frames = argc > 2 ? atoi(argv[2]) : 1600;
+	struct wire_bytes *index;
+	struct burst *bursts;
+	uint64_t ts = 1395212042000000000ULL;
+	size_t total = 0;
+	char name[64];
+	int i;
+
+	if (n_bursts < 1 || n_frames < 1) {
+		fprintf(stderr, "%s [bursts] [frames per burst]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	bursts = calloc(n_bursts, sizeof(*bursts));
+	index = calloc(n_frames, sizeof(*index));
+	if (bursts == NULL || index == NULL)
+		return perror("calloc"), 1;
+	index_size = n_frames;
+	for (i = 0; i < n_bursts; i++) {
+		bursts[i] = make_burst(n_frames, &ts);
+		total += bursts[i].len;
+	}
+	printf("%d bursts of %d frames, %zu bytes a burst on average\n\n",
+		n_bursts, n_frames, total / n_bursts);
+
+	run("protobuf-c unpack", pbc_count, bursts, n_bursts, n_frames, index);
+
+	for (i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+		if (wire_set_scanner(scanners[i].scanner) < 0) {
+			printf("%-32s not supported on this CPU\n", scanners[i].name);
+			continue;
+		}
+		snprintf(name, sizeof(name), "%s count", scanners[i].name);
+		run(name, wire_count, bursts, n_bursts, n_frames, index);
+		snprintf(name, sizeof(name), "%s index", scanners[i].name);
+		run(name, wire_index, bursts, n_bursts, n_frames, index);
+		snprintf(name, sizeof(name), "%s index + decode", scanners[i].name);
+		run(name, wire_decode, bursts, n_bursts, n_frames, index);
+	}
+
+	for (i = 0; i < n_bursts; i++)
+		free(bursts[i].buf);
+	free(bursts);
+	free(index);
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * wire_test: check the wire decoder and burst splitter over frames and
+ * bursts protobuf-c had no trouble with, and that they once got wrong
+ *
+ * make check builds and runs it. Exits 1 if anything fails
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wire.h"
+#include "burststream.h"
+
+static int failures;
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+		failures++;						\
+	}								\
+} while (0)
+
+/* A message being put together */
+struct msg {
+	uint8_t buf[256];
+	size_t len;
+};
+
+static void put_varint(struct msg *m, uint64_t v) {
+	while (v >= 0x80) {
+		m->buf[m->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	m->buf[m->len++] = v;
+}
+
+static void put_fixed64(struct msg *m, uint64_t v) {
+	int i;
+
+	for (i = 0; i < 8; i++)
+		m->buf[m->len++] = v >> (8 * i);
+}
+
+static void put_bytes(struct msg *m, int field, const void *data, size_t len) {
+	put_varint(m, WIRE_KEY(field, WIRE_LEN));
+	put_varint(m, len);
+	memcpy(m->buf + m->len, data, len);
+	m->len += len;
+}
+
+/* A frame with one source tag, a timestamp and a payload type, and none
+ * of the optional fields
+ */
+static void put_frame_header(struct msg *m, enum wire_payload payload) {
+	static const uint8_t tag[] = { 0x0a, 4, 'h', 'o', 's', 't', 0x12, 1, 'a' };
+
+	m->len = 0;
+	put_bytes(m, 1, tag, sizeof(tag));
+	put_varint(m, WIRE_KEY(2, WIRE_FIXED64));
+	put_fixed64(m, 1395212041732118000ULL);
+	put_varint(m, WIRE_KEY(3, WIRE_VARINT));
+	put_varint(m, payload);
+}
+
+/* Frames that leave out their optional fields read them as 0 or empty,
+ * whatever was decoded into the same wire_frame before
+ */
+static void test_missing_fields(void) {
+	struct wire_frame frame;
+	struct msg m;
+	double real = 4.5;
+	uint64_t bits;
+
+	memset(&frame, 0xa5, sizeof(frame));
+	put_frame_header(&m, WIRE_NUMBER);
+	put_varint(&m, WIRE_KEY(4, WIRE_VARINT));
+	put_varint(&m, 42);
+	put_varint(&m, WIRE_KEY(5, WIRE_FIXED64));
+	memcpy(&bits, &real, sizeof(bits));
+	put_fixed64(&m, bits);
+	put_bytes(&m, 6, "hello", 5);
+	put_bytes(&m, 7, "\x01\x02", 2);
+	put_bytes(&m, 8, "origin", 6);
+	CHECK(wire_decode_frame(m.buf, m.len, &frame) == 0);
+	CHECK(frame.has == (WIRE_HAS_NUMERIC | WIRE_HAS_MEASUREMENT
+		| WIRE_HAS_TEXTUAL | WIRE_HAS_BLOB | WIRE_HAS_ORIGIN));
+	CHECK(frame.value_numeric == 42);
+	CHECK(frame.value_measurement == 4.5);
+	CHECK(frame.value_textual.len == 5);
+	CHECK(frame.value_blob.len == 2);
+	CHECK(frame.origin.len == 6);
+
+	put_frame_header(&m, WIRE_NUMBER);
+	CHECK(wire_decode_frame(m.buf, m.len, &frame) == 0);
+	CHECK(frame.payload == WIRE_NUMBER);
+	CHECK(frame.has == 0);
+	CHECK(frame.value_numeric == 0);
+	CHECK(frame.value_measurement == 0);
+	CHECK(frame.value_textual.len == 0);
+	CHECK(frame.value_blob.len == 0);
+	CHECK(frame.origin.len == 0);
+
+	/* And straight off an uninitialised one */
+	memset(&frame, 0xa5, sizeof(frame));
+	put_frame_header(&m, WIRE_TEXT);
+	CHECK(wire_decode_frame(m.buf, m.len, &frame) == 0);
+	CHECK(frame.payload == WIRE_TEXT);
+	CHECK(frame.has == 0);
+	CHECK(frame.value_numeric == 0);
+	CHECK(frame.value_textual.len == 0);
+	CHECK(frame.value_blob.len == 0);
+	CHECK(frame.origin.len == 0);
+}
+
+/* Every scanner finds the same frames as wire_burst_next(), in bursts
+ * of every length around the 16 and 17 bytes the vector scanners load
+ * at once. Each burst is in a buffer of just its length, so a sanitizer
+ * sees any read past the end
+ */
+static void test_scanners(void) {
+	static const enum wire_scanner scanners[] = {
+		WIRE_SCAN_SCALAR, WIRE_SCAN_SSE2, WIRE_SCAN_BMI2
+	};
+	static const uint8_t payload[64];
+	struct wire_bytes frames[8], expect[8];
+	size_t burst_len, first;
+	unsigned int i;
+
+	for (burst_len = 2; burst_len <= 40; burst_len++) {
+		/* One frame, or two split every way that fits */
+		for (first = 0; first + 2 <= burst_len; first++) {
+			struct msg m = { .len = 0 };
+			const uint8_t *cursor;
+			uint8_t *buf;
+			long n = 0;
+
+			if (first == 0) {
+				put_bytes(&m, 1, payload, burst_len - 2);
+			} else {
+				if (first < 2 || burst_len - first < 2)
+					continue;
+				put_bytes(&m, 1, payload, first - 2);
+				put_bytes(&m, 1, payload, burst_len - first - 2);
+			}
+			CHECK(m.len == burst_len);
+
+			buf = malloc(m.len);
+			if (buf == NULL)
+				perror("malloc"), exit(1);
+			memcpy(buf, m.buf, m.len);
+			cursor = buf;
+			while (wire_burst_next(&cursor, buf + m.len, &expect[n]) > 0)
+				n++;
+
+			for (i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+				long found;
+
+				if (wire_set_scanner(scanners[i]) < 0)
+					continue;
+				memset(frames, 0, sizeof(frames));
+				found = wire_burst_index(buf, m.len, frames, 8);
+				if (found != n) {
+					fprintf(stderr, "%s: %ld frames in a %zu byte burst, not %ld\n",
+						wire_scanner_name(), found, burst_len, n);
+					failures++;
+					continue;
+				}
+				CHECK(memcmp(frames, expect, n * sizeof(frames[0])) == 0);
+				/* A frame cut short is malformed */
+				CHECK(wire_burst_index(buf, m.len - 1, NULL, 0) == -1);
+			}
+			free(buf);
+		}
+	}
+	wire_set_scanner(WIRE_SCAN_AUTO);
+}
+
+static int count_frame(const uint8_t *frame, size_t len, void *ctx) {
+	(void)frame;
+	(void)len;
+	(*(int *)ctx)++;
+	return 0;
+}
+
+/* The splitter gets to the end of a burst whose last field is an empty
+ * one it skips, whether it's fed whole or a byte at a time
+ */
+static void test_splitter(void) {
+	struct frame_splitter s;
+	struct msg m = { .len = 0 };
+	size_t i;
+	int frames;
+
+	put_bytes(&m, 1, "frame", 5);
+	put_bytes(&m, 2, "", 0);
+	splitter_init(&s, 64, count_frame, &frames);
+
+	frames = 0;
+	splitter_reset(&s);
+	CHECK(splitter_feed(m.buf, m.len, &s) == 0);
+	CHECK(splitter_finish(&s) == 0);
+	CHECK(frames == 1);
+
+	frames = 0;
+	splitter_reset(&s);
+	for (i = 0; i < m.len; i++)
+		CHECK(splitter_feed(m.buf + i, 1, &s) == 0);
+	CHECK(splitter_finish(&s) == 0);
+	CHECK(frames == 1);
+
+	/* Cut short inside the frame it's still malformed */
+	splitter_reset(&s);
+	CHECK(splitter_feed(m.buf, 4, &s) == 0);
+	CHECK(splitter_finish(&s) == SPLITTER_MALFORMED);
+	splitter_free(&s);
+}
+
+int main(void) {
+	test_missing_fields();
+	test_scanners();
+	test_splitter();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	puts("wire_test: ok");
+	return 0;
+}